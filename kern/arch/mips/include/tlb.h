@@ -63,10 +63,14 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * Note that the MIPS has support for a 6-bit address space ID. An
+ * entry only matches if its TLBHI_PID field is the same as that of
+ * the entryhi register, which is loaded by all of the functions
+ * above, so an entry written with one PID leaves the processor
+ * matching that PID. (Or, for tlb_read, the PID of the entry read.)
+ * The VM system uses the PID to tell address spaces apart; see
+ * vm.c. TLBLO_GLOBAL, which makes an entry match any PID, can be left
+ * zero, as can the bits that aren't assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,7 +82,8 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -101,5 +106,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of address space IDs (values of TLBHI_PID).
+ */
+
+#define NUM_ASID 64
+
 
 #endif /* _MIPS_TLB_H_ */
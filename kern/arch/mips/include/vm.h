@@ -67,6 +67,12 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/*
+ * The reverse: the physical address behind a kseg0 kernel virtual
+ * address, such as one returned by alloc_kpages.
+ */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -113,14 +119,16 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * A shootdown request carries a whole batch of pages (see
+ * vm_shootdown_start), which stays in the sender's memory until every
+ * target has acknowledged it. Each CPU can have up to 16 batches
+ * queued.
  */
 
+struct vm_shootdown;  /* from <vm.h> */
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct vm_shootdown *ts_batch;	/* pages to invalidate */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -38,6 +38,8 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <kmem_cache.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,15 +61,11 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
-/*
- * Wrap ram_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	coremap_bootstrap();
+	as_bootstrap();
 }
 
 /*
@@ -94,14 +92,7 @@ static
 paddr_t
 getppages(unsigned long npages)
 {
-	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
-	addr = ram_stealmem(npages);
-
-	spinlock_release(&stealmem_lock);
-	return addr;
+	return coremap_alloc(npages);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -121,18 +112,7 @@ alloc_kpages(unsigned npages)
 void
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
-
-	(void)addr;
-}
-
-unsigned
-int
-coremap_used_bytes() {
-
-	/* dumbvm doesn't track page allocations. Return 0 so that khu works. */
-
-	return 0;
+	coremap_free(KVADDR_TO_PADDR(addr));
 }
 
 void
@@ -147,7 +127,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
@@ -222,31 +201,39 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	ehi = faultaddress;
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+
+	/*
+	 * There's no entry for this page (or we wouldn't be here), so
+	 * let the processor pick one to replace.
+	 */
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
+	curcpu->c_tlbfaults++;
+	tlb_random(ehi, elo);
+	splx(spl);
+	return 0;
+}
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
-	}
+static struct kmem_cache *as_cache;
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl);
-	return EFAULT;
+void
+as_bootstrap(void)
+{
+	as_cache = kmem_cache_create("addrspace", sizeof(struct addrspace),
+				     NULL, NULL);
+	if (as_cache == NULL) {
+		panic("as_bootstrap: Out of memory\n");
+	}
 }
 
 struct addrspace *
 as_create(void)
 {
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	struct addrspace *as = kmem_cache_alloc(as_cache);
 	if (as==NULL) {
 		return NULL;
 	}
@@ -266,7 +253,18 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
-	kfree(as);
+
+	/* These are 0 if as_prepare_load never got to them. */
+	if (as->as_pbase1 != 0) {
+		coremap_free(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_free(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_free(as->as_stackpbase);
+	}
+	kmem_cache_free(as_cache, as);
 }
 
 void
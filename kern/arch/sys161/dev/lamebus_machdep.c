@@ -35,6 +35,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <clock.h>
+#include <prof.h>
 #include <thread.h>
 #include <current.h>
 #include <membar.h>
@@ -76,6 +77,20 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Restart the on-chip timer's count from zero. ($9 == c0_count.)
+ */
+static
+void
+mips_timer_clearcount(void)
+{
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		"mtc0 $0, $9;"
+		".set pop");
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -119,6 +134,29 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Idle CPUs turn off their clock tick, so they aren't woken HZ times
+ * a second for nothing. There's no way to disable the on-chip timer,
+ * so instead push the compare value out as far as it goes (about
+ * three minutes at 25 MHz; a spurious tick then does no harm). When
+ * restarting, clear the count, which has been running meanwhile, so
+ * the next tick comes a full period later.
+ */
+void
+mainbus_tick_stop(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	mips_timer_set(0xffffffff);
+}
+
+void
+mainbus_tick_start(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	mips_timer_clearcount();
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Start all secondary CPUs.
  */
@@ -316,6 +354,8 @@ mainbus_interrupt(struct trapframe *tf)
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
 		mips_timer_set(CPU_FREQUENCY / HZ);
+		/* take a profiling sample of whatever we interrupted */
+		prof_sample(tf->tf_epc, (tf->tf_status & CST_KUp) != 0);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
@@ -65,6 +65,10 @@
 /* I/O buffer offset */
 #define EMU_BUFFER    32768
 
+/* Read-ahead window limits for emufs files, in bytes */
+#define EMUFS_RA_MIN  4096
+#define EMUFS_RA_MAX  EMU_MAXIO
+
 /* Operation codes for REG_OPER */
 #define EMU_OP_OPEN          1
 #define EMU_OP_CREATE        2
@@ -529,10 +533,69 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	lock_destroy(ev->ev_lock);
+	kfree(ev->ev_rabuf);
+
 	kfree(ev);
 	return 0;
 }
 
+/*
+ * Read-ahead for files.
+ *
+ * Each emu operation is a synchronous trip out to the host, so
+ * there's no reading ahead in the background; instead, once reads
+ * look sequential (see readahead.h), we read a window's worth past
+ * the end of each read into a per-vnode buffer, and later reads are
+ * served from that. This turns a stream of small reads into a few
+ * large ones. Writes and truncates throw the buffer away.
+ */
+
+/*
+ * Check if the read-ahead buffer holds the byte at POS.
+ */
+static
+bool
+emufs_rahas(struct emufs_vnode *ev, off_t pos)
+{
+	return pos >= ev->ev_rapos && pos < ev->ev_rapos + ev->ev_ralen;
+}
+
+/*
+ * After a sequential read ending at POS, refill the read-ahead buffer
+ * if needed. Errors just mean no read-ahead.
+ */
+static
+void
+emufs_readahead(struct emufs_vnode *ev, off_t pos)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t start, end;
+	int result;
+
+	if (!readahead_next(&ev->ev_ra, pos, &start, &end)) {
+		return;
+	}
+	if (ev->ev_rabuf == NULL) {
+		ev->ev_rabuf = kmalloc(EMUFS_RA_MAX);
+		if (ev->ev_rabuf == NULL) {
+			return;
+		}
+	}
+
+	/* Read from POS, so as to keep whatever's left of the old data */
+	KASSERT(start >= pos && end - pos <= EMUFS_RA_MAX);
+	ev->ev_ralen = 0;
+	uio_kinit(&iov, &ku, ev->ev_rabuf, end - pos, pos, UIO_READ);
+	result = emu_read(ev->ev_emu, ev->ev_handle, end - pos, &ku);
+	if (result) {
+		return;
+	}
+	ev->ev_rapos = pos;
+	ev->ev_ralen = (end - pos) - ku.uio_resid;
+}
+
 /*
  * VOP_READ
  */
@@ -541,13 +604,38 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	enum ra_pattern pattern;
 	uint32_t amt;
 	size_t oldresid;
-	int result;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	lock_acquire(ev->ev_lock);
+
+	pattern = readahead_access(&ev->ev_ra, uio->uio_offset,
+				   uio->uio_offset + uio->uio_resid);
+	if (pattern == RA_READAHEAD) {
+		readahead_adjust(&ev->ev_ra,
+				 emufs_rahas(ev, uio->uio_offset));
+	}
+
 	while (uio->uio_resid > 0) {
+		if (emufs_rahas(ev, uio->uio_offset)) {
+			/* Already have it */
+			amt = ev->ev_rapos + ev->ev_ralen - uio->uio_offset;
+			if (amt > uio->uio_resid) {
+				amt = uio->uio_resid;
+			}
+			result = uiomove(ev->ev_rabuf +
+					 (uio->uio_offset - ev->ev_rapos),
+					 amt, uio);
+			if (result) {
+				break;
+			}
+			continue;
+		}
+
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
 			amt = EMU_MAXIO;
@@ -557,7 +645,7 @@ emufs_read(struct vnode *v, struct uio *uio)
 
 		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -566,7 +654,12 @@ emufs_read(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	if (result == 0 && pattern != RA_RANDOM) {
+		emufs_readahead(ev, uio->uio_offset);
+	}
+
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -599,10 +692,13 @@ emufs_write(struct vnode *v, struct uio *uio)
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
-	int result;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	lock_acquire(ev->ev_lock);
+	ev->ev_ralen = 0;
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -613,7 +709,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -622,7 +718,8 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -725,7 +822,13 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	lock_acquire(ev->ev_lock);
+	ev->ev_ralen = 0;
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -1179,12 +1282,24 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_lock = lock_create("emufs vnode");
+	if (ev->ev_lock == NULL) {
+		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		kfree(ev);
+		return ENOMEM;
+	}
+	readahead_init(&ev->ev_ra, EMUFS_RA_MIN, EMUFS_RA_MAX);
+	ev->ev_rabuf = NULL;
+	ev->ev_rapos = 0;
+	ev->ev_ralen = 0;
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		lock_destroy(ev->ev_lock);
 		kfree(ev);
 		return result;
 	}
@@ -1195,6 +1310,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		lock_destroy(ev->ev_lock);
 		kfree(ev);
 		return result;
 	}
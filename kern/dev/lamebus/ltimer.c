@@ -51,6 +51,20 @@
 
 static bool havetimerclock;
 
+/*
+ * Start a one-shot countdown that ends in a call to timerclock()
+ * in one second.
+ */
+static
+void
+ltimer_arm(void *vlt)
+{
+	struct ltimer_softc *lt = vlt;
+
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
+			   LT_GRANULARITY);
+}
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -86,15 +100,17 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	/*
 	 * We do, however, use ltimer for the timer clock, since the
 	 * on-chip timer can't do that.
+	 *
+	 * Rather than interrupting every second whether anyone cares
+	 * or not, run it one-shot: the clock code calls ltimer_arm
+	 * when it next needs timerclock() called.
 	 */
 	if (!havetimerclock) {
 		havetimerclock = true;
 		lt->lt_timerclock = 1;
 
-		/* Wire it to go off once every second. */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
-				   LT_GRANULARITY);
+		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 0);
+		timerclock_attach(ltimer_arm, lt);
 	}
 
 	return 0;
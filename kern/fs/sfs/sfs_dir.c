@@ -95,18 +95,310 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Hashed directories
+
+/*
+ * These are open-addressed hash tables of directory entries; see
+ * <kern/sfs.h> for the format. Lookups start at the name's home slot
+ * and stop at the first free slot. Removal shifts later entries back
+ * into the hole instead of leaving tombstones, so free slots stay
+ * plain zeroed entries. The table doubles when an insert has to
+ * probe too far, up to the largest power of two that fits in a file.
+ */
+
+#define SFS_DIRPERBLOCK (SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
+/* Grow the table when an insert has to look further than this. */
+#define SFS_HASHDIR_MAXPROBE 16
+
+static
+unsigned
+sfs_hashdir_home(const char *name, unsigned nslots)
+{
+	uint32_t h;
+
+	h = SFS_HASHDIR_HASHINIT;
+	while (*name) {
+		h = SFS_HASHDIR_HASHSTEP(h, *name);
+		name++;
+	}
+	return h & (nslots - 1);
+}
+
+/*
+ * The largest table we can have: a power of two number of slots
+ * that fits within the largest file the inode can map.
+ */
+static
+unsigned
+sfs_hashdir_maxslots(void)
+{
+	unsigned maxblocks, nslots;
+
+	maxblocks = SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB;
+	nslots = SFS_HASHDIR_MINSLOTS;
+	while (nslots * 2 <= maxblocks * SFS_DIRPERBLOCK) {
+		nslots *= 2;
+	}
+	return nslots;
+}
+
+static
+int
+sfs_hashdir_findname(struct sfs_vnode *sv, const char *name,
+		     uint32_t *ino, int *slot)
+{
+	struct sfs_direntry tsd;
+	unsigned nslots, i, n;
+	int result;
+
+	nslots = sfs_dir_nentries(sv);
+	if (nslots == 0) {
+		return ENOENT;
+	}
+
+	i = sfs_hashdir_home(name, nslots);
+	for (n = 0; n < nslots; n++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			break;
+		}
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = i;
+			}
+			if (ino != NULL) {
+				*ino = tsd.sfd_ino;
+			}
+			return 0;
+		}
+		i = (i + 1) & (nslots - 1);
+	}
+	return ENOENT;
+}
+
+/*
+ * Rebuild the table with NEWSLOTS slots. Blocks for the new size are
+ * allocated first, so running out of space leaves the old table as
+ * it was.
+ */
+static
+int
+sfs_hashdir_resize(struct sfs_vnode *sv, unsigned newslots)
+{
+	struct sfs_direntry *old, *new;
+	unsigned oldslots, i, j;
+	off_t oldsize;
+	int result;
+
+	oldslots = sfs_dir_nentries(sv);
+	oldsize = sv->sv_i.sfi_size;
+	KASSERT(newslots > oldslots);
+
+	old = NULL;
+	if (oldslots > 0) {
+		old = kmalloc(oldslots * sizeof(*old));
+		if (old == NULL) {
+			return ENOMEM;
+		}
+	}
+	new = kmalloc(newslots * sizeof(*new));
+	if (new == NULL) {
+		kfree(old);
+		return ENOMEM;
+	}
+
+	/* Read the old table */
+	for (i = 0; i < oldslots; i += SFS_DIRPERBLOCK) {
+		result = sfs_metaio(sv, i * sizeof(*old), &old[i],
+				    SFS_BLOCKSIZE, UIO_READ);
+		if (result) {
+			goto out;
+		}
+	}
+
+	/* Extend the directory with empty blocks */
+	bzero(new, newslots * sizeof(*new));
+	for (i = oldslots; i < newslots; i += SFS_DIRPERBLOCK) {
+		result = sfs_metaio(sv, i * sizeof(*new), &new[i],
+				    SFS_BLOCKSIZE, UIO_WRITE);
+		if (result) {
+			sfs_itrunc(sv, oldsize);
+			goto out;
+		}
+	}
+
+	/* Rehash */
+	for (i = 0; i < oldslots; i++) {
+		if (old[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		old[i].sfd_name[sizeof(old[i].sfd_name)-1] = 0;
+		j = sfs_hashdir_home(old[i].sfd_name, newslots);
+		while (new[j].sfd_ino != SFS_NOINO) {
+			j = (j + 1) & (newslots - 1);
+		}
+		new[j] = old[i];
+	}
+
+	/* Write it all back */
+	for (i = 0; i < newslots; i += SFS_DIRPERBLOCK) {
+		result = sfs_metaio(sv, i * sizeof(*new), &new[i],
+				    SFS_BLOCKSIZE, UIO_WRITE);
+		if (result) {
+			goto out;
+		}
+	}
+	KASSERT(sv->sv_i.sfi_size == newslots * sizeof(*new));
+	result = 0;
+
+ out:
+	kfree(new);
+	kfree(old);
+	return result;
+}
+
+static
+int
+sfs_hashdir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
+		 int *slot)
+{
+	struct sfs_direntry sd;
+	unsigned nslots, maxslots, i, n;
+	int result;
+
+	/* Make sure the name's not there already */
+	result = sfs_hashdir_findname(sv, name, NULL, NULL);
+	if (result!=0 && result!=ENOENT) {
+		return result;
+	}
+	if (result==0) {
+		return EEXIST;
+	}
+	if (strlen(name)+1 > sizeof(sd.sfd_name)) {
+		return ENAMETOOLONG;
+	}
+
+	maxslots = sfs_hashdir_maxslots();
+	if (sfs_dir_nentries(sv) == 0) {
+		/* Empty directory; set up the table */
+		result = sfs_hashdir_resize(sv, SFS_HASHDIR_MINSLOTS);
+		if (result) {
+			return result;
+		}
+	}
+
+ again:
+	nslots = sfs_dir_nentries(sv);
+	i = sfs_hashdir_home(name, nslots);
+	for (n = 0; n < nslots; n++) {
+		result = sfs_readdir(sv, i, &sd);
+		if (result) {
+			return result;
+		}
+		if (sd.sfd_ino == SFS_NOINO) {
+			break;
+		}
+		i = (i + 1) & (nslots - 1);
+	}
+
+	if ((n == nslots || n > SFS_HASHDIR_MAXPROBE) && nslots < maxslots) {
+		result = sfs_hashdir_resize(sv, nslots * 2);
+		if (result == 0) {
+			goto again;
+		}
+		if (n == nslots) {
+			return result;
+		}
+		/* Couldn't grow, but there's room; go ahead */
+	}
+	else if (n == nslots) {
+		return ENOSPC;
+	}
+
+	bzero(&sd, sizeof(sd));
+	sd.sfd_ino = ino;
+	strcpy(sd.sfd_name, name);
+
+	if (slot) {
+		*slot = i;
+	}
+	return sfs_writedir(sv, i, &sd);
+}
+
+/*
+ * Remove the entry in SLOT, then move back any entries after it
+ * that would otherwise no longer be reachable from their home slots.
+ */
+static
+int
+sfs_hashdir_unlink(struct sfs_vnode *sv, int slot)
+{
+	struct sfs_direntry sd;
+	unsigned nslots, hole, j, home;
+	int result;
+
+	nslots = sfs_dir_nentries(sv);
+	KASSERT(slot >= 0 && (unsigned)slot < nslots);
+
+	hole = slot;
+	for (j = (hole + 1) & (nslots - 1); j != (unsigned)slot;
+	     j = (j + 1) & (nslots - 1)) {
+		result = sfs_readdir(sv, j, &sd);
+		if (result) {
+			return result;
+		}
+		if (sd.sfd_ino == SFS_NOINO) {
+			break;
+		}
+		sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+		home = sfs_hashdir_home(sd.sfd_name, nslots);
+
+		/* It can move into the hole unless its home is in (hole, j] */
+		if (hole < j ? (home <= hole || home > j)
+			     : (home <= hole && home > j)) {
+			result = sfs_writedir(sv, hole, &sd);
+			if (result) {
+				return result;
+			}
+			hole = j;
+		}
+	}
+
+	bzero(&sd, sizeof(sd));
+	sd.sfd_ino = SFS_NOINO;
+	return sfs_writedir(sv, hole, &sd);
+}
+
+////////////////////////////////////////////////////////////
+// Directory operations
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * For hashed directories EMPTYSLOT is not supported (the free slot
+ * to use depends on the name); sfs_dir_link takes care of that.
  */
 int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (SFS_HASHDIRS(sfs)) {
+		KASSERT(emptyslot == NULL);
+		return sfs_hashdir_findname(sv, name, ino, slot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -153,10 +445,15 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
 
+	if (SFS_HASHDIRS(sfs)) {
+		return sfs_hashdir_link(sv, name, ino, slot);
+	}
+
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
 	if (result!=0 && result!=ENOENT) {
@@ -195,8 +492,13 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	struct sfs_direntry sd;
 
+	if (SFS_HASHDIRS(sfs)) {
+		return sfs_hashdir_unlink(sv, slot);
+	}
+
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
@@ -41,6 +41,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -112,13 +113,14 @@ static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct sfs_vnode *sv;
+	unsigned i;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	/* Go over the table of loaded vnodes, syncing as we go. */
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			VOP_FSYNC(&sv->sv_absvn);
+		}
 	}
 	return 0;
 }
@@ -229,6 +231,13 @@ sfs_sync(struct fs *fs)
 		return result;
 	}
 
+	/* Now push everything out of the buffer cache to disk. */
+	result = buf_sync(sfs->sfs_device);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	vfs_biglock_release();
 	return 0;
 }
@@ -262,7 +271,7 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	sfs_vnhash_cleanup(sfs);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -281,7 +290,7 @@ sfs_unmount(struct fs *fs)
 	vfs_biglock_acquire();
 
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
+	if (sfs->sfs_numvnodes > 0) {
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -290,6 +299,9 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Forget any cached blocks; they were written out by sfs_sync. */
+	buf_drop(sfs->sfs_device);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -351,8 +363,7 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	if (sfs_vnhash_init(sfs)) {
 		goto cleanup_object;
 	}
 
@@ -399,8 +410,10 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * (Note: for all intents and purposes here, "sector" and
 	 * "block" are interchangeable terms. Technically a filesystem
 	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * don't do that in sfs.) All I/O goes through the buffer
+	 * cache, whose blocks had better be the same size.
 	 */
+	COMPILE_ASSERT(SFS_BLOCKSIZE == BUF_BLOCKSIZE);
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
 		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
@@ -440,6 +453,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return EINVAL;
 	}
 
+	if (sfs->sfs_sb.sb_features & ~SFS_FEATURES_KNOWN) {
+		kprintf("sfs: Unsupported features 0x%x in superblock\n",
+			sfs->sfs_sb.sb_features & ~SFS_FEATURES_KNOWN);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return EINVAL;
+	}
+
 	if (sfs->sfs_sb.sb_nblocks > dev->d_blocks) {
 		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
 			sfs->sfs_sb.sb_nblocks, dev->d_blocks);
@@ -36,10 +36,171 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <kmem_cache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+/*
+ * Object cache for struct sfs_vnode, shared by all SFS volumes.
+ */
+static struct kmem_cache *sfs_vnode_cache;
+
+/*
+ * Setup; called once at boot from vfs_bootstrap.
+ */
+void
+sfs_bootstrap(void)
+{
+	sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+					    sizeof(struct sfs_vnode),
+					    NULL, NULL);
+	if (sfs_vnode_cache == NULL) {
+		panic("sfs: Could not create vnode cache\n");
+	}
+}
+
+/*
+ * The table of loaded vnodes.
+ *
+ * This is a hash table keyed on inode number, chained through the
+ * vnodes themselves. Each vnode also remembers the pointer that
+ * points to it, so it can be unlinked in constant time on reclaim.
+ * The table doubles when the average chain gets longer than 2; if
+ * the memory for that isn't available we just keep going with
+ * longer chains. All of it is protected by the vfs biglock.
+ */
+
+static
+unsigned
+sfs_vnhash_bucket(unsigned hashsize, uint32_t ino)
+{
+	/* inode numbers are block numbers, so already well spread */
+	return ino & (hashsize - 1);
+}
+
+static
+void
+sfs_vnhash_link(struct sfs_vnode **table, unsigned hashsize,
+		struct sfs_vnode *sv)
+{
+	struct sfs_vnode **head;
+
+	head = &table[sfs_vnhash_bucket(hashsize, sv->sv_ino)];
+	sv->sv_hashnext = *head;
+	if (*head != NULL) {
+		(*head)->sv_hashprevp = &sv->sv_hashnext;
+	}
+	sv->sv_hashprevp = head;
+	*head = sv;
+}
+
+static
+void
+sfs_vnhash_unlink(struct sfs_vnode *sv)
+{
+	*sv->sv_hashprevp = sv->sv_hashnext;
+	if (sv->sv_hashnext != NULL) {
+		sv->sv_hashnext->sv_hashprevp = sv->sv_hashprevp;
+	}
+	sv->sv_hashnext = NULL;
+	sv->sv_hashprevp = NULL;
+}
+
+/*
+ * Double the number of chains. Failure is not an error.
+ */
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newtable, *sv;
+	unsigned newsize, i;
+
+	newsize = sfs->sfs_vnhashsize * 2;
+	newtable = kmalloc(newsize * sizeof(*newtable));
+	if (newtable == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newtable[i] = NULL;
+	}
+
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		while ((sv = sfs->sfs_vnhash[i]) != NULL) {
+			sfs_vnhash_unlink(sv);
+			sfs_vnhash_link(newtable, newsize, sv);
+		}
+	}
+
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = newtable;
+	sfs->sfs_vnhashsize = newsize;
+}
+
+static
+void
+sfs_vnhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	if (sfs->sfs_numvnodes >= 2 * sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+	}
+	sfs_vnhash_link(sfs->sfs_vnhash, sfs->sfs_vnhashsize, sv);
+	sfs->sfs_numvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sfs->sfs_numvnodes > 0);
+	sfs_vnhash_unlink(sv);
+	sfs->sfs_numvnodes--;
+}
+
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	sv = sfs->sfs_vnhash[sfs_vnhash_bucket(sfs->sfs_vnhashsize, ino)];
+	while (sv != NULL && sv->sv_ino != ino) {
+		sv = sv->sv_hashnext;
+	}
+	return sv;
+}
+
+/*
+ * Set up and tear down the table; called from sfs_fs_create and
+ * sfs_fs_destroy.
+ */
+int
+sfs_vnhash_init(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	sfs->sfs_vnhash = kmalloc(SFS_VNHASH_INITSIZE *
+				  sizeof(*sfs->sfs_vnhash));
+	if (sfs->sfs_vnhash == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_VNHASH_INITSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_vnhashsize = SFS_VNHASH_INITSIZE;
+	sfs->sfs_numvnodes = 0;
+	return 0;
+}
+
+void
+sfs_vnhash_cleanup(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_numvnodes == 0);
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = NULL;
+}
+
 /*
  * Write an on-disk inode structure back out to disk.
  */
@@ -70,7 +231,6 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
 	vfs_biglock_acquire();
@@ -115,28 +275,18 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
+	if (sv->sv_hashprevp == NULL || *sv->sv_hashprevp != sv) {
 		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
 		      sfs->sfs_sb.sb_volname, sv->sv_ino);
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnhash_remove(sfs, sv);
 
 	vnode_cleanup(&sv->sv_absvn);
 
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -150,41 +300,30 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
+	sv = sfs_vnhash_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
-
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -198,13 +337,16 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No reads seen yet */
+	readahead_init(&sv->sv_ra, SFS_RA_MIN, SFS_RA_MAX);
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -235,7 +377,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -243,12 +385,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnhash_add(sfs, sv);
 
 	/* Hand it back */
 	*ret = sv;
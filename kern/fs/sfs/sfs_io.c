@@ -38,6 +38,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -46,89 +47,59 @@
 // Basic block-level I/O routines
 
 /*
+ * All block I/O goes through the buffer cache (see buf.h), which
+ * does the actual device I/O and retries errors.
+ *
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
  * except sfs_device.
  */
 
-/*
- * Read or write a block, retrying I/O errors.
- */
-static
-int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
-{
-	int result;
-	int tries=0;
-
-	KASSERT(vfs_biglock_do_i_hold());
-
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
-
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: %s: DEVOP_IO returned EINVAL\n",
-		      sfs->sfs_sb.sb_volname);
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: %s: block %llu I/O error, retrying\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
-		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
-		}
-		else {
-			kprintf("sfs: %s: block %llu I/O error, giving up "
-				"after %d retries\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
-		}
-	}
-	return result;
-}
-
 /*
  * Read a block.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *b;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	DEBUG(DB_SFS, "sfs: read %u\n", block);
+
+	result = buf_read(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buf_map(b), len);
+	buf_release(b);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Write a block. This only updates the cache; the block is written
+ * to disk later, by buf_sync.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *b;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	DEBUG(DB_SFS, "sfs: write %u\n", block);
+
+	result = buf_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(buf_map(b), data, len);
+	buf_markdirty(b);
+	buf_release(b);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -150,16 +121,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +132,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,107 +144,241 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buf_read(sfs->sfs_device, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 */
+	result = uiomove((char *)buf_map(b) + skipstart, len, uio);
+
+	/*
+	 * If it was a write, the buffer needs writing back. (Even if
+	 * uiomove failed, it may have changed part of it.)
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		buf_markdirty(b);
 	}
+	buf_release(b);
 
-	return 0;
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Read whole blocks, at most MAXBLOCKS of them. Blocks that are
+ * consecutive on disk as well as in the file are read with one
+ * transfer (see buf_readrun), up to BUF_MAXRUN at a time; this
+ * reads as many as are consecutive.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockread(struct sfs_vnode *sv, struct uio *uio, uint32_t maxblocks)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
+	struct buf *bufs[BUF_MAXRUN];
+	daddr_t diskblock, nextblock;
 	uint32_t fileblock;
+	unsigned n, i;
 	int result;
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(maxblocks > 0);
+	KASSERT(uio->uio_resid >= maxblocks * SFS_BLOCKSIZE);
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
 	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
 	if (result) {
 		return result;
 	}
 
 	if (diskblock == 0) {
-		/*
-		 * No block - fill with zeros.
-		 *
-		 * We must be reading, or sfs_bmap would have
-		 * allocated a block for us.
-		 */
-		KASSERT(uio->uio_rw == UIO_READ);
+		/* No block - fill with zeros. */
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * See how far the run goes. If looking up a later block
+	 * fails, stop there; we'll get the error again next time.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	if (maxblocks > BUF_MAXRUN) {
+		maxblocks = BUF_MAXRUN;
+	}
+	for (n = 1; n < maxblocks; n++) {
+		result = sfs_bmap(sv, fileblock + n, false, &nextblock);
+		if (result || nextblock != diskblock + n) {
+			break;
+		}
+	}
 
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
+	result = buf_readrun(sfs->sfs_device, diskblock, &n, bufs);
+	if (result) {
+		return result;
+	}
+	for (i=0; i<n; i++) {
+		if (result == 0) {
+			result = uiomove(buf_map(bufs[i]), SFS_BLOCKSIZE, uio);
+		}
+		buf_release(bufs[i]);
+	}
+	return result;
+}
+
+/*
+ * Write a single whole block. Writes go to the buffer cache, and
+ * buf_sync writes consecutive dirty blocks out together, so there's
+ * nothing to gain from doing more than one block here.
+ */
+static
+int
+sfs_blockwrite(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
+	daddr_t diskblock;
+	uint32_t fileblock;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
 
-	result = sfs_rwblock(sfs, uio);
+	/* Get the block number within the file */
+	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+
+	/* Look up the disk block number, allocating if needed */
+	result = sfs_bmap(sv, fileblock, true, &diskblock);
+	if (result) {
+		return result;
+	}
+	KASSERT(diskblock != 0);
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
+	 * We're overwriting the whole block, so there's no need to
+	 * read it first.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
-
+	result = buf_get(sfs->sfs_device, diskblock, &b);
+	if (result) {
+		return result;
+	}
+	result = uiomove(buf_map(b), SFS_BLOCKSIZE, uio);
+	if (result == 0 || buf_isvalid(b)) {
+		/*
+		 * If the copy failed partway and the buffer didn't
+		 * already hold the block, leave it invalid so the
+		 * block gets read back in from disk; otherwise it
+		 * needs writing.
+		 */
+		buf_markdirty(b);
+	}
+	buf_release(b);
 	return result;
 }
 
+/*
+ * Start reading the part of the file from START to END (in bytes)
+ * into the buffer cache, in the background. Blocks that are holes,
+ * past EOF, or already cached are skipped; the rest go out in runs
+ * of blocks that are consecutive on disk.
+ */
+static
+void
+sfs_prefetch(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t fileblock, endblock;
+	daddr_t diskblock, runstart;
+	unsigned runlen;
+
+	if (end > (off_t)sv->sv_i.sfi_size) {
+		end = sv->sv_i.sfi_size;
+	}
+	fileblock = start / SFS_BLOCKSIZE;
+	endblock = (end + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+
+	runstart = 0;
+	runlen = 0;
+	for (; fileblock < endblock; fileblock++) {
+		if (sfs_bmap(sv, fileblock, false, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0 && buf_incache(sfs->sfs_device, diskblock)) {
+			diskblock = 0;
+		}
+		if (runlen > 0 && (diskblock != runstart + runlen ||
+				   runlen == BUF_MAXRUN)) {
+			buf_prefetch(sfs->sfs_device, runstart, runlen);
+			runlen = 0;
+		}
+		if (diskblock == 0) {
+			continue;
+		}
+		if (runlen == 0) {
+			runstart = diskblock;
+		}
+		runlen++;
+	}
+	if (runlen > 0) {
+		buf_prefetch(sfs->sfs_device, runstart, runlen);
+	}
+}
+
+/*
+ * Note a read of the file from START to END for read-ahead purposes
+ * (see readahead.h) before it's done. Returns whether it was part of
+ * a sequential stream.
+ */
+static
+bool
+sfs_readahead_begin(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblock;
+
+	switch (readahead_access(&sv->sv_ra, start, end)) {
+	    case RA_RANDOM:
+		return false;
+	    case RA_SEQUENTIAL:
+		return true;
+	    case RA_READAHEAD:
+		break;
+	}
+
+	/* See if what we read ahead is still there */
+	if (sfs_bmap(sv, start / SFS_BLOCKSIZE, false, &diskblock) == 0 &&
+	    diskblock != 0) {
+		readahead_adjust(&sv->sv_ra,
+				 buf_incache(sfs->sfs_device, diskblock));
+	}
+	return true;
+}
+
+/*
+ * After a sequential read ending at POS, read ahead more if needed.
+ */
+static
+void
+sfs_readahead_end(struct sfs_vnode *sv, off_t pos)
+{
+	off_t start, end;
+
+	if (readahead_next(&sv->sv_ra, pos, &start, &end)) {
+		sfs_prefetch(sv, start, end);
+	}
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -292,9 +386,10 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	bool sequential = false;
 
 	origresid = uio->uio_resid;
 
@@ -317,6 +412,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			KASSERT(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
 		}
+
+		sequential = sfs_readahead_begin(sv, uio->uio_offset,
+						 uio->uio_offset +
+						 uio->uio_resid);
 	}
 
 	/*
@@ -351,9 +450,13 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 * Now we should be block-aligned. Do the remaining whole blocks.
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while ((nblocks = uio->uio_resid / SFS_BLOCKSIZE) > 0) {
+		if (uio->uio_rw == UIO_READ) {
+			result = sfs_blockread(sv, uio, nblocks);
+		}
+		else {
+			result = sfs_blockwrite(sv, uio);
+		}
 		if (result) {
 			goto out;
 		}
@@ -381,6 +484,11 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/* Keep a sequential reader supplied */
+	if (sequential && result == 0) {
+		sfs_readahead_end(sv, uio->uio_offset);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -407,6 +515,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
+	char *ptr;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +524,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -446,26 +544,21 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buf_read(sfs->sfs_device, diskblock, &b);
 	if (result) {
 		return result;
 	}
+	ptr = buf_map(b);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, ptr + blockoffset, len);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(ptr + blockoffset, data, len);
+		buf_markdirty(b);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -474,6 +567,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 			sv->sv_dirty = true;
 		}
 	}
+	buf_release(b);
 
 	/* Done */
 	return 0;
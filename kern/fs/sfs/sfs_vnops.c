@@ -470,6 +470,14 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
 
+	/* Adding the new name may have rehashed a hashed directory */
+	if (SFS_HASHDIRS(sfs)) {
+		result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+		if (result) {
+			goto puke_harder;
+		}
+	}
+
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
 	if (result) {
@@ -494,7 +502,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/*
 	 * Error recovery: try to undo what we already did
 	 */
-	result2 = sfs_dir_unlink(sv, slot2);
+	result2 = 0;
+	if (SFS_HASHDIRS(sfs)) {
+		result2 = sfs_dir_findname(sv, n2, NULL, &slot2, NULL);
+	}
+	if (result2 == 0) {
+		result2 = sfs_dir_unlink(sv, slot2);
+	}
 	if (result2) {
 		kprintf("sfs: %s: rename: %s\n",
 			sfs->sfs_sb.sb_volname, strerror(result));
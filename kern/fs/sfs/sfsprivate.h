@@ -33,15 +33,18 @@
 #include <uio.h> /* for uio_rw */
 
 
+/* True if directories on SFS are hash tables (see <kern/sfs.h>) */
+#define SFS_HASHDIRS(sfs) \
+	(((sfs)->sfs_sb.sb_features & SFS_FEATURE_HASHDIR) != 0)
+
+/* Read-ahead window limits, in bytes */
+#define SFS_RA_MIN (8 * SFS_BLOCKSIZE)
+#define SFS_RA_MAX (32 * SFS_BLOCKSIZE)
+
 /* ops tables (in sfs_vnops.c) */
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
-/* Macro for initializing a uio structure */
-#define SFSUIO(iov, uio, ptr, block, rw) \
-    uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
-
-
 /* Functions in sfs_balloc.c */
 int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
@@ -62,7 +65,12 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Initial number of chains in the vnode hash table (power of 2) */
+#define SFS_VNHASH_INITSIZE 64
+
 /* Functions in sfs_inode.c */
+int sfs_vnhash_init(struct sfs_fs *sfs);
+void sfs_vnhash_cleanup(struct sfs_fs *sfs);
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
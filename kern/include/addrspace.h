@@ -39,15 +39,38 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
 
 
+/*
+ * A region of an address space: a range of pages with the same
+ * permissions, as set up by as_define_region or as_define_stack.
+ */
+struct region {
+	vaddr_t rg_base;		/* first address (page-aligned) */
+	size_t rg_npages;		/* size in pages */
+	bool rg_readable;
+	bool rg_writeable;
+	bool rg_executable;
+	struct region *rg_next;		/* next region in address space */
+};
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
  *
- * You write this.
+ * Pages are allocated (and zero-filled) only when first touched. The
+ * stack region starts small and grows downward on demand, up to
+ * VM_STACKPAGES pages.
+ *
+ * as_asid holds the address space's TLB address space ID on each
+ * CPU, if it has one; see vm.c. VM_MAXCPUS is the most CPUs
+ * System/161 can have.
  */
 
+#define VM_STACKPAGES 1024
+#define VM_MAXCPUS 32
+
 struct addrspace {
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
@@ -58,13 +81,20 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region *as_regions;	/* list of regions */
+        struct region *as_stack;	/* the stack region (also on list) */
+        struct pagetable *as_pt;	/* page table */
+        bool as_loading;		/* loading executable; ignore perms */
+        unsigned as_asid[VM_MAXCPUS];	/* ASID on each cpu (see vm.c) */
 #endif
 };
 
 /*
  * Functions in addrspace.c:
  *
+ *    as_bootstrap - set up the object cache address spaces come
+ *                from. Called from vm_bootstrap.
+ *
  *    as_create - create a new empty address space. You need to make
  *                sure this gets called in all the right places. You
  *                may find you want to change the argument list. May
@@ -103,6 +133,7 @@ struct addrspace {
  * functions are found in dumbvm.c.
  */
 
+void              as_bootstrap(void);
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
@@ -118,6 +149,16 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+/*
+ *    as_findregion - return the region containing VADDR, growing the
+ *                stack to cover it if it's just below the stack.
+ *                Returns NULL if VADDR isn't (and can't be) part of
+ *                the address space.
+ */
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+#endif
+
 
 /*
  * Functions in loadelf.c
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Buffer cache.
+ *
+ * The buffer cache holds recently used disk blocks, keyed by device
+ * and block number. Buffers are reference counted; a buffer stays
+ * put (and its contents stay valid) from when it's gotten until it's
+ * released. Unreferenced buffers are kept in LRU order and reused
+ * for other blocks as needed.
+ *
+ * Writes are write-behind: marking a buffer dirty doesn't write it;
+ * it's written when it's reused, when buf_sync is called, or by a
+ * syncer thread every few seconds.
+ *
+ * The cache only knows about contents, not about who's using them;
+ * if two threads have the same buffer, it's up to them to not get in
+ * each other's way.
+ *
+ * Functions:
+ *     buf_bootstrap  - set up the cache. Called from vfs_bootstrap.
+ *     buf_read       - get the buffer for block BLOCK of device DEV,
+ *                    reading it from disk if it isn't already
+ *                    cached. Returns an error code.
+ *     buf_readrun    - like buf_read, for *NP (at most BUF_MAXRUN)
+ *                    consecutive blocks starting at BLOCK; blocks not
+ *                    cached are read in as few transfers as possible.
+ *                    May return fewer buffers than asked for; *NP is
+ *                    set to the number actually gotten.
+ *     buf_prefetch   - start reading N (at most BUF_MAXRUN)
+ *                    consecutive blocks starting at BLOCK into the
+ *                    cache in the background, if they aren't there
+ *                    already. Doesn't wait, and may do nothing.
+ *     buf_incache    - return true if block BLOCK of DEV is cached
+ *                    (or on its way in).
+ *     buf_get        - like buf_read, but doesn't read the block.
+ *                    Use this for blocks that are about to be
+ *                    overwritten entirely. If buf_isvalid says no,
+ *                    the contents are garbage until the caller fills
+ *                    them in and calls buf_markdirty.
+ *     buf_release    - drop a reference gotten from buf_read/buf_get.
+ *     buf_map        - return a pointer to the buffer's contents,
+ *                    BUF_BLOCKSIZE bytes.
+ *     buf_isvalid    - return true if the buffer's contents are
+ *                    valid.
+ *     buf_markdirty  - note that the buffer's contents have been
+ *                    changed (and are valid) and need to be written.
+ *     buf_sync       - write all dirty buffers for DEV (or for all
+ *                    devices, if DEV is NULL), consecutive blocks
+ *                    together. Returns an error code.
+ *     buf_drop       - forget all buffers for DEV, which must have
+ *                    been synced and must not be in use by the
+ *                    filesystem. Pending prefetches for DEV are
+ *                    cancelled, and buffers the syncer is still
+ *                    writing are waited for. For unmount.
+ *     buf_printstats - print hit/miss counts.
+ */
+
+#define BUF_BLOCKSIZE	512
+
+/* Most blocks transferred at once. */
+#define BUF_MAXRUN	16
+
+struct buf;     /* Opaque. */
+struct device;  /* from <device.h> */
+
+void buf_bootstrap(void);
+int buf_read(struct device *dev, daddr_t block, struct buf **ret);
+int buf_readrun(struct device *dev, daddr_t block, unsigned *np,
+		struct buf **bufs);
+void buf_prefetch(struct device *dev, daddr_t block, unsigned n);
+bool buf_incache(struct device *dev, daddr_t block);
+int buf_get(struct device *dev, daddr_t block, struct buf **ret);
+void buf_release(struct buf *b);
+void *buf_map(struct buf *b);
+bool buf_isvalid(struct buf *b);
+void buf_markdirty(struct buf *b);
+int buf_sync(struct device *dev);
+void buf_drop(struct device *dev);
+void buf_printstats(void);
+
+
+#endif /* _BUF_H_ */
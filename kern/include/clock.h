@@ -51,8 +51,15 @@ void hardclock(void);
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
+ *
+ * The timer device is one-shot: the driver that calls timerclock()
+ * registers an ARM function with timerclock_attach(), and it is
+ * called (with DATA) whenever someone needs timerclock() to be
+ * called one second from now. If nobody is waiting, the timer stays
+ * off.
  */
 void timerclock(void);
+void timerclock_attach(void (*arm)(void *data), void *data);
 
 /*
  * gettime() may be used to fetch the current time of day.
@@ -79,5 +86,62 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * Timeouts: calls to a function after a number of hardclock ticks.
+ *
+ * The caller supplies the struct timeout, sets it up once with
+ * timeout_init, and then may schedule and cancel it any number of
+ * times. Each CPU keeps its own timing wheel, driven by its own
+ * hardclock; a timeout goes on the wheel of the CPU that schedules
+ * it. The function is called from the hardclock interrupt with no
+ * spinlocks held, and must not sleep.
+ *
+ * timeout_init  - set up a timeout to call FUNC(ARG).
+ * timeout       - schedule the call in TICKS ticks (at least 1), from
+ *                 now; if already scheduled, reschedule it.
+ * untimeout     - cancel the call. Returns true if it was still
+ *                 pending. If the function is running on another CPU,
+ *                 waits for it to finish, so afterwards the timeout
+ *                 may be freed.
+ *
+ * A timeout fires at the first hardclock at least TICKS ticks after
+ * it was scheduled, so resolution is one tick (1/HZ seconds).
+ */
+struct timeout_wheel;	/* Opaque */
+
+struct timeout {
+	void (*to_func)(void *);
+	void *to_arg;
+	uint64_t to_expire;		/* Wheel tick when due */
+	struct timeout_wheel *to_wheel;	/* Wheel it was last put on */
+	volatile unsigned to_state;	/* TO_IDLE, etc. */
+	struct timeout *to_next;	/* Link on a wheel slot */
+	struct timeout **to_prevp;
+};
+
+#define TO_IDLE		0	/* Not scheduled */
+#define TO_PENDING	1	/* On a wheel */
+#define TO_RUNNING	2	/* Function being called */
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout(struct timeout *to, unsigned ticks);
+bool untimeout(struct timeout *to);
+
+/*
+ * Set up a cpu's timing wheel (called from cpu_create), and check if
+ * the current cpu has timeouts pending, in which case it has to keep
+ * its clock ticking even when idle.
+ */
+struct cpu;
+void timeout_cpu_init(struct cpu *c);
+bool timeout_cpu_pending(void);
+
+/*
+ * ticksleep() suspends execution for the requested number of ticks.
+ * timespec_to_ticks() converts a time interval to ticks, rounding up.
+ */
+void ticksleep(unsigned ticks);
+unsigned timespec_to_ticks(const struct timespec *ts);
+
 
 #endif /* _CLOCK_H_ */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator.
+ *
+ * The coremap has an entry for every page of physical memory. Free
+ * pages are managed as a buddy system: free memory is kept in blocks
+ * of 2^k pages, aligned to their size, on one list per k, and two
+ * free buddies are merged as soon as both are free. So multi-page
+ * allocations come out physically contiguous, and allocation and
+ * free take time logarithmic in the size of memory. Single pages,
+ * which are most of what gets allocated, are also cached per cpu.
+ *
+ * Until coremap_bootstrap is called, pages are taken with
+ * ram_stealmem. Such pages are never given back.
+ *
+ * Functions:
+ *     coremap_bootstrap - take over physical memory. Called from
+ *                         vm_bootstrap.
+ *     coremap_alloc     - allocate NPAGES physically contiguous pages.
+ *                         Returns the physical address of the first,
+ *                         or 0 if out of memory.
+ *     coremap_free      - free pages allocated with coremap_alloc,
+ *                         given the address it returned. For shared
+ *                         pages, drops one reference.
+ *     coremap_addref    - add a reference to a single page, so it can
+ *                         be shared (copy-on-write) by another
+ *                         address space. It's freed when the last
+ *                         reference is dropped with coremap_free.
+ *     coremap_refcount  - return the number of references to a page.
+ *
+ * For paging (see swap.c):
+ *     coremap_setowner  - record which address space and virtual
+ *                         address a user page belongs to, which makes
+ *                         it eligible for paging out; or, with AS
+ *                         NULL, that it isn't.
+ *     coremap_touch     - mark a page as recently used.
+ *     coremap_pickvictim - choose and pin a page to page out.
+ *     coremap_unpin     - unpin it again. coremap_free on a pinned
+ *                         page waits for this.
+ *     coremap_freepages - return the number of free pages.
+ *
+ * coremap_used_bytes, declared in vm.h, is also here.
+ */
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned npages);
+void coremap_free(paddr_t pa);
+void coremap_addref(paddr_t pa);
+unsigned coremap_refcount(paddr_t pa);
+
+struct addrspace;
+void coremap_setowner(paddr_t pa, struct addrspace *as, vaddr_t vaddr);
+void coremap_touch(paddr_t pa);
+paddr_t coremap_pickvictim(struct addrspace **as, vaddr_t *vaddr);
+void coremap_unpin(paddr_t pa);
+unsigned coremap_freepages(void);
+
+
+#endif /* _COREMAP_H_ */
@@ -37,6 +37,12 @@
 
 extern unsigned num_cpus;
 
+/*
+ * Number of scheduling priority levels; 0 is the highest. See
+ * schedule() in thread.c.
+ */
+#define SCHED_NPRIO	4
+
 /*
  * Per-cpu structure
  *
@@ -62,13 +68,32 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct kmalloc_cpucache *c_kmcache; /* kmalloc magazines */
+	struct coremap_cpucache *c_cmcache; /* free page cache */
+	unsigned c_asid;		/* Address space ID in the TLB */
+	unsigned c_asidnext;		/* Next address space ID to use */
+	unsigned c_asidgen;		/* Address space ID generation */
+	unsigned c_tlbfaults;		/* Counter of TLB faults */
+	unsigned c_tlbrefills;		/* ...handled from the TLB cache */
+	unsigned c_schedreset;		/* c_hardclocks at last priority reset */
+	unsigned c_demotions;		/* Counter of threads demoted */
+	unsigned c_boosts;		/* Counter of threads boosted */
+	unsigned c_resets;		/* Counter of priority resets */
+	unsigned c_steals;		/* Counter of threads stolen */
+	struct timeout_wheel *c_timeouts; /* Timeouts; see clock.c */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * There is one run queue per priority level; c_runcount is
+	 * the total number of threads on all of them. Other cpus
+	 * also read c_runcount without the lock, as an estimate of
+	 * this cpu's load, when looking for work to steal.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues for this cpu */
+	volatile unsigned c_runcount;	/* Number of runnable threads */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -89,6 +114,18 @@ struct cpu {
 	unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
+	/*
+	 * Accessed by other cpus (only to reclaim memory).
+	 * Protected by the thread cache lock.
+	 *
+	 * Exited threads are kept here, with their stacks, to be
+	 * reused by thread_fork, up to a limit. See thread.c.
+	 */
+	struct threadlist c_threadcache; /* Recycled threads */
+	struct spinlock c_threadcache_lock;
+	unsigned c_threadcache_hits;	/* thread_fork reused a thread */
+	unsigned c_threadcache_misses;	/* thread_fork had to allocate */
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -101,7 +138,11 @@ struct cpu {
  * cpu_create creates a cpu; it is suitable for calling from driver-
  * or bus-specific code that looks for secondary CPUs.
  *
- * cpu_create calls cpu_machdep_init.
+ * cpu_create calls cpu_machdep_init, kmalloc_cpucache_init (in
+ * kmalloc.c) to give the cpu its own kmalloc magazines, and
+ * coremap_cpucache_init (in coremap.c) to give it its own cache of
+ * free physical pages, and timeout_cpu_init (in clock.c, declared in
+ * clock.h) to give it its own timing wheel.
  *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
@@ -110,6 +151,8 @@ struct cpu {
  */
 struct cpu *cpu_create(unsigned hardware_number);
 void cpu_machdep_init(struct cpu *);
+void kmalloc_cpucache_init(struct cpu *);
+void coremap_cpucache_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
@@ -118,6 +161,16 @@ void cpu_hatch(unsigned software_number);
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Print each CPU's TLB fault counts.
+ */
+void cpu_printtlbstats(void);
+
+/*
+ * Print each CPU's run queue lengths and scheduler counts.
+ */
+void cpu_printschedstats(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -156,6 +209,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_mask is like ipi_tlbshootdown but sends to every
+ * CPU whose number's bit is set in CPUMASK, except the current one;
+ * it returns the number of CPUs it was sent to.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -170,6 +226,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_mask(uint32_t cpumask,
+			       const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
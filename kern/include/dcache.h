@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+/*
+ * Name cache.
+ *
+ * The name cache remembers the results of looking up single path
+ * components, keyed by directory vnode and name, so that repeated
+ * lookups of the same names don't go back to the filesystem (which
+ * for SFS means reading through the whole directory). Failed
+ * lookups are remembered too, as negative entries.
+ *
+ * Each entry holds a reference to its directory and (unless it's
+ * negative) to the vnode the name refers to. The number of entries
+ * is fixed; when it runs out the least recently used entry is
+ * recycled. Names longer than DCACHE_NAMELEN, ".", "..", and vnodes
+ * that don't belong to a filesystem (devices) are never cached.
+ *
+ * Everything here must be called with the vfs biglock held.
+ *
+ * Functions:
+ *     dcache_bootstrap  - set up the cache. Called from vfs_bootstrap.
+ *     dcache_lookup     - look up NAME in DIR. Returns false if it
+ *                         isn't cached. Otherwise returns true and
+ *                         sets *RET to the vnode, with a reference
+ *                         added, or to NULL for a negative entry.
+ *     dcache_enter      - remember that NAME in DIR is VN, or that
+ *                         it doesn't exist if VN is NULL.
+ *     dcache_purge      - forget NAME in DIR. Must be called whenever
+ *                         a name is created, removed, or renamed.
+ *     dcache_purgefs    - forget all entries for filesystem FS. For
+ *                         unmount, and for operations (like rmdir)
+ *                         that may invalidate entries under other
+ *                         names too.
+ *     dcache_printstats - print hit/miss counts.
+ */
+
+#define DCACHE_NAMELEN	31
+
+struct vnode;	/* from <vnode.h> */
+struct fs;	/* from <fs.h> */
+
+void dcache_bootstrap(void);
+bool dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret);
+void dcache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void dcache_purge(struct vnode *dir, const char *name);
+void dcache_purgefs(struct fs *fs);
+void dcache_printstats(void);
+
+
+#endif /* _DCACHE_H_ */
@@ -193,8 +193,55 @@ typedef struct {
 #define	PF_X		0x1	/* Segment is executable */
 
 
+/*
+ * Section header. There are Ehdr.e_shnum of these starting at
+ * Ehdr.e_shoff. The loader ignores sections; they're defined here so
+ * the kernel profiler can find the symbol table in its own image.
+ */
+typedef struct {
+	uint32_t	sh_name;      /* Section name (index into shstrtab) */
+	uint32_t	sh_type;      /* Type of section */
+	uint32_t	sh_flags;     /* Flags */
+	uint32_t	sh_addr;      /* Address when loaded */
+	uint32_t	sh_offset;    /* Location of data within file */
+	uint32_t	sh_size;      /* Size of data within file */
+	uint32_t	sh_link;      /* Associated section (symtab: its strtab) */
+	uint32_t	sh_info;      /* Extra information */
+	uint32_t	sh_addralign; /* Required alignment */
+	uint32_t	sh_entsize;   /* Size of entries, for tables */
+} Elf32_Shdr;
+
+/* values for sh_type (only the ones we use) */
+#define	SHT_NULL	0		/* Section header entry unused */
+#define	SHT_PROGBITS	1		/* Program data */
+#define	SHT_SYMTAB	2		/* Symbol table */
+#define	SHT_STRTAB	3		/* String table */
+
+/*
+ * Symbol table entry.
+ */
+typedef struct {
+	uint32_t	st_name;     /* Symbol name (index into strtab) */
+	uint32_t	st_value;    /* Value (address) */
+	uint32_t	st_size;     /* Size of object */
+	unsigned char	st_info;     /* Type and binding */
+	unsigned char	st_other;    /* Visibility */
+	uint16_t	st_shndx;    /* Section the symbol is defined in */
+} Elf32_Sym;
+
+#define	ELF32_ST_BIND(i)	((i) >> 4)
+#define	ELF32_ST_TYPE(i)	((i) & 0xf)
+
+/* values for ELF32_ST_TYPE (only the ones we use) */
+#define	STT_NOTYPE	0	/* Unspecified */
+#define	STT_OBJECT	1	/* Data object */
+#define	STT_FUNC	2	/* Function */
+
+
 typedef Elf32_Ehdr Elf_Ehdr;
 typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Shdr Elf_Shdr;
+typedef Elf32_Sym Elf_Sym;
 
 
 #endif /* _ELF_H_ */
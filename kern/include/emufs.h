@@ -36,6 +36,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include <readahead.h>
 
 /*
  * Our structures
@@ -45,6 +46,11 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	struct lock *ev_lock;		/* protects the following */
+	struct readahead ev_ra;		/* read-ahead state */
+	char *ev_rabuf;			/* read-ahead data (or NULL) */
+	off_t ev_rapos;			/* file offset of ev_rabuf */
+	size_t ev_ralen;		/* amount of data in ev_rabuf */
 };
 
 struct emufs_fs {
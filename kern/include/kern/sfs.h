@@ -62,6 +62,30 @@
 /* Size of free block bitmap (in blocks) */
 #define SFS_FREEMAPBLOCKS(nblocks)  (SFS_FREEMAPBITS(nblocks)/SFS_BITSPERBLOCK)
 
+/* Feature flags for sb_features */
+#define SFS_FEATURE_HASHDIR  0x00000001  /* directories are hash tables */
+#define SFS_FEATURES_KNOWN   (SFS_FEATURE_HASHDIR)
+
+/*
+ * Hashed directories (SFS_FEATURE_HASHDIR).
+ *
+ * A hashed directory is an open-addressed hash table of directory
+ * entries with linear probing. Its size is a power of two number of
+ * slots, at least SFS_HASHDIR_MINSLOTS; a size of 0 means an empty
+ * directory whose table hasn't been set up yet. A name's home slot
+ * is the hash of the name (below) modulo the number of slots, and the
+ * entry for a name is always reachable from its home slot without
+ * passing a free slot. Free slots are all zeros, as in a plain
+ * directory, so tools that don't know about hashing can still read
+ * hashed directories; they must not add entries to them, though.
+ *
+ * The hash is h = h * 33 + c over the bytes of the name, starting
+ * from h = 5381, in unsigned 32-bit arithmetic.
+ */
+#define SFS_HASHDIR_MINSLOTS  32
+#define SFS_HASHDIR_HASHINIT  5381
+#define SFS_HASHDIR_HASHSTEP(h, c) ((h) * 33 + (unsigned char)(c))
+
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
@@ -74,7 +98,8 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_features;			/* SFS_FEATURE_* flags */
+	uint32_t reserved[117];			/* unused, set to 0 */
 };
 
 /*
@@ -197,6 +197,10 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Wait/wake on user memory --
+#define SYS_futex_wait   121
+#define SYS_futex_wake   122
+
 /*CALLEND*/
 
 
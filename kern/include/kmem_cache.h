@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches ("slab allocator") for fixed-size kernel structures.
+ *
+ * A cache hands out objects of one size, packed into whole pages
+ * ("slabs") with no rounding beyond alignment, so they don't waste
+ * the space kmalloc's power-of-two size classes would. Objects are
+ * kept constructed while they sit free in the cache: the constructor
+ * runs once when a slab is made and the destructor once when it is
+ * released, not on every alloc/free. So the constructor should set up
+ * the parts of the object that are the same every time it's free
+ * (empty lists, unheld spinlocks, and so forth), and users must hand
+ * objects back in that state.
+ *
+ * Functions:
+ *     kmem_cache_create  - make a cache for objects of size SIZE.
+ *                          CTOR and DTOR may be NULL. NAME should
+ *                          generally be a string constant. Returns
+ *                          NULL on error.
+ *     kmem_cache_destroy - destroy a cache. All its objects must
+ *                          have been freed.
+ *     kmem_cache_alloc   - get a (constructed) object. Returns NULL
+ *                          if out of memory.
+ *     kmem_cache_free    - return an object to its cache.
+ *
+ *     kmem_cache_printstats - print per-cache counters (for "kh").
+ *     kmem_cache_getused    - return bytes in use by live objects and
+ *                             (through NPAGES) the number of pages
+ *                             held by all caches (for "khu").
+ *
+ * Objects may be at most a little under a page.
+ */
+
+struct kmem_cache;  /* Opaque. */
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     void (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+void kmem_cache_printstats(void);
+unsigned long kmem_cache_getused(unsigned *npages);
+
+
+#endif /* _KMEM_CACHE_H_ */
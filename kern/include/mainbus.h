@@ -52,6 +52,13 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Stop and restart the current CPU's periodic clock tick (which calls
+ * hardclock), for idling. Interrupts should be off.
+ */
+void mainbus_tick_stop(void);
+void mainbus_tick_start(void);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page tables for user address spaces.
+ *
+ * The top 10 bits of a virtual address index the first level, which
+ * points to second-level tables of one page each; the next 10 bits
+ * index those. Second-level tables are only allocated for parts of
+ * the address space that have been touched, so a small process has a
+ * small page table no matter how spread out its regions are.
+ *
+ * A page table entry holds the physical address of the page and
+ * some flag bits. An entry of 0 means nothing has been put there yet;
+ * the page gets zero-filled the first time it's touched.
+ *
+ * A page may be shared, copy-on-write, by several page tables; the
+ * coremap keeps the count (see coremap_refcount). Shared pages are
+ * only ever mapped read-only, and are copied on the first write.
+ *
+ * A page that has been paged out (see swap.c) has PTE_SWAPPED set
+ * instead of PTE_VALID, and the swap slot where the setting of the
+ * physical address would be. PTE_BUSY is set on an entry whose page
+ * is on its way to or from swap; anyone else who wants the entry
+ * must wait (with pt_wait) until it's clear. Entries may only be
+ * examined or changed with the page table locked, and the lock is a
+ * spinlock, so allocating memory or doing I/O means marking the
+ * entry busy and unlocking first.
+ *
+ * Functions:
+ *     pt_create  - make a new empty page table. Returns NULL if out
+ *                  of memory.
+ *     pt_destroy - destroy a page table, dropping its reference to
+ *                  each page it refers to.
+ *     pt_lookup  - return a pointer to the entry for VADDR. If there
+ *                  is no second-level table for it yet, makes one if
+ *                  CREATE is true and otherwise returns NULL. Also
+ *                  returns NULL if out of memory.
+ *     pt_copy    - make NEW, which should be empty, share every page
+ *                  in OLD. Returns an error code. The caller must
+ *                  make sure no writeable TLB entries for OLD's
+ *                  pages are left. Paged-out pages get copied in
+ *                  swap rather than shared.
+ *     pt_lock    - lock the page table.
+ *     pt_unlock  - unlock it.
+ *     pt_wait    - with the page table locked, sleep until
+ *                  pt_wakeup is called.
+ *     pt_wakeup  - with the page table locked, wake everyone in
+ *                  pt_wait. Call this after clearing PTE_BUSY.
+ *
+ * Each page table also has a small cache of TLB entries, so that TLB
+ * misses on recently used pages can be refilled without walking the
+ * table or checking the address space's regions. The VM system
+ * decides what goes in an entry; the cache just holds it. All of
+ * these must be called with the page table locked.
+ *     pt_tlbcache_lookup     - look up VADDR. If it's there, put its
+ *                              TLB entry in ENTRYLO and return true.
+ *     pt_tlbcache_set        - remember ENTRYLO for VADDR.
+ *     pt_tlbcache_invalidate - forget VADDR. Call this whenever its
+ *                              page table entry changes.
+ *     pt_tlbcache_flush      - forget everything.
+ */
+
+typedef uint32_t pte_t;
+
+#define PTE_VALID	0x00000001	/* page is in memory */
+#define PTE_SWAPPED	0x00000002	/* page is in swap */
+#define PTE_BUSY	0x00000004	/* page is being paged in or out */
+#define PTE_PADDR(pte)	((pte) & PAGE_FRAME)
+#define PTE_SLOT(pte)	((pte) >> 12)
+#define PTE_MKSWAPPED(slot) (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+struct pagetable;  /* Opaque. */
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int pt_copy(struct pagetable *old, struct pagetable *new);
+void pt_lock(struct pagetable *pt);
+void pt_unlock(struct pagetable *pt);
+void pt_wait(struct pagetable *pt);
+void pt_wakeup(struct pagetable *pt);
+
+bool pt_tlbcache_lookup(struct pagetable *pt, vaddr_t vaddr,
+			uint32_t *entrylo);
+void pt_tlbcache_set(struct pagetable *pt, vaddr_t vaddr, uint32_t entrylo);
+void pt_tlbcache_invalidate(struct pagetable *pt, vaddr_t vaddr);
+void pt_tlbcache_flush(struct pagetable *pt);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Statistical kernel profiler.
+ *
+ * While enabled, every hardclock tick records the interrupted PC
+ * into a per-CPU histogram over the kernel text. prof_dump matches
+ * the histogram against the symbol table of the kernel image and
+ * writes a report of where the time went, by function.
+ *
+ *     prof_sample  - record one sample; called from the timer
+ *                    interrupt with the trapframe's EPC. FROMUSER
+ *                    is true if the interrupt came from user mode.
+ *     prof_start   - clear the histograms and start sampling.
+ *     prof_stop    - stop sampling. The histograms are kept.
+ *     prof_dump    - write the report to OUTFILE, reading symbols
+ *                    from the kernel image KERNFILE.
+ *
+ * prof_start, prof_stop, and prof_dump are meant to be called from
+ * the menu and are not safe against each other.
+ */
+
+void prof_sample(vaddr_t pc, bool fromuser);
+int prof_start(void);
+void prof_stop(void);
+int prof_dump(const char *outfile, const char *kernfile);
+
+
+#endif /* _PROF_H_ */
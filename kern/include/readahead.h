@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _READAHEAD_H_
+#define _READAHEAD_H_
+
+/*
+ * Read-ahead policy.
+ *
+ * Each open file that wants read-ahead keeps a struct readahead and
+ * reports every read to it with readahead_access. Reads that pick up
+ * where the previous one left off (or that start at the beginning of
+ * the file) make a sequential stream; anything else resets it.
+ *
+ * For a sequential stream, readahead_next says what to fetch: it
+ * keeps a window of data read ahead of the current position and asks
+ * for more once half of it has been used. The window starts at its
+ * minimum size and adapts: the filesystem calls readahead_adjust to
+ * say whether a read found its read-ahead data still there (window
+ * doubles) or not (window halves).
+ *
+ * Offsets and sizes are in bytes. The caller provides locking.
+ *
+ * Functions:
+ *     readahead_init   - set up, with the window between MIN and MAX.
+ *     readahead_access - note a read of [START, END). Returns
+ *                        RA_RANDOM if it isn't part of a sequential
+ *                        stream, RA_SEQUENTIAL if it is, or
+ *                        RA_READAHEAD if it is and it starts in data
+ *                        already read ahead.
+ *     readahead_adjust - report whether read-ahead data was used
+ *                        (HIT) or lost before it was needed.
+ *     readahead_next   - after a sequential read ending at POS,
+ *                        return true and the range to fetch in
+ *                        *START and *END if more read-ahead is
+ *                        wanted.
+ */
+
+enum ra_pattern {
+	RA_RANDOM,
+	RA_SEQUENTIAL,
+	RA_READAHEAD,
+};
+
+struct readahead {
+	off_t ra_next;		/* where a sequential read would start */
+	off_t ra_end;		/* end of what's been read ahead */
+	unsigned ra_run;	/* reads in the current stream */
+	unsigned ra_window;	/* current read-ahead size */
+	unsigned ra_min;	/* smallest window */
+	unsigned ra_max;	/* largest window */
+};
+
+void readahead_init(struct readahead *ra, unsigned min, unsigned max);
+enum ra_pattern readahead_access(struct readahead *ra, off_t start,
+				 off_t end);
+void readahead_adjust(struct readahead *ra, bool hit);
+bool readahead_next(struct readahead *ra, off_t pos,
+		    off_t *start, off_t *end);
+
+
+#endif /* _READAHEAD_H_ */
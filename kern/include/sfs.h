@@ -41,6 +41,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include <readahead.h>
 
 /*
  * Get on-disk structures and constants that are made available to
@@ -56,6 +57,9 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_vnode *sv_hashnext;  /* next in vnode hash chain */
+	struct sfs_vnode **sv_hashprevp; /* pointer to us in hash chain */
+	struct readahead sv_ra;         /* read-ahead state */
 };
 
 /*
@@ -66,11 +70,18 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnhash;  /* vnodes loaded, hashed by ino */
+	unsigned sfs_vnhashsize;        /* number of hash chains */
+	unsigned sfs_numvnodes;         /* number of vnodes loaded */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
 };
 
+/*
+ * Setup function, called from vfs_bootstrap.
+ */
+void sfs_bootstrap(void);
+
 /*
  * Function for mounting a sfs (calls vfs_mount)
  */
@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include "opt-ticketlock.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,9 +55,18 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * With "options ticketlock" spinlocks are ticket locks: each CPU
+ * takes the next number from splk_lock and waits until splk_serving
+ * reaches it. The lock is then granted in FIFO order, and waiters
+ * only read the shared line (backing off in proportion to their
+ * place in line) instead of all hammering it with test-and-set.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+#if OPT_TICKETLOCK
+	volatile spinlock_data_t splk_serving; /* Ticket now holding. */
+#endif
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
@@ -64,11 +74,18 @@ struct spinlock {
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
+#if OPT_TICKETLOCK
+#define SPINLOCK_DATA_INITIALIZERS	SPINLOCK_DATA_INITIALIZER, \
+					SPINLOCK_DATA_INITIALIZER
+#else
+#define SPINLOCK_DATA_INITIALIZERS	SPINLOCK_DATA_INITIALIZER
+#endif
+
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZERS, NULL, \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZERS, NULL }
 #endif
 
 /*
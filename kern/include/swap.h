@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Paging to a swap disk.
+ *
+ * At boot, swap_bootstrap attaches the first hard disk (lhd0) with
+ * vfs_swapon and divides it into page-sized slots, tracked with a
+ * bitmap. If there's no disk, the system runs without swap, and
+ * running out of memory is fatal to whoever does it, as before.
+ *
+ * Pages to page out are chosen by the coremap (coremap_pickvictim)
+ * using the clock algorithm. A pageout thread tries to keep a reserve
+ * of free pages so faults don't usually have to wait for a write;
+ * when that isn't enough, allocators page things out themselves.
+ *
+ * Functions:
+ *     swap_bootstrap - attach the swap disk and start the pageout
+ *                      thread. Called from vm_bootstrap.
+ *     swap_evict     - page one page out to free it. Returns an
+ *                      error code if nothing can be paged out.
+ *     swap_kick      - wake the pageout thread if memory is getting
+ *                      low. Call after allocating pages.
+ *     swap_pagein    - read the page in swap slot SLOT into the
+ *                      physical page PA. Doesn't free the slot.
+ *     swap_free      - free a swap slot.
+ *     swap_dup       - copy a swap slot to a new one, which is
+ *                      returned in NEWSLOT. Returns an error code.
+ */
+
+void swap_bootstrap(void);
+int swap_evict(void);
+void swap_kick(void);
+int swap_pagein(unsigned slot, paddr_t pa);
+void swap_free(unsigned slot);
+int swap_dup(unsigned slot, unsigned *newslot);
+
+
+#endif /* _SWAP_H_ */
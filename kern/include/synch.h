@@ -62,6 +62,12 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P_timed is P that gives up after TICKS hardclock ticks. Returns 0
+ * if it decremented the count, or ETIMEDOUT.
+ */
+int P_timed(struct semaphore *, unsigned ticks);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -75,10 +81,24 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+        volatile spinlock_data_t lk_held;   /* 1 if held; set with LL/SC */
+        struct thread *volatile lk_owner;   /* Thread holding the lock */
+        volatile unsigned lk_waiters;       /* Threads asleep on lk_wchan */
+        unsigned lk_spinmax;                /* Spin limit; 0 never spins */
+        struct wchan *lk_wchan;
+        struct spinlock lk_spinlock;        /* Protects lk_wchan */
+        unsigned lk_contended;              /* Acquires that missed */
+        unsigned lk_sleeps;                 /* Acquires that slept */
 };
 
+/*
+ * Number of times lock_acquire polls a lock whose holder is running
+ * on another CPU before giving up and going to sleep. Critical
+ * sections under sleep locks are usually short, so this is normally
+ * much cheaper than a trip through the scheduler.
+ */
+#define LOCK_SPINMAX 1000
+
 struct lock *lock_create(const char *name);
 void lock_destroy(struct lock *);
 
@@ -91,7 +111,11 @@ void lock_destroy(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
- * These operations must be atomic. You get to write them.
+ * lock_acquire first tries to take the lock with a single atomic
+ * operation. If that fails it spins, for at most lk_spinmax tries,
+ * as long as the holder is running on another CPU, and then sleeps.
+ * lk_contended and lk_sleeps count how often each of the two slow
+ * paths was needed.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
@@ -114,8 +138,8 @@ bool lock_do_i_hold(struct lock *);
 
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+        struct wchan *cv_wchan;
+        struct spinlock cv_spinlock;    /* Protects cv_wchan */
 };
 
 struct cv *cv_create(const char *name);
@@ -132,12 +156,20 @@ void cv_destroy(struct cv *);
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
- * These operations must be atomic. You get to write them.
+ * These operations are atomic.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_timedwait is cv_wait that also wakes up after TICKS hardclock
+ * ticks. Returns ETIMEDOUT if it was the timeout that woke it, and 0
+ * otherwise. As with cv_wait, the caller must recheck its condition
+ * either way.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
+
 /*
  * Reader-writer locks.
  *
@@ -148,10 +180,38 @@ void cv_broadcast(struct cv *cv, struct lock *lock);
  * (should be) made internally.
  */
 
+/*
+ * Readers are counted per CPU, in slots each on its own cache line,
+ * so that readers on different CPUs don't contend. A thread may
+ * release its read hold on a different CPU than it acquired it, so
+ * single slots can go negative; only the sum (plus rw_handoff, read
+ * holds granted by a departing writer) means anything.
+ *
+ * Writers are preferred: once one is waiting (rw_writers > 0) new
+ * readers queue up behind it. When a writer releases, every reader
+ * queued by then is let in as a batch before the next writer, so
+ * neither side can starve the other.
+ */
+#define RWLOCK_NSLOTS 8
+#define RWLOCK_SLOTSIZE 64
+
+struct rwlock_slot {
+        struct spinlock rs_lock;
+        volatile int rs_readers;
+} __ALIGNED(RWLOCK_SLOTSIZE);
+
 struct rwlock {
+        struct rwlock_slot rw_slots[RWLOCK_NSLOTS];
         char *rwlock_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+        struct spinlock rw_lock;          /* Protects all the below */
+        volatile unsigned rw_writers;     /* Writers waiting or holding */
+        struct thread *rw_writer;         /* Writer holding, if any */
+        unsigned rw_handoff;              /* Read holds given by writer */
+        unsigned rw_readwaiters;          /* Readers on rw_readwchan */
+        unsigned rw_readgen;              /* Bumped at each handoff */
+        struct wchan *rw_readwchan;       /* Readers behind a writer */
+        struct wchan *rw_writewchan;      /* Writers behind a writer */
+        struct wchan *rw_drainwchan;      /* Writer waiting for readers */
 };
 
 struct rwlock * rwlock_create(const char *);
@@ -166,7 +226,7 @@ void rwlock_destroy(struct rwlock *);
  *                           hold the write lock at one time.
  *    rwlock_release_write - Free the write lock.
  *
- * These operations must be atomic. You get to write them.
+ * These operations are atomic.
  */
 
 void rwlock_acquire_read(struct rwlock *);
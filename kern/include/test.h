@@ -57,12 +57,17 @@ int threadlisttest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
+int threadtest5(int, char **);
+int timeouttest(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int locktest2(int, char **);
 int locktest3(int, char **);
 int locktest4(int, char **);
 int locktest5(int, char **);
+int lockbench(int, char **);
+int spinlockbench(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
 int cvtest3(int, char **);
@@ -73,6 +78,7 @@ int rwtest2(int, char **);
 int rwtest3(int, char **);
 int rwtest4(int, char **);
 int rwtest5(int, char **);
+int rwbench(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -105,6 +111,7 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int vnodebench(int, char **);
 int printfile(int, char **);
 
 /* HMAC/hash tests */
@@ -116,8 +123,16 @@ int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int kmalloctest5(int, char **);
+int kmalloctest6(int, char **);
+int kmalloctest7(int, char **);
 int nettest(int, char **);
 
+/* benchmark helpers, in bench.c */
+void bench_fork(const char *name, unsigned nthreads,
+		void (*func)(void *, unsigned long), void *data);
+void bench_threaddone(void);
+uint64_t bench_wait(void);
+
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
 
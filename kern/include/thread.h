@@ -116,6 +116,19 @@ struct thread {
 	 * Public fields
 	 */
 
+	/*
+	 * Scheduling state. t_priority is the thread's run queue
+	 * level (0 is highest); t_quantum is the number of hardclock
+	 * ticks left before it's demoted, and t_ticks is the total
+	 * number of ticks it has been charged for. t_affinity is the
+	 * number of ticks it should run where it is before another
+	 * cpu steals it again. See schedule().
+	 */
+	unsigned t_priority;
+	unsigned t_quantum;
+	unsigned t_ticks;
+	unsigned t_affinity;
+
 	/* add more here as needed */
 };
 
@@ -168,17 +181,30 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for a clock tick, and yield if its
+ * quantum has run out or a higher-priority thread is waiting.
+ * Called from the timer interrupt.
+ */
+void thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
+ * Potentially steal ready threads from busier CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Free the threads (and stacks) cached for reuse by thread_fork.
+ * Called when memory is short. Returns the number freed.
+ */
+unsigned thread_reclaim(void);
+
 extern unsigned thread_count;
 void thread_wait_for_count(unsigned);
 
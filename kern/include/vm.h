@@ -65,5 +65,38 @@ unsigned int coremap_used_bytes(void);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Switch the TLB to an address space (used by addrspace.c) */
+struct addrspace;
+void vm_tlbactivate(struct addrspace *as);
+
+/* Invalidate all of an address space's TLB entries (used by addrspace.c) */
+void vm_tlbflush_as(struct addrspace *as);
+
+/*
+ * Batched TLB shootdown (used by swap.c).
+ *
+ * Collect the pages to invalidate in a struct vm_shootdown with
+ * vm_shootdown_add, which returns false when the batch is full.
+ * vm_shootdown_start invalidates them here and sends the batch, in a
+ * single IPI per CPU, to the CPUs that may have them mapped. The
+ * caller can then get on with something else until it needs the
+ * pages gone, and wait for the other CPUs with vm_shootdown_wait. The
+ * batch must not be touched (or go out of scope) in between.
+ */
+#define VM_SHOOTDOWN_PAGES 16
+
+struct vm_shootdown {
+	unsigned sd_npages;
+	struct addrspace *sd_as[VM_SHOOTDOWN_PAGES];
+	vaddr_t sd_vaddr[VM_SHOOTDOWN_PAGES];
+	unsigned sd_pending;		/* CPUs yet to acknowledge */
+};
+
+void vm_shootdown_init(struct vm_shootdown *sd);
+bool vm_shootdown_add(struct vm_shootdown *sd, struct addrspace *as,
+		      vaddr_t vaddr);
+void vm_shootdown_start(struct vm_shootdown *sd);
+void vm_shootdown_wait(struct vm_shootdown *sd);
+
 
 #endif /* _VM_H_ */
@@ -76,5 +76,14 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up a particular thread, if it is sleeping on the wait channel.
+ * Returns true if it was. The associated spinlock should be locked.
+ * This is for timeouts; it walks the list of sleepers.
+ */
+struct thread;
+bool wchan_wakethread(struct wchan *wc, struct spinlock *lk,
+		      struct thread *target);
+
 
 #endif /* _WCHAN_H_ */
@@ -35,6 +35,10 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
+#include <buf.h>
+#include <dcache.h>
+#include <prof.h>
 #include <mainbus.h>
 #include <synch.h>
 #include <thread.h>
@@ -463,6 +467,95 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+static
+int
+cmd_tlbstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printtlbstats();
+
+	return 0;
+}
+
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printschedstats();
+
+	return 0;
+}
+
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buf_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing name cache stats.
+ */
+static
+int
+cmd_dcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	dcache_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for the kernel profiler.
+ */
+static
+int
+cmd_prof(int nargs, char **args)
+{
+	const char *outfile, *kernfile;
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		result = prof_start();
+		if (result) {
+			kprintf("prof on: %s\n", strerror(result));
+			return result;
+		}
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		prof_stop();
+		return 0;
+	}
+	if (nargs >= 2 && nargs <= 4 && !strcmp(args[1], "dump")) {
+		outfile = nargs > 2 ? args[2] : "emu0:kernprof.txt";
+		kernfile = nargs > 3 ? args[3] : "emu0:kernel";
+		result = prof_dump(outfile, kernfile);
+		if (result) {
+			kprintf("prof dump: %s\n", strerror(result));
+			return result;
+		}
+		kprintf("Profile written to %s\n", outfile);
+		return 0;
+	}
+
+	kprintf("Usage: prof on | off | dump [outfile [kernelfile]]\n");
+	return EINVAL;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -583,9 +676,14 @@ static const char *testmenu[] = {
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
 	"[km5] kmalloc coremap alloc test    ",
+	"[km6] kmalloc scalability test      ",
+	"[km7] kfree cost test               ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread test 4 (scaling)       ",
+	"[tt5] Thread test 5 (fork latency)  ",
+	"[tmo] Timeout latency test          ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -595,6 +693,8 @@ static const char *testmenu[] = {
 	"[lt3]  Lock test 3           (1*)   ",
 	"[lt4]  Lock test 4           (1*)   ",
 	"[lt5]  Lock test 5           (1*)   ",
+	"[lkb]  Lock benchmark               ",
+	"[slb]  Spinlock benchmark           ",
 	"[cvt1] CV test 1             (1)    ",
 	"[cvt2] CV test 2             (1)    ",
 	"[cvt3] CV test 3             (1*)   ",
@@ -605,6 +705,7 @@ static const char *testmenu[] = {
 	"[rwt3] RW lock test 3        (1?)   ",
 	"[rwt4] RW lock test 4        (1?)   ",
 	"[rwt5] RW lock test 5        (1?)   ",
+	"[rwb]  RW lock benchmark            ",
 #if OPT_SYNCHPROBS
 	"[sp1] Whalemating test       (1)    ",
 	"[sp2] Stoplight test         (1)    ",
@@ -616,6 +717,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[fs7] FS vnode lookup benchmark     ",
 	"[hm1] HMAC unit test                ",
 	NULL
 };
@@ -667,6 +769,11 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[tlb] TLB fault stats               ",
+	"[sched] Scheduler stats             ",
+	"[buf] Buffer cache stats            ",
+	"[dc] Name cache stats               ",
+	"[prof] Kernel profiler (on/off/dump)",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -722,6 +829,11 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "tlb",        cmd_tlbstats },
+	{ "sched",      cmd_schedstats },
+	{ "buf",        cmd_bufstats },
+	{ "dc",         cmd_dcachestats },
+	{ "prof",       cmd_prof },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -733,12 +845,17 @@ static struct {
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
 	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
+	{ "km7",	kmalloctest7 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
+	{ "tt5",	threadtest5 },
+	{ "tmo",	timeouttest },
 
 	/* synchronization assignment tests */
 	{ "sem1",	semtest },
@@ -747,6 +864,8 @@ static struct {
 	{ "lt3",	locktest3 },
 	{ "lt4", 	locktest4 },
 	{ "lt5", 	locktest5 },
+	{ "lkb",	lockbench },
+	{ "slb",	spinlockbench },
 	{ "cvt1",	cvtest },
 	{ "cvt2",	cvtest2 },
 	{ "cvt3",	cvtest3 },
@@ -757,6 +876,7 @@ static struct {
 	{ "rwt3",	rwtest3 },
 	{ "rwt4",	rwtest4 },
 	{ "rwt5",	rwtest5 },
+	{ "rwb",	rwbench },
 #if OPT_SYNCHPROBS
 	{ "sp1",	whalemating },
 	{ "sp2",	stoplight },
@@ -793,6 +913,7 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "fs7",	vnodebench },
 
 	/* HMAC unit tests */
 	{ "hm1",	hmacu1 },
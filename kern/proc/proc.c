@@ -48,12 +48,40 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <kmem_cache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Object cache for proc structures.
+ */
+static struct kmem_cache *proc_cache;
+
+/*
+ * Object cache constructor and destructor: p_lock is never held while
+ * the proc is free, so it only needs setting up once.
+ */
+static
+void
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_init(&proc->p_lock);
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_cleanup(&proc->p_lock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -63,18 +91,18 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
 	proc->p_numthreads = 0;
-	spinlock_init(&proc->p_lock);
+	/* p_lock is set up by proc_ctor */
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -166,10 +194,10 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_numthreads == 0);
-	spinlock_cleanup(&proc->p_lock);
+	KASSERT(!spinlock_do_i_hold(&proc->p_lock));
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -178,6 +206,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
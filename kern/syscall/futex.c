@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: sleeping and waking on a word of user memory.
+ *
+ * futex_wait(uaddr, val) sleeps if *uaddr still contains val, and
+ * futex_wake(uaddr, n) wakes up to n threads sleeping on uaddr. The
+ * user-level code that uses them (see umutex in libc) does all the
+ * work with atomic operations on the word and only comes here to
+ * sleep when there's contention, so uncontended locking never enters
+ * the kernel at all.
+ *
+ * Sleepers are kept in a hash table keyed on the address space and
+ * the user address. Each bucket has a sleep lock, which is held
+ * across the check of *uaddr so that a wakeup between the check and
+ * the sleep can't be lost, and a CV that the bucket's sleepers wait
+ * on. A wakeup marks the sleepers it picks and broadcasts; any others
+ * that happen to share the bucket go back to sleep.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS 64
+
+/*
+ * One sleeper. Lives on the sleeping thread's stack.
+ */
+struct futex_waiter {
+	struct addrspace *fw_as;
+	userptr_t fw_uaddr;
+	bool fw_woken;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+/*
+ * Set up the hash table.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Find the bucket for a user address in the current address space.
+ */
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, userptr_t uaddr)
+{
+	uintptr_t key;
+
+	key = (uintptr_t)uaddr >> 2;
+	key ^= (uintptr_t)as >> 4;
+	return &futex_table[key % FUTEX_NBUCKETS];
+}
+
+/*
+ * Check the futex address: it must be an aligned int in a process
+ * that has an address space.
+ */
+static
+int
+futex_check(userptr_t uaddr, struct addrspace **ret)
+{
+	if ((uintptr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	*ret = proc_getas();
+	if (*ret == NULL) {
+		return EFAULT;
+	}
+	return 0;
+}
+
+int
+sys_futex_wait(userptr_t uaddr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **fwp;
+	struct addrspace *as;
+	int cur, result;
+
+	result = futex_check(uaddr, &as);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(as, uaddr);
+
+	lock_acquire(fb->fb_lock);
+
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		/* Changed since the caller looked; go try again. */
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	fw.fw_as = as;
+	fw.fw_uaddr = uaddr;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+
+	/* Go on the end, so wakeups are first come first served. */
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next);
+	*fwp = &fw;
+
+	/* futex_wake unlinks us when it sets fw_woken. */
+	while (!fw.fw_woken) {
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+int
+sys_futex_wake(userptr_t uaddr, int count, int32_t *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **fwp, *fw;
+	struct addrspace *as;
+	int result, woken;
+
+	result = futex_check(uaddr, &as);
+	if (result) {
+		return result;
+	}
+	if (count < 0) {
+		return EINVAL;
+	}
+	fb = futex_hash(as, uaddr);
+
+	lock_acquire(fb->fb_lock);
+
+	/* Unlink and mark the first COUNT sleepers on this address. */
+	woken = 0;
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < count) {
+		fw = *fwp;
+		if (fw->fw_as == as && fw->fw_uaddr == uaddr) {
+			*fwp = fw->fw_next;
+			fw->fw_next = NULL;
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			fwp = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,32 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the requested interval, rounded up to whole hardclock
+ * ticks. Nothing can interrupt the sleep, so the time remaining is
+ * always zero and USER_REM is left alone.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req;
+	unsigned ticks;
+	int result;
+
+	(void)user_rem;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = timespec_to_ticks(&req);
+	if (ticks > 0) {
+		ticksleep(ticks);
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Helpers for the benchmarks in this directory: fork a batch of
+ * threads, wait for them all to finish, and time it. Benchmarks are
+ * run from the menu one at a time, so the state is kept here.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+static struct semaphore *bench_sem;
+static unsigned bench_nthreads;
+static struct timespec bench_start;
+
+/*
+ * Start the clock and fork NTHREADS threads running FUNC. Thread I
+ * is named NAME-I and gets DATA and I as its arguments; it must call
+ * bench_threaddone when it's finished.
+ */
+void
+bench_fork(const char *name, unsigned nthreads,
+	   void (*func)(void *, unsigned long), void *data)
+{
+	char tname[16];
+	unsigned i;
+	int result;
+
+	if (bench_sem == NULL) {
+		bench_sem = sem_create("bench", 0);
+		if (bench_sem == NULL) {
+			panic("%s: sem_create failed\n", name);
+		}
+	}
+	KASSERT(bench_nthreads == 0);
+	bench_nthreads = nthreads;
+
+	gettime(&bench_start);
+	for (i=0; i<nthreads; i++) {
+		snprintf(tname, sizeof(tname), "%s-%u", name, i);
+		result = thread_fork(tname, NULL, func, data, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+}
+
+void
+bench_threaddone(void)
+{
+	V(bench_sem);
+}
+
+/*
+ * Wait for the threads started by bench_fork and return the time
+ * since they were started, in nanoseconds.
+ */
+uint64_t
+bench_wait(void)
+{
+	struct timespec now, diff;
+	unsigned i;
+
+	for (i=0; i<bench_nthreads; i++) {
+		P(bench_sem);
+	}
+	bench_nthreads = 0;
+	gettime(&now);
+
+	timespec_sub(&now, &bench_start, &diff);
+	return diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+}
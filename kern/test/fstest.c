@@ -42,6 +42,7 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <lib.h>
+#include <clock.h>
 #include <uio.h>
 #include <thread.h>
 #include <synch.h>
@@ -56,6 +57,8 @@
 #define NTHREADS 12
 #define NLONG    32
 #define NCREATE  24
+#define NVNB     1024	/* max files held open by vnodebench */
+#define NVNBLOOK 2000	/* lookups timed per step */
 
 static struct semaphore *threadsem = NULL;
 
@@ -674,6 +677,108 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Vnode lookup benchmark. Hold more and more distinct files open
+ * (so their vnodes stay loaded), and at each step time lookups of
+ * one more file, the probe. SFS has no subdirectories, so everything
+ * is in the root directory and the directory search for the probe
+ * grows with the number of files too; compare against a run with
+ * few files open to see what the vnode table itself costs.
+ */
+
+static
+void
+vnodebench_time(const char *filesys, unsigned numopen)
+{
+	struct timespec before, after, diff;
+	struct vnode *vn;
+	char name[32];
+	uint64_t ns;
+	unsigned i;
+	int err;
+
+	gettime(&before);
+	for (i=0; i<NVNBLOOK; i++) {
+		/* vfs_lookup destroys the string it's passed */
+		snprintf(name, sizeof(name), "%s:vnb.probe", filesys);
+		err = vfs_lookup(name, &vn);
+		if (err) {
+			kprintf("vnodebench: lookup: %s\n", strerror(err));
+			return;
+		}
+		VOP_DECREF(vn);
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &diff);
+	ns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	kprintf("%5u files open: %llu ns per lookup\n",
+		numopen, ns / NVNBLOOK);
+}
+
+static
+void
+dovnodebench(const char *filesys)
+{
+	struct vnode **vns;
+	struct vnode *probe;
+	char name[32];
+	unsigned num, step, i;
+	int err;
+
+	kprintf("*** Starting vnode lookup benchmark on %s:\n", filesys);
+
+	vns = kmalloc(NVNB * sizeof(*vns));
+	if (vns == NULL) {
+		kprintf("vnodebench: Out of memory\n");
+		return;
+	}
+
+	/* Create the probe first, so it's near the front of the directory */
+	snprintf(name, sizeof(name), "%s:vnb.probe", filesys);
+	err = vfs_open(name, O_WRONLY|O_CREAT, 0664, &probe);
+	if (err) {
+		kprintf("vnodebench: create probe: %s\n", strerror(err));
+		kfree(vns);
+		return;
+	}
+	vfs_close(probe);
+
+	num = 0;
+	for (step = 16; step <= NVNB; step *= 4) {
+		for (; num < step; num++) {
+			snprintf(name, sizeof(name), "%s:vnb.%u",
+				 filesys, num);
+			err = vfs_open(name, O_WRONLY|O_CREAT, 0664,
+				       &vns[num]);
+			if (err) {
+				kprintf("vnodebench: create %u: %s\n",
+					num, strerror(err));
+				goto done;
+			}
+		}
+		vnodebench_time(filesys, num);
+	}
+
+done:
+	for (i=0; i<num; i++) {
+		vfs_close(vns[i]);
+		snprintf(name, sizeof(name), "%s:vnb.%u", filesys, i);
+		err = vfs_remove(name);
+		if (err) {
+			kprintf("vnodebench: remove %u: %s\n",
+				i, strerror(err));
+		}
+	}
+	snprintf(name, sizeof(name), "%s:vnb.probe", filesys);
+	vfs_remove(name);
+	kfree(vns);
+
+	kprintf("*** vnode lookup benchmark done\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
@@ -681,7 +786,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[123456] filesystem:\n");
+		kprintf("Usage: fs[1234567] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -714,6 +819,7 @@ DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(longstress);
 DEFTEST(createstress);
+DEFTEST(vnodebench);
 
 ////////////////////////////////////////////////////////////
 
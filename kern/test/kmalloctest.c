@@ -36,13 +36,12 @@
 #include <cpu.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
 #include <kern/test161.h>
 #include <mainbus.h>
 
-#include "opt-dumbvm.h"
-
 // from arch/mips/vm/ram.c
 extern vaddr_t firstfree;
 
@@ -389,9 +388,6 @@ kmalloctest4(int nargs, char **args)
 	(void)args;
 
 	kprintf("Starting multipage kmalloc test...\n");
-#if OPT_DUMBVM
-	kprintf("(This test will not work with dumbvm)\n");
-#endif
 
 	sem = sem_create("kmalloctest4", 0);
 	if (sem == NULL) {
@@ -460,10 +456,6 @@ kmalloctest5(int nargs, char **args)
 		}
 	}
 
-#if OPT_DUMBVM
-	kprintf("(This test will not work with dumbvm)\n");
-#endif
-
 	// First, we need to figure out how much memory we're running with and how
 	// much space it will take up if we maintain a pointer to each allocated
 	// page. We do something similar to km3 - for 32 bit systems with
@@ -605,3 +597,163 @@ kmalloctest5(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km6
+
+/*
+ * kmalloc scalability benchmark. Run 1, 2, 4, ... threads (up to one
+ * per cpu), each of which allocates and frees small blocks of assorted
+ * sizes as fast as it can, and report the aggregate allocation rate
+ * for each thread count. With the per-cpu magazines in front of the
+ * subpage allocator this should go up with the number of cpus rather
+ * than flatten out on kmalloc_spinlock.
+ */
+
+#define KM6_ALLOCS 20000
+#define KM6_BATCH 8
+
+static
+void
+kmalloctest6thread(void *sm, unsigned long num)
+{
+	static const unsigned sizes[KM6_BATCH] = {
+		16, 24, 100, 200, 32, 500, 64, 1000
+	};
+	struct semaphore *sem = sm;
+	void *ptrs[KM6_BATCH];
+	unsigned i, j;
+
+	for (i=0; i<KM6_ALLOCS / KM6_BATCH; i++) {
+		for (j=0; j<KM6_BATCH; j++) {
+			ptrs[j] = kmalloc(sizes[j]);
+			if (ptrs[j] == NULL) {
+				panic("kmalloctest6: thread %lu: "
+				      "allocating %u bytes failed\n",
+				      num, sizes[j]);
+			}
+		}
+		for (j=0; j<KM6_BATCH; j++) {
+			kfree(ptrs[j]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest6(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after, duration;
+	unsigned nthreads, i;
+	uint64_t nsecs, rate;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	sem = sem_create("kmalloctest6", 0);
+	if (sem == NULL) {
+		panic("kmalloctest6: sem_create failed\n");
+	}
+
+	kprintf("Starting kmalloc scalability test...\n");
+
+	nthreads = 1;
+	while (1) {
+		gettime(&before);
+		for (i=0; i<nthreads; i++) {
+			result = thread_fork("kmalloctest6", NULL,
+					     kmalloctest6thread, sem, i);
+			if (result) {
+				panic("kmalloctest6: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(sem);
+		}
+		gettime(&after);
+
+		timespec_sub(&after, &before, &duration);
+		nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+		rate = nsecs == 0 ? 0 :
+			(uint64_t)nthreads * KM6_ALLOCS * 1000000000ULL / nsecs;
+		kprintf("km6: %u thread(s): %llu allocations/sec\n",
+			nthreads, (unsigned long long)rate);
+
+		if (nthreads >= num_cpus) {
+			break;
+		}
+		nthreads = nthreads * 2 > num_cpus ? num_cpus : nthreads * 2;
+	}
+
+	sem_destroy(sem);
+
+	success(TEST161_SUCCESS, SECRET, "km6");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// km7
+//
+// Measure the cost of kfree as the kernel heap grows. We fill the
+// heap with an increasing number of small blocks and time freeing
+// every other one, so the pages stay in use while we do it. The cost
+// per kfree should stay flat; if finding a block's page takes a
+// search, it won't.
+
+#define KM7_MINBLOCKS 128
+#define KM7_MAXBLOCKS 8192
+#define KM7_BLOCKSIZE 64
+
+int
+kmalloctest7(int nargs, char **args)
+{
+	void **ptrs;
+	struct timespec before, after, duration;
+	unsigned nblocks, i;
+	uint64_t nsecs;
+
+	(void)nargs;
+	(void)args;
+
+	ptrs = kmalloc(KM7_MAXBLOCKS * sizeof(ptrs[0]));
+	if (ptrs == NULL) {
+		panic("kmalloctest7: Out of memory\n");
+	}
+
+	kprintf("Starting kfree cost test...\n");
+
+	for (nblocks = KM7_MINBLOCKS; nblocks <= KM7_MAXBLOCKS; nblocks *= 2) {
+		for (i=0; i<nblocks; i++) {
+			ptrs[i] = kmalloc(KM7_BLOCKSIZE);
+			if (ptrs[i] == NULL) {
+				panic("kmalloctest7: allocating block %u of %u "
+				      "failed\n", i, nblocks);
+			}
+		}
+
+		gettime(&before);
+		for (i=0; i<nblocks; i+=2) {
+			kfree(ptrs[i]);
+		}
+		gettime(&after);
+
+		for (i=1; i<nblocks; i+=2) {
+			kfree(ptrs[i]);
+		}
+
+		timespec_sub(&after, &before, &duration);
+		nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+		kprintf("km7: %u blocks (%u pages): %llu ns/kfree\n",
+			nblocks, nblocks * KM7_BLOCKSIZE / PAGE_SIZE,
+			(unsigned long long)(nsecs / (nblocks / 2)));
+	}
+
+	kfree(ptrs);
+
+	success(TEST161_SUCCESS, SECRET, "km7");
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock benchmark: adaptive spinning versus pure sleeping.
+ *
+ * Several threads repeatedly take a shared lock, do a little work
+ * while holding it, and a little more without it. Each run is done
+ * twice on the same lock: once with the usual spin limit, and once
+ * with lk_spinmax set to 0 so that every contended acquire goes
+ * straight to sleep. With more than one CPU the adaptive lock should
+ * sleep far less often and finish sooner; on one CPU the two should
+ * be about the same, since the holder is never running elsewhere.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <synch.h>
+#include <test.h>
+
+#define LKB_MAXTHREADS	16
+#define LKB_LOOPS	2000	/* acquires per thread */
+#define LKB_HOLD	50	/* work with the lock held */
+#define LKB_THINK	200	/* work between acquires */
+
+static struct lock *lkblock;
+static volatile unsigned long lkbcount;
+
+static
+void
+lkbthread(void *junk, unsigned long num)
+{
+	volatile unsigned j;
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<LKB_LOOPS; i++) {
+		lock_acquire(lkblock);
+		lkbcount++;
+		for (j=0; j<LKB_HOLD; j++);
+		lock_release(lkblock);
+		for (j=0; j<LKB_THINK; j++);
+	}
+
+	bench_threaddone();
+}
+
+/*
+ * Run NTHREADS threads against the lock with the given spin limit
+ * and print the elapsed time and contention counts.
+ */
+static
+void
+lkbrun(unsigned nthreads, unsigned spinmax)
+{
+	uint64_t nsecs;
+
+	lkblock->lk_spinmax = spinmax;
+	lkblock->lk_contended = 0;
+	lkblock->lk_sleeps = 0;
+	lkbcount = 0;
+
+	bench_fork("lkb", nthreads, lkbthread, NULL);
+	nsecs = bench_wait();
+
+	if (lkbcount != (unsigned long)nthreads * LKB_LOOPS) {
+		panic("lkb: count is %lu, expected %lu\n", lkbcount,
+		      (unsigned long)nthreads * LKB_LOOPS);
+	}
+
+	kprintf("lkb: %2u threads, %-8s %llu ms, %u contended, %u slept\n",
+		nthreads, spinmax > 0 ? "adaptive" : "sleep",
+		nsecs / 1000000,
+		lkblock->lk_contended, lkblock->lk_sleeps);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned nthreads;
+
+	(void)nargs;
+	(void)args;
+
+	lkblock = lock_create("lkblock");
+	if (lkblock == NULL) {
+		panic("lkb: lock_create failed\n");
+	}
+
+	kprintf("Starting lock benchmark (%u cpus)...\n", num_cpus);
+	for (nthreads = 2; nthreads <= LKB_MAXTHREADS; nthreads *= 2) {
+		lkbrun(nthreads, LOCK_SPINMAX);
+		lkbrun(nthreads, 0);
+	}
+	kprintf("Lock benchmark done.\n");
+
+	lock_destroy(lkblock);
+	lkblock = NULL;
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reader-writer lock benchmark.
+ *
+ * Runs 1, 2, 4, ... threads, up to the number of CPUs, each taking
+ * the read lock in a tight loop for a second and occasionally the
+ * write lock, and reports reads per second. With readers counted per
+ * CPU, throughput should grow about linearly with the CPUs.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <test.h>
+
+#define RWB_SECONDS	1
+#define RWB_WRITEEVERY	1024	/* reads per write, per thread */
+
+static struct rwlock *rwblock;
+static volatile bool rwbstop;
+static volatile unsigned long rwbval1, rwbval2;
+static volatile unsigned long rwbreads, rwbwrites;
+static struct spinlock rwbcountlock = SPINLOCK_INITIALIZER;
+
+static
+void
+rwbthread(void *junk, unsigned long num)
+{
+	unsigned long reads, writes;
+
+	(void)junk;
+	(void)num;
+
+	reads = writes = 0;
+	while (!rwbstop) {
+		rwlock_acquire_read(rwblock);
+		if (rwbval1 != rwbval2) {
+			panic("rwb: read saw a partial write\n");
+		}
+		rwlock_release_read(rwblock);
+		reads++;
+
+		if (reads % RWB_WRITEEVERY == 0) {
+			rwlock_acquire_write(rwblock);
+			rwbval1++;
+			rwbval2++;
+			rwlock_release_write(rwblock);
+			writes++;
+		}
+	}
+
+	spinlock_acquire(&rwbcountlock);
+	rwbreads += reads;
+	rwbwrites += writes;
+	spinlock_release(&rwbcountlock);
+
+	bench_threaddone();
+}
+
+static
+void
+rwbrun(unsigned nthreads)
+{
+	rwbstop = false;
+	rwbreads = rwbwrites = 0;
+	bench_fork("rwb", nthreads, rwbthread, NULL);
+	clocksleep(RWB_SECONDS);
+	rwbstop = true;
+	bench_wait();
+
+	kprintf("rwb: %2u threads: %lu reads/sec, %lu writes/sec\n",
+		nthreads, rwbreads / RWB_SECONDS, rwbwrites / RWB_SECONDS);
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	unsigned nthreads;
+
+	(void)nargs;
+	(void)args;
+
+	rwblock = rwlock_create("rwblock");
+	if (rwblock == NULL) {
+		panic("rwb: rwlock_create failed\n");
+	}
+
+	kprintf("Starting rwlock benchmark (%u cpus)...\n", num_cpus);
+	for (nthreads = 1; nthreads < num_cpus; nthreads *= 2) {
+		rwbrun(nthreads);
+	}
+	rwbrun(num_cpus);
+	kprintf("Rwlock benchmark done.\n");
+
+	rwlock_destroy(rwblock);
+	rwblock = NULL;
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock benchmark: throughput and fairness under contention.
+ *
+ * Starts one thread per CPU (or as many as asked for), each of which
+ * takes and releases one shared spinlock as fast as it can for a few
+ * seconds. Reports the total acquire rate and the spread between the
+ * threads that got the lock most and least often. Test-and-set
+ * spinlocks tend to favor whichever CPU released the lock last;
+ * ticket locks ("options ticketlock") should keep the spread small.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <test.h>
+
+#define SLB_MAXTHREADS	32
+#define SLB_SECONDS	2
+#define SLB_HOLD	10	/* work with the lock held */
+#define SLB_THINK	10	/* work between acquires */
+
+static struct spinlock slblock = SPINLOCK_INITIALIZER;
+static volatile bool slbstop;
+static volatile unsigned long slbshared;
+static unsigned long slbcounts[SLB_MAXTHREADS];
+
+static
+void
+slbthread(void *junk, unsigned long num)
+{
+	unsigned long count;
+	volatile unsigned j;
+
+	(void)junk;
+
+	count = 0;
+	while (!slbstop) {
+		spinlock_acquire(&slblock);
+		slbshared++;
+		for (j=0; j<SLB_HOLD; j++);
+		spinlock_release(&slblock);
+		count++;
+		for (j=0; j<SLB_THINK; j++);
+	}
+	slbcounts[num] = count;
+
+	bench_threaddone();
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	unsigned long total, min, max;
+	unsigned nthreads, i;
+
+	nthreads = num_cpus;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nthreads < 1 || nthreads > SLB_MAXTHREADS) {
+		kprintf("Usage: slb [1-%u]\n", SLB_MAXTHREADS);
+		return EINVAL;
+	}
+
+	kprintf("Starting spinlock benchmark (%s, %u threads, %u cpus)...\n",
+		OPT_TICKETLOCK ? "ticket" : "test-and-set",
+		nthreads, num_cpus);
+
+	slbstop = false;
+	slbshared = 0;
+	bench_fork("slb", nthreads, slbthread, NULL);
+	clocksleep(SLB_SECONDS);
+	slbstop = true;
+	bench_wait();
+
+	total = 0;
+	min = max = slbcounts[0];
+	for (i=0; i<nthreads; i++) {
+		total += slbcounts[i];
+		if (slbcounts[i] < min) {
+			min = slbcounts[i];
+		}
+		if (slbcounts[i] > max) {
+			max = slbcounts[i];
+		}
+	}
+	if (total != slbshared) {
+		panic("slb: lock count is %lu, expected %lu\n",
+		      slbshared, total);
+	}
+
+	kprintf("slb: %lu acquires/sec; per thread min %lu, max %lu",
+		total / SLB_SECONDS, min, max);
+	if (max > 0) {
+		kprintf(" (spread %lu%%)", (max - min) * 100 / max);
+	}
+	kprintf("\n");
+	kprintf("Spinlock benchmark done.\n");
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timeout test.
+ *
+ * First checks that timeouts, P_timed, and cv_timedwait behave:
+ * untimeout cancels, timed waits time out when nothing happens and
+ * don't when something does. Then has several threads sleep for
+ * random numbers of ticks and prints how late each wakeup was, as a
+ * histogram. Since timeouts fire on a tick boundary and never early,
+ * almost all wakeups should be between 0 and one tick late.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define TMO_THREADS	4
+#define TMO_SAMPLES	50	/* per thread */
+#define TMO_MAXTICKS	10
+#define TMO_NBUCKETS	12	/* 1 ms each; the last is "more" */
+
+#define NSECS_PER_TICK	(1000000000 / HZ)
+
+static struct semaphore *tmosem;
+static struct spinlock tmo_lock = SPINLOCK_INITIALIZER;
+static unsigned tmo_hist[TMO_NBUCKETS];
+static unsigned tmo_early;
+static uint64_t tmo_total, tmo_max;
+
+static volatile unsigned tmo_fired;
+
+static
+void
+tmo_count(void *arg)
+{
+	(void)arg;
+	tmo_fired++;
+}
+
+static
+void
+tmo_v(void *sem, unsigned long junk)
+{
+	(void)junk;
+
+	ticksleep(2);
+	V(sem);
+}
+
+/*
+ * Check the basic behavior.
+ */
+static
+void
+tmo_functional(void)
+{
+	struct timeout to;
+	struct semaphore *sem;
+	struct lock *lock;
+	struct cv *cv;
+	int result;
+
+	/* untimeout cancels a pending timeout */
+	timeout_init(&to, tmo_count, NULL);
+	tmo_fired = 0;
+	timeout(&to, 5);
+	if (!untimeout(&to)) {
+		panic("tmo: untimeout didn't find a pending timeout\n");
+	}
+	ticksleep(10);
+	if (tmo_fired != 0) {
+		panic("tmo: cancelled timeout fired\n");
+	}
+
+	/* and one that isn't cancelled fires once */
+	timeout(&to, 1);
+	ticksleep(3);
+	if (tmo_fired != 1 || untimeout(&to)) {
+		panic("tmo: timeout fired %u times\n", tmo_fired);
+	}
+
+	sem = sem_create("tmosem", 1);
+	if (sem == NULL) {
+		panic("tmo: sem_create failed\n");
+	}
+	if (P_timed(sem, 5) != 0) {
+		panic("tmo: P_timed failed with the count at 1\n");
+	}
+	if (P_timed(sem, 5) != ETIMEDOUT) {
+		panic("tmo: P_timed didn't time out\n");
+	}
+	result = thread_fork("tmo-v", NULL, tmo_v, sem, 0);
+	if (result) {
+		panic("tmo: thread_fork failed: %s\n", strerror(result));
+	}
+	if (P_timed(sem, 10 * HZ) != 0) {
+		panic("tmo: P_timed timed out despite a V\n");
+	}
+	sem_destroy(sem);
+
+	lock = lock_create("tmolock");
+	cv = cv_create("tmocv");
+	if (lock == NULL || cv == NULL) {
+		panic("tmo: lock_create or cv_create failed\n");
+	}
+	lock_acquire(lock);
+	if (cv_timedwait(cv, lock, 5) != ETIMEDOUT) {
+		panic("tmo: cv_timedwait didn't time out\n");
+	}
+	KASSERT(lock_do_i_hold(lock));
+	lock_release(lock);
+	cv_destroy(cv);
+	lock_destroy(lock);
+
+	kprintf("tmo: timeouts, P_timed, and cv_timedwait ok\n");
+}
+
+/*
+ * Sleep for random tick counts and record how late we woke up.
+ */
+static
+void
+tmo_thread(void *junk, unsigned long num)
+{
+	struct timespec before, after, diff;
+	uint64_t elapsed, want, late;
+	unsigned i, ticks, bucket;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<TMO_SAMPLES; i++) {
+		ticks = random() % TMO_MAXTICKS + 1;
+
+		gettime(&before);
+		ticksleep(ticks);
+		gettime(&after);
+
+		timespec_sub(&after, &before, &diff);
+		elapsed = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+		want = (uint64_t)ticks * NSECS_PER_TICK;
+
+		spinlock_acquire(&tmo_lock);
+		if (elapsed < want) {
+			tmo_early++;
+		}
+		else {
+			late = elapsed - want;
+			bucket = late / 1000000;
+			if (bucket >= TMO_NBUCKETS) {
+				bucket = TMO_NBUCKETS - 1;
+			}
+			tmo_hist[bucket]++;
+			tmo_total += late;
+			if (late > tmo_max) {
+				tmo_max = late;
+			}
+		}
+		spinlock_release(&tmo_lock);
+	}
+
+	V(tmosem);
+}
+
+int
+timeouttest(int nargs, char **args)
+{
+	unsigned i, n;
+	char name[16];
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timeout test...\n");
+	tmo_functional();
+
+	tmosem = sem_create("tmosem", 0);
+	if (tmosem == NULL) {
+		panic("tmo: sem_create failed\n");
+	}
+	for (i=0; i<TMO_NBUCKETS; i++) {
+		tmo_hist[i] = 0;
+	}
+	tmo_early = 0;
+	tmo_total = tmo_max = 0;
+
+	for (i=0; i<TMO_THREADS; i++) {
+		snprintf(name, sizeof(name), "tmo-%u", i);
+		result = thread_fork(name, NULL, tmo_thread, NULL, i);
+		if (result) {
+			panic("tmo: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<TMO_THREADS; i++) {
+		P(tmosem);
+	}
+	sem_destroy(tmosem);
+	tmosem = NULL;
+
+	n = TMO_THREADS * TMO_SAMPLES - tmo_early;
+	kprintf("tmo: wakeup lateness, %u sleeps of 1-%u ticks "
+		"(1 tick = %u ms):\n",
+		TMO_THREADS * TMO_SAMPLES, TMO_MAXTICKS, 1000 / HZ);
+	for (i=0; i<TMO_NBUCKETS - 1; i++) {
+		kprintf("tmo:   %2u-%2u ms: %u\n", i, i + 1, tmo_hist[i]);
+	}
+	kprintf("tmo:   %2u+    ms: %u\n", i, tmo_hist[i]);
+	if (n > 0) {
+		kprintf("tmo: mean %llu us, max %llu us\n",
+			tmo_total / n / 1000, tmo_max / 1000);
+	}
+	if (tmo_early > 0) {
+		panic("tmo: %u sleeps woke up early\n", tmo_early);
+	}
+	kprintf("Timeout test done.\n");
+
+	return 0;
+}
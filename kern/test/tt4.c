@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Thread test 4: throughput scaling.
+ *
+ * Runs a fixed amount of CPU-bound work split across 1, 2, 4, ... 32
+ * threads and reports how long each split takes. With working load
+ * balancing the speedup should track the number of CPUs (up to the
+ * number of threads) and then level off; run it under sys161 with
+ * different numbers of CPUs to see the scaling curve.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <test.h>
+
+#define TT4_MAXTHREADS	32
+#define TT4_WORK	(1U << 22)	/* total loop iterations per run */
+
+static unsigned long tt4iters;		/* iterations per thread */
+
+static
+void
+tt4thread(void *junk, unsigned long num)
+{
+	volatile unsigned long i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<tt4iters; i++);
+
+	bench_threaddone();
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	uint64_t base, ms;
+	unsigned nthreads;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting thread test 4 (%u cpus)...\n", num_cpus);
+	base = 0;
+	for (nthreads = 1; nthreads <= TT4_MAXTHREADS; nthreads *= 2) {
+		tt4iters = TT4_WORK / nthreads;
+		bench_fork("tt4", nthreads, tt4thread, NULL);
+		ms = bench_wait() / 1000000;
+		if (ms == 0) {
+			ms = 1;
+		}
+		if (base == 0) {
+			base = ms;
+		}
+		kprintf("tt4: %2u threads: %llu ms, speedup %llu.%02llu\n",
+			nthreads, ms, base / ms, (base * 100 / ms) % 100);
+	}
+	cpu_printschedstats();
+	kprintf("Thread test 4 done.\n");
+
+	return 0;
+}
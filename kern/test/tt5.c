@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Thread test 5: thread_fork/thread_exit round-trip latency.
+ *
+ * Forks a thread that exits immediately, waits for it, and repeats,
+ * first with the per-cpu thread cache warm (the usual case) and then
+ * emptying the cache before each fork so every thread and stack
+ * comes from kmalloc, as before there was a cache.
+ */
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <test.h>
+
+#define TT5_ROUNDS	1000
+
+static
+void
+tt5thread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	bench_threaddone();
+}
+
+/*
+ * Do TT5_ROUNDS fork/exit round trips and return the average time
+ * for one, in nanoseconds.
+ */
+static
+uint64_t
+tt5run(bool cold)
+{
+	uint64_t total;
+	unsigned i;
+
+	total = 0;
+	for (i=0; i<TT5_ROUNDS; i++) {
+		if (cold) {
+			thread_reclaim();
+		}
+		bench_fork("tt5", 1, tt5thread, NULL);
+		total += bench_wait();
+	}
+	return total / TT5_ROUNDS;
+}
+
+int
+threadtest5(int nargs, char **args)
+{
+	uint64_t warm, cold;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting thread test 5...\n");
+	warm = tt5run(false);
+	cold = tt5run(true);
+	kprintf("tt5: fork+exit with thread cache: %llu ns\n", warm);
+	kprintf("tt5: fork+exit without thread cache: %llu ns\n", cold);
+	kprintf("Thread test 5 done.\n");
+
+	return 0;
+}
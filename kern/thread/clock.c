@@ -28,9 +28,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
 #include <wchan.h>
+#include <synch.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
@@ -38,9 +40,8 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at specific points in the future are scheduled with
+ * timeout(), which has a resolution of one hardclock; see below.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -55,9 +56,55 @@
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ *
+ * Actually, the timer only runs while someone is waiting: lbolt_arm
+ * (supplied by the timer driver) starts a one-second countdown, and
+ * lbolt_armed is true while one is in progress.
  */
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
+static void (*lbolt_arm)(void *data);
+static void *lbolt_armdata;
+static bool lbolt_armed;
+
+/*
+ * Timeouts.
+ *
+ * Each cpu has a hierarchical timing wheel: TIMEOUT_LEVELS arrays of
+ * TIMEOUT_WHEELSIZE slots. Level 0 has one slot per tick; each slot
+ * in level n covers TIMEOUT_WHEELSIZE times as many ticks as one in
+ * level n-1. A timeout goes in the lowest level whose range covers
+ * its expiry time. Every TIMEOUT_WHEELSIZE ticks, when level 0 wraps
+ * around, the next slot of level 1 is emptied and its timeouts are
+ * placed again, now in level 0; when that wraps level 2 is cascaded
+ * into level 1, and so on. Adding and removing timeouts is O(1), and
+ * each hardclock only looks at the one level-0 slot that's due.
+ *
+ * With four levels of 64 slots the wheel covers 2^24 ticks (about
+ * 46 hours at HZ=100). Longer timeouts are parked in the top-level
+ * slot that comes around last and placed again each time it does,
+ * until their expiry time is in range.
+ *
+ * tw_now is the next tick to be processed; it counts only this cpu's
+ * ticks, which don't happen while it's idle with nothing pending.
+ */
+#define TIMEOUT_WHEELBITS	6
+#define TIMEOUT_WHEELSIZE	(1U << TIMEOUT_WHEELBITS)
+#define TIMEOUT_WHEELMASK	(TIMEOUT_WHEELSIZE - 1)
+#define TIMEOUT_LEVELS		4
+
+struct timeout_wheel {
+	struct spinlock tw_lock;
+	uint64_t tw_now;		/* Next tick to process */
+	volatile unsigned tw_count;	/* Number of timeouts pending */
+	struct timeout *tw_slots[TIMEOUT_LEVELS][TIMEOUT_WHEELSIZE];
+};
+
+/*
+ * ticksleep sleeps on this semaphore, which is never V'd, until
+ * P_timed gives up.
+ */
+static struct semaphore *ticksleep_sem;
 
 /*
  * Setup.
@@ -70,6 +117,278 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	ticksleep_sem = sem_create("ticksleep", 0);
+	if (ticksleep_sem == NULL) {
+		panic("Couldn't create ticksleep semaphore\n");
+	}
+}
+
+/*
+ * Set up a cpu's timing wheel.
+ */
+void
+timeout_cpu_init(struct cpu *c)
+{
+	struct timeout_wheel *tw;
+	unsigned i, j;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		panic("timeout_cpu_init: Out of memory\n");
+	}
+	spinlock_init(&tw->tw_lock);
+	tw->tw_now = 0;
+	tw->tw_count = 0;
+	for (i=0; i<TIMEOUT_LEVELS; i++) {
+		for (j=0; j<TIMEOUT_WHEELSIZE; j++) {
+			tw->tw_slots[i][j] = NULL;
+		}
+	}
+	c->c_timeouts = tw;
+}
+
+/*
+ * Check if the current cpu has timeouts pending. Unlocked; only this
+ * cpu adds to its wheel, so it can't go from 0 to nonzero under us.
+ */
+bool
+timeout_cpu_pending(void)
+{
+	return curcpu->c_timeouts->tw_count > 0;
+}
+
+/*
+ * Put a timeout in the right slot for its expiry time. The wheel
+ * must be locked.
+ */
+static
+void
+timeout_place(struct timeout_wheel *tw, struct timeout *to)
+{
+	struct timeout **slot;
+	uint64_t delta, top;
+	unsigned level, index;
+
+	if (to->to_expire < tw->tw_now) {
+		to->to_expire = tw->tw_now;
+	}
+	delta = to->to_expire - tw->tw_now;
+	for (level = 0; level < TIMEOUT_LEVELS - 1; level++) {
+		if (delta < (uint64_t)1 << ((level + 1) * TIMEOUT_WHEELBITS)) {
+			break;
+		}
+	}
+
+	/*
+	 * If the top level can't hold it without wrapping around onto
+	 * the slot it's on now, park it in the top slot that cascades
+	 * last. It'll be placed again from there, and its expiry time
+	 * is left alone so eventually it lands where it belongs.
+	 */
+	top = (TIMEOUT_LEVELS - 1) * TIMEOUT_WHEELBITS;
+	if (level == TIMEOUT_LEVELS - 1 &&
+	    (to->to_expire >> top) - (tw->tw_now >> top) >= TIMEOUT_WHEELSIZE) {
+		index = ((tw->tw_now >> top) - 1) & TIMEOUT_WHEELMASK;
+	}
+	else {
+		index = (to->to_expire >> (level * TIMEOUT_WHEELBITS))
+			& TIMEOUT_WHEELMASK;
+	}
+
+	slot = &tw->tw_slots[level][index];
+	to->to_next = *slot;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = &to->to_next;
+	}
+	to->to_prevp = slot;
+	*slot = to;
+}
+
+/*
+ * Take a timeout off whatever slot it's in. The wheel must be locked.
+ */
+static
+void
+timeout_unlink(struct timeout *to)
+{
+	*to->to_prevp = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = to->to_prevp;
+	}
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+}
+
+/*
+ * Empty the current slot of level LEVEL and place its timeouts again,
+ * which moves them down a level. Returns the slot index, so the
+ * caller knows whether this level wrapped too.
+ */
+static
+unsigned
+timeout_cascade(struct timeout_wheel *tw, unsigned level)
+{
+	struct timeout *to;
+	unsigned index;
+
+	index = (tw->tw_now >> (level * TIMEOUT_WHEELBITS))
+		& TIMEOUT_WHEELMASK;
+	while ((to = tw->tw_slots[level][index]) != NULL) {
+		timeout_unlink(to);
+		timeout_place(tw, to);
+	}
+	return index;
+}
+
+/*
+ * Process one tick of the current cpu's wheel: cascade if level 0
+ * wrapped, then call everything in the slot that's now due.
+ */
+static
+void
+timeout_tick(void)
+{
+	struct timeout_wheel *tw = curcpu->c_timeouts;
+	struct timeout *to;
+	unsigned index, level;
+
+	spinlock_acquire(&tw->tw_lock);
+
+	index = tw->tw_now & TIMEOUT_WHEELMASK;
+	if (index == 0) {
+		for (level = 1; level < TIMEOUT_LEVELS; level++) {
+			if (timeout_cascade(tw, level) != 0) {
+				break;
+			}
+		}
+	}
+
+	while ((to = tw->tw_slots[0][index]) != NULL) {
+		timeout_unlink(to);
+		tw->tw_count--;
+		to->to_state = TO_RUNNING;
+
+		spinlock_release(&tw->tw_lock);
+		to->to_func(to->to_arg);
+		spinlock_acquire(&tw->tw_lock);
+
+		/* It may have rescheduled itself. */
+		if (to->to_state == TO_RUNNING) {
+			to->to_state = TO_IDLE;
+		}
+	}
+
+	tw->tw_now++;
+	spinlock_release(&tw->tw_lock);
+}
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_expire = 0;
+	to->to_wheel = NULL;
+	to->to_state = TO_IDLE;
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+}
+
+void
+timeout(struct timeout *to, unsigned ticks)
+{
+	struct timeout_wheel *tw;
+
+	untimeout(to);
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	tw = curcpu->c_timeouts;
+	spinlock_acquire(&tw->tw_lock);
+	to->to_expire = tw->tw_now + ticks;
+	to->to_wheel = tw;
+	to->to_state = TO_PENDING;
+	timeout_place(tw, to);
+	tw->tw_count++;
+	spinlock_release(&tw->tw_lock);
+}
+
+bool
+untimeout(struct timeout *to)
+{
+	struct timeout_wheel *tw;
+
+	while (1) {
+		tw = to->to_wheel;
+		if (tw == NULL) {
+			/* Never scheduled. */
+			return false;
+		}
+		spinlock_acquire(&tw->tw_lock);
+		if (to->to_wheel != tw) {
+			/* Rescheduled onto another wheel meanwhile. */
+			spinlock_release(&tw->tw_lock);
+			continue;
+		}
+		switch (to->to_state) {
+		    case TO_PENDING:
+			timeout_unlink(to);
+			tw->tw_count--;
+			to->to_state = TO_IDLE;
+			spinlock_release(&tw->tw_lock);
+			return true;
+		    case TO_IDLE:
+			spinlock_release(&tw->tw_lock);
+			return false;
+		}
+
+		/*
+		 * Running. If it's running on this cpu, we're being
+		 * called from the function itself; otherwise wait
+		 * for it to finish.
+		 */
+		KASSERT(to->to_state == TO_RUNNING);
+		if (tw == curcpu->c_timeouts) {
+			spinlock_release(&tw->tw_lock);
+			return false;
+		}
+		spinlock_release(&tw->tw_lock);
+	}
+}
+
+/*
+ * Convert a time interval to ticks, rounding up, and capped at the
+ * largest unsigned.
+ */
+unsigned
+timespec_to_ticks(const struct timespec *ts)
+{
+	const uint64_t nsecs_per_tick = 1000000000ULL / HZ;
+	uint64_t ticks;
+
+	if (ts->tv_sec < 0 || (ts->tv_sec == 0 && ts->tv_nsec <= 0)) {
+		return 0;
+	}
+	ticks = (uint64_t)ts->tv_sec * HZ;
+	ticks += (ts->tv_nsec + nsecs_per_tick - 1) / nsecs_per_tick;
+	if (ticks > (unsigned)-1) {
+		return (unsigned)-1;
+	}
+	return ticks;
+}
+
+/*
+ * Suspend execution for some number of ticks.
+ */
+void
+ticksleep(unsigned ticks)
+{
+	int result;
+
+	result = P_timed(ticksleep_sem, ticks);
+	KASSERT(result == ETIMEDOUT);
 }
 
 /*
@@ -81,10 +400,43 @@ timerclock(void)
 {
 	/* Just broadcast on lbolt */
 	spinlock_acquire(&lbolt_lock);
+	lbolt_armed = false;
 	wchan_wakeall(lbolt, &lbolt_lock);
 	spinlock_release(&lbolt_lock);
 }
 
+/*
+ * Start the timer for the next lbolt, if it isn't running already.
+ */
+static
+void
+lbolt_start(void)
+{
+	KASSERT(spinlock_do_i_hold(&lbolt_lock));
+
+	if (!lbolt_armed && lbolt_arm != NULL) {
+		lbolt_arm(lbolt_armdata);
+		lbolt_armed = true;
+	}
+}
+
+/*
+ * Called by the timer driver at attach time.
+ */
+void
+timerclock_attach(void (*arm)(void *data), void *data)
+{
+	spinlock_acquire(&lbolt_lock);
+	KASSERT(lbolt_arm == NULL);
+	lbolt_arm = arm;
+	lbolt_armdata = data;
+	/* Someone may have started waiting before the timer appeared. */
+	if (!wchan_isempty(lbolt, &lbolt_lock)) {
+		lbolt_start();
+	}
+	spinlock_release(&lbolt_lock);
+}
+
 /*
  * This is called HZ times a second (on each processor) by the timer
  * code.
@@ -97,13 +449,14 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	timeout_tick();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_tick();
 }
 
 /*
@@ -114,6 +467,7 @@ clocksleep(int num_secs)
 {
 	spinlock_acquire(&lbolt_lock);
 	while (num_secs > 0) {
+		lbolt_start();
 		wchan_sleep(lbolt, &lbolt_lock);
 		num_secs--;
 	}
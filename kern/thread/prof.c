@@ -0,0 +1,550 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Statistical kernel profiler.
+ *
+ * Each CPU has a histogram with one saturating 16-bit counter per
+ * PROF_GRANULE bytes of kernel text. The timer interrupt bumps the
+ * counter for the interrupted PC on the CPU it lands on, so the
+ * sampling path touches only that CPU's own memory and needs no
+ * locking. Samples taken in user mode or outside the kernel text
+ * are only counted.
+ *
+ * Symbolization is deferred until dump time: we read the section
+ * headers, symbol table, and string table out of the kernel image
+ * with the ordinary VFS calls, so nothing has to be linked into the
+ * kernel for it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stdarg.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <clock.h>
+#include <membar.h>
+#include <uio.h>
+#include <elf.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <prof.h>
+
+/* Histogram granularity: 8 bytes, or two instructions. */
+#define PROF_SHIFT    3
+#define PROF_GRANULE  (1 << PROF_SHIFT)
+#define PROF_MAXCOUNT 0xffff
+
+/* Symbols read from the image per I/O. */
+#define PROF_SYMCHUNK 64
+
+/* Linker-provided bounds of the kernel text (see ldscript). */
+extern char _stext[], _etext[];
+
+struct profcpu {
+	uint16_t *pr_hist;		/* per-granule counts */
+	unsigned pr_kernel;		/* samples in kernel text */
+	unsigned pr_user;		/* samples in user mode */
+	unsigned pr_other;		/* kernel samples outside text */
+};
+
+static struct profcpu *prof_cpus;
+static unsigned prof_ncpus;
+static unsigned prof_nbuckets;
+static volatile bool prof_enabled;
+
+/*
+ * Called from the timer interrupt, with interrupts off.
+ */
+void
+prof_sample(vaddr_t pc, bool fromuser)
+{
+	struct profcpu *pr;
+	vaddr_t base;
+	unsigned ix;
+
+	if (!prof_enabled) {
+		return;
+	}
+	if (curcpu->c_number >= prof_ncpus) {
+		return;
+	}
+	pr = &prof_cpus[curcpu->c_number];
+
+	if (fromuser) {
+		pr->pr_user++;
+		return;
+	}
+
+	base = (vaddr_t)_stext;
+	if (pc < base || pc >= (vaddr_t)_etext) {
+		pr->pr_other++;
+		return;
+	}
+	ix = (pc - base) >> PROF_SHIFT;
+	if (pr->pr_hist[ix] < PROF_MAXCOUNT) {
+		pr->pr_hist[ix]++;
+	}
+	pr->pr_kernel++;
+}
+
+/*
+ * Start (or restart) sampling. The histograms are allocated the
+ * first time through and reused after that; restarting clears them.
+ */
+int
+prof_start(void)
+{
+	unsigned i;
+
+	if (prof_enabled) {
+		return EBUSY;
+	}
+
+	if (prof_cpus == NULL) {
+		prof_nbuckets = ((vaddr_t)_etext - (vaddr_t)_stext
+				 + PROF_GRANULE - 1) >> PROF_SHIFT;
+		prof_cpus = kmalloc(num_cpus * sizeof(*prof_cpus));
+		if (prof_cpus == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<num_cpus; i++) {
+			prof_cpus[i].pr_hist =
+				kmalloc(prof_nbuckets * sizeof(uint16_t));
+			if (prof_cpus[i].pr_hist == NULL) {
+				while (i > 0) {
+					i--;
+					kfree(prof_cpus[i].pr_hist);
+				}
+				kfree(prof_cpus);
+				prof_cpus = NULL;
+				return ENOMEM;
+			}
+		}
+		prof_ncpus = num_cpus;
+	}
+
+	for (i=0; i<prof_ncpus; i++) {
+		bzero(prof_cpus[i].pr_hist, prof_nbuckets * sizeof(uint16_t));
+		prof_cpus[i].pr_kernel = 0;
+		prof_cpus[i].pr_user = 0;
+		prof_cpus[i].pr_other = 0;
+	}
+
+	/* Make sure the cleared buffers are visible before sampling. */
+	membar_store_store();
+	prof_enabled = true;
+	return 0;
+}
+
+void
+prof_stop(void)
+{
+	prof_enabled = false;
+	membar_any_any();
+}
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Output state for the report: a line buffer flushed with VOP_WRITE.
+ */
+struct profout {
+	struct vnode *po_vn;
+	off_t po_pos;
+	int po_err;
+	char po_buf[128];
+};
+
+static
+void
+prof_printf(struct profout *po, const char *fmt, ...)
+{
+	struct iovec iov;
+	struct uio ku;
+	va_list ap;
+	size_t len;
+	int result;
+
+	if (po->po_err) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(po->po_buf, sizeof(po->po_buf), fmt, ap);
+	va_end(ap);
+	len = strlen(po->po_buf);
+
+	uio_kinit(&iov, &ku, po->po_buf, len, po->po_pos, UIO_WRITE);
+	result = VOP_WRITE(po->po_vn, &ku);
+	if (result) {
+		po->po_err = result;
+		return;
+	}
+	if (ku.uio_resid != 0) {
+		po->po_err = ENOSPC;
+		return;
+	}
+	po->po_pos = ku.uio_offset;
+}
+
+/*
+ * Read exactly LEN bytes at offset POS from the kernel image.
+ */
+static
+int
+prof_readat(struct vnode *vn, off_t pos, void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, pos, UIO_READ);
+	result = VOP_READ(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Load the symbol table section header and the string table that
+ * goes with it. On success the string table is returned in *STRTAB_RET
+ * (kmalloc'd; caller frees).
+ */
+static
+int
+prof_loadsyms(struct vnode *vn, Elf_Shdr *symsh,
+	      char **strtab_ret, size_t *strsize_ret)
+{
+	Elf_Ehdr eh;
+	Elf_Shdr sh;
+	char *strtab;
+	unsigned i;
+	int result;
+
+	result = prof_readat(vn, 0, &eh, sizeof(eh));
+	if (result) {
+		return result;
+	}
+	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
+	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
+	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
+	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
+	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh.e_shentsize != sizeof(Elf_Shdr)) {
+		return ENOEXEC;
+	}
+
+	for (i=0; i<eh.e_shnum; i++) {
+		result = prof_readat(vn, eh.e_shoff + i * sizeof(Elf_Shdr),
+				     symsh, sizeof(*symsh));
+		if (result) {
+			return result;
+		}
+		if (symsh->sh_type == SHT_SYMTAB) {
+			break;
+		}
+	}
+	if (i == eh.e_shnum || symsh->sh_link >= eh.e_shnum ||
+	    symsh->sh_entsize != sizeof(Elf_Sym)) {
+		/* stripped */
+		return ENOEXEC;
+	}
+
+	result = prof_readat(vn, eh.e_shoff + symsh->sh_link * sizeof(sh),
+			     &sh, sizeof(sh));
+	if (result) {
+		return result;
+	}
+	if (sh.sh_type != SHT_STRTAB || sh.sh_size == 0) {
+		return ENOEXEC;
+	}
+
+	strtab = kmalloc(sh.sh_size + 1);
+	if (strtab == NULL) {
+		return ENOMEM;
+	}
+	result = prof_readat(vn, sh.sh_offset, strtab, sh.sh_size);
+	if (result) {
+		kfree(strtab);
+		return result;
+	}
+	strtab[sh.sh_size] = 0;
+
+	*strtab_ret = strtab;
+	*strsize_ret = sh.sh_size;
+	return 0;
+}
+
+/*
+ * One line of the report.
+ */
+struct profent {
+	unsigned pe_count;
+	uint32_t pe_name;		/* offset in string table */
+};
+
+/*
+ * Count the samples attributed to the function [LO, HI). A granule
+ * belongs to the function its first byte is in, so adjacent
+ * functions never count the same granule twice.
+ */
+static
+unsigned
+prof_countrange(vaddr_t lo, vaddr_t hi)
+{
+	vaddr_t base = (vaddr_t)_stext;
+	unsigned b, bstart, bend, i, total;
+
+	if (lo < base) {
+		lo = base;
+	}
+	if (hi > (vaddr_t)_etext) {
+		hi = (vaddr_t)_etext;
+	}
+	if (lo >= hi) {
+		return 0;
+	}
+	bstart = (lo - base + PROF_GRANULE - 1) >> PROF_SHIFT;
+	bend = (hi - base + PROF_GRANULE - 1) >> PROF_SHIFT;
+
+	total = 0;
+	for (b = bstart; b < bend; b++) {
+		for (i=0; i<prof_ncpus; i++) {
+			total += prof_cpus[i].pr_hist[b];
+		}
+	}
+	return total;
+}
+
+/*
+ * Walk the symbol table and fill in ENTS with every function that
+ * got at least one sample. Returns the number of entries in *NUM_RET.
+ */
+static
+int
+prof_attribute(struct vnode *vn, const Elf_Shdr *symsh, size_t strsize,
+	       struct profent *ents, unsigned maxents, unsigned *num_ret)
+{
+	Elf_Sym syms[PROF_SYMCHUNK];
+	unsigned nsyms, done, n, i, num;
+	unsigned count;
+	int result;
+
+	nsyms = symsh->sh_size / sizeof(Elf_Sym);
+	num = 0;
+	for (done = 0; done < nsyms; done += n) {
+		n = nsyms - done;
+		if (n > PROF_SYMCHUNK) {
+			n = PROF_SYMCHUNK;
+		}
+		result = prof_readat(vn, symsh->sh_offset +
+				     done * sizeof(Elf_Sym),
+				     syms, n * sizeof(Elf_Sym));
+		if (result) {
+			return result;
+		}
+		for (i=0; i<n; i++) {
+			if (ELF32_ST_TYPE(syms[i].st_info) != STT_FUNC ||
+			    syms[i].st_size == 0 ||
+			    syms[i].st_name >= strsize) {
+				continue;
+			}
+			count = prof_countrange(syms[i].st_value,
+					syms[i].st_value + syms[i].st_size);
+			if (count == 0 || num >= maxents) {
+				continue;
+			}
+			ents[num].pe_count = count;
+			ents[num].pe_name = syms[i].st_name;
+			num++;
+		}
+	}
+	*num_ret = num;
+	return 0;
+}
+
+/*
+ * Sort by descending count. There are at most a few hundred entries
+ * with samples, so insertion sort is fine.
+ */
+static
+void
+prof_sort(struct profent *ents, unsigned num)
+{
+	struct profent tmp;
+	unsigned i, j;
+
+	for (i=1; i<num; i++) {
+		tmp = ents[i];
+		for (j=i; j>0 && ents[j-1].pe_count < tmp.pe_count; j--) {
+			ents[j] = ents[j-1];
+		}
+		ents[j] = tmp;
+	}
+}
+
+/*
+ * Print a count as a percentage of TOTAL with one decimal place.
+ */
+static
+void
+prof_printent(struct profout *po, unsigned count, unsigned total,
+	      const char *name)
+{
+	unsigned permille;
+
+	permille = total ? (unsigned)((uint64_t)count * 1000 / total) : 0;
+	prof_printf(po, "%10u %3u.%u%%  %s\n",
+		    count, permille / 10, permille % 10, name);
+}
+
+static
+void
+prof_report(struct profout *po, struct profent *ents, unsigned num,
+	    const char *strtab)
+{
+	unsigned kernel, user, other, attributed;
+	unsigned i;
+
+	kernel = user = other = 0;
+	for (i=0; i<prof_ncpus; i++) {
+		kernel += prof_cpus[i].pr_kernel;
+		user += prof_cpus[i].pr_user;
+		other += prof_cpus[i].pr_other;
+	}
+
+	prof_printf(po, "Kernel profile: %u samples at %u Hz per CPU\n",
+		    kernel + user + other, HZ);
+	prof_printf(po, "    %u in kernel text, %u in user mode, "
+		    "%u elsewhere\n", kernel, user, other);
+	for (i=0; i<prof_ncpus; i++) {
+		prof_printf(po, "    cpu%u: %u kernel, %u user, %u other\n",
+			    i, prof_cpus[i].pr_kernel, prof_cpus[i].pr_user,
+			    prof_cpus[i].pr_other);
+	}
+	prof_printf(po, "\n%10s %6s  %s\n", "samples", "%", "function");
+
+	attributed = 0;
+	for (i=0; i<num; i++) {
+		prof_printent(po, ents[i].pe_count, kernel,
+			      strtab + ents[i].pe_name);
+		attributed += ents[i].pe_count;
+	}
+	if (attributed < kernel) {
+		prof_printent(po, kernel - attributed, kernel,
+			      "(unattributed)");
+	}
+}
+
+/*
+ * Write a symbolized report of the current histograms to OUTFILE.
+ */
+int
+prof_dump(const char *outfile, const char *kernfile)
+{
+	struct vnode *kvn;
+	struct profout po;
+	Elf_Shdr symsh;
+	char *strtab, *path;
+	size_t strsize;
+	struct profent *ents;
+	unsigned maxents, num;
+	int result;
+
+	if (prof_cpus == NULL) {
+		/* never started */
+		return ENOENT;
+	}
+
+	/* vfs_open destroys the string it's passed */
+	path = kstrdup(kernfile);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(path, O_RDONLY, 0, &kvn);
+	kfree(path);
+	if (result) {
+		return result;
+	}
+
+	result = prof_loadsyms(kvn, &symsh, &strtab, &strsize);
+	if (result) {
+		vfs_close(kvn);
+		return result;
+	}
+
+	maxents = symsh.sh_size / sizeof(Elf_Sym);
+	ents = kmalloc(maxents * sizeof(*ents));
+	if (ents == NULL) {
+		kfree(strtab);
+		vfs_close(kvn);
+		return ENOMEM;
+	}
+
+	result = prof_attribute(kvn, &symsh, strsize, ents, maxents, &num);
+	vfs_close(kvn);
+	if (result) {
+		kfree(ents);
+		kfree(strtab);
+		return result;
+	}
+	prof_sort(ents, num);
+
+	path = kstrdup(outfile);
+	if (path == NULL) {
+		kfree(ents);
+		kfree(strtab);
+		return ENOMEM;
+	}
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &po.po_vn);
+	kfree(path);
+	if (result) {
+		kfree(ents);
+		kfree(strtab);
+		return result;
+	}
+	po.po_pos = 0;
+	po.po_err = 0;
+
+	prof_report(&po, ents, num, strtab);
+	result = po.po_err;
+
+	vfs_close(po.po_vn);
+	kfree(ents);
+	kfree(strtab);
+	return result;
+}
@@ -51,6 +51,9 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+#if OPT_TICKETLOCK
+	spinlock_data_set(&splk->splk_serving, 0);
+#endif
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
@@ -62,37 +65,53 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
+#if OPT_TICKETLOCK
+	KASSERT(spinlock_data_get(&splk->splk_lock) ==
+		spinlock_data_get(&splk->splk_serving));
+#else
 	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+#endif
 }
 
+#if OPT_TICKETLOCK
+
 /*
- * Get the lock.
- *
- * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * Delay loop iterations per waiter ahead of us in line. Waiting about
+ * as long as it takes the CPUs ahead to get through keeps us from
+ * rereading splk_serving every time one of them writes it.
+ */
+#define SPINLOCK_BACKOFF 16
+
+/*
+ * Wait for the lock, ticket style: take a ticket, then wait until
+ * it's being served.
  */
+static
 void
-spinlock_acquire(struct spinlock *splk)
+spinlock_wait(struct spinlock *splk)
 {
-	struct cpu *mycpu;
-
-	splraise(IPL_NONE, IPL_HIGH);
+	spinlock_data_t ticket, serving;
+	volatile unsigned i;
 
-	/* this must work before curcpu initialization */
-	if (CURCPU_EXISTS()) {
-		mycpu = curcpu->c_self;
-		if (splk->splk_holder == mycpu) {
-			panic("Deadlock on spinlock %p\n", splk);
+	ticket = spinlock_data_fetchinc(&splk->splk_lock);
+	while (1) {
+		serving = spinlock_data_get(&splk->splk_serving);
+		if (serving == ticket) {
+			break;
 		}
-		mycpu->c_spinlocks++;
-
-		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
-	}
-	else {
-		mycpu = NULL;
+		for (i = (ticket - serving) * SPINLOCK_BACKOFF; i > 0; i--);
 	}
+}
 
+#else /* !OPT_TICKETLOCK */
+
+/*
+ * Wait for the lock with test-and-set.
+ */
+static
+void
+spinlock_wait(struct spinlock *splk)
+{
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -112,6 +131,40 @@ spinlock_acquire(struct spinlock *splk)
 		}
 		break;
 	}
+}
+
+#endif /* OPT_TICKETLOCK */
+
+/*
+ * Get the lock.
+ *
+ * First disable interrupts (otherwise, if we get a timer interrupt we
+ * might come back to this lock and deadlock), then use a machine-level
+ * atomic operation to wait for the lock to be free. With ticket locks
+ * this also fixes our place in line.
+ */
+void
+spinlock_acquire(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (splk->splk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", splk);
+		}
+		mycpu->c_spinlocks++;
+
+		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	spinlock_wait(splk);
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
@@ -137,7 +190,13 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
+#if OPT_TICKETLOCK
+	/* Only the holder writes splk_serving, so no atomic op is needed */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
+#else
 	spinlock_data_set(&splk->splk_lock, 0);
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -33,11 +33,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
+#include <clock.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -134,6 +138,88 @@ V(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Timed sleeps.
+
+/*
+ * State shared between a thread doing a timed sleep on a wchan and
+ * the timeout that ends the sleep. It lives on the sleeper's stack;
+ * the sleeper calls untimeout before returning, which waits for the
+ * timeout function if it's running.
+ *
+ * st_expired says the time is up. st_fired says the timeout is what
+ * woke the sleeper; it stays false if something else had already
+ * taken the thread off the wchan, so that wakeup isn't lost.
+ */
+struct sleeptimeout {
+	struct wchan *st_wchan;
+	struct spinlock *st_lock;
+	struct thread *st_thread;
+	bool st_expired;
+	bool st_fired;
+};
+
+static
+void
+sleeptimeout_fire(void *arg)
+{
+	struct sleeptimeout *st = arg;
+
+	spinlock_acquire(st->st_lock);
+	st->st_expired = true;
+	st->st_fired = wchan_wakethread(st->st_wchan, st->st_lock,
+					st->st_thread);
+	spinlock_release(st->st_lock);
+}
+
+static
+void
+sleeptimeout_init(struct sleeptimeout *st, struct timeout *to,
+		  struct wchan *wc, struct spinlock *lk)
+{
+	st->st_wchan = wc;
+	st->st_lock = lk;
+	st->st_thread = curthread;
+	st->st_expired = false;
+	st->st_fired = false;
+	timeout_init(to, sleeptimeout_fire, st);
+}
+
+int
+P_timed(struct semaphore *sem, unsigned ticks)
+{
+	struct sleeptimeout st;
+	struct timeout to;
+	int result;
+
+	KASSERT(sem != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	sleeptimeout_init(&st, &to, sem->sem_wchan, &sem->sem_lock);
+
+	spinlock_acquire(&sem->sem_lock);
+	if (sem->sem_count == 0) {
+		timeout(&to, ticks);
+	}
+	while (sem->sem_count == 0 && !st.st_expired) {
+		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+	}
+	if (sem->sem_count > 0) {
+		sem->sem_count--;
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&sem->sem_lock);
+
+	untimeout(&to);
+	return result;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
@@ -156,7 +242,20 @@ lock_create(const char *name)
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-	// add stuff here as needed
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		kfree(lock->lk_name);
+		kfree(lock);
+		return NULL;
+	}
+
+	spinlock_init(&lock->lk_spinlock);
+	spinlock_data_set(&lock->lk_held, 0);
+	lock->lk_owner = NULL;
+	lock->lk_waiters = 0;
+	lock->lk_spinmax = LOCK_SPINMAX;
+	lock->lk_contended = 0;
+	lock->lk_sleeps = 0;
 
 	return lock;
 }
@@ -165,46 +264,159 @@ void
 lock_destroy(struct lock *lock)
 {
 	KASSERT(lock != NULL);
+	KASSERT(lock->lk_owner == NULL);
+	KASSERT(spinlock_data_get(&lock->lk_held) == 0);
 
-	// add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&lock->lk_spinlock);
+	wchan_destroy(lock->lk_wchan);
 	kfree(lock->lk_name);
 	kfree(lock);
 }
 
+/*
+ * Try once to get the lock with test-test-and-set. Returns true if
+ * we now hold it.
+ */
+static
+bool
+lock_tryget(struct lock *lock)
+{
+	if (spinlock_data_get(&lock->lk_held) != 0) {
+		return false;
+	}
+	if (spinlock_data_testandset(&lock->lk_held) != 0) {
+		return false;
+	}
+	membar_store_any();
+	return true;
+}
+
+/*
+ * Check if the holder of the lock is running on some other CPU, in
+ * which case it's likely to release the lock soon and spinning is
+ * worthwhile. If it's asleep, on a runqueue, or on our own CPU,
+ * spinning can only waste time.
+ *
+ * The holder may release the lock and exit while we look at it;
+ * since thread structures live in kernel memory that's always
+ * mapped, the worst this can do is give a wrong answer, which only
+ * costs a few extra spins or an early sleep.
+ */
+static
+bool
+lock_owner_running(struct lock *lock)
+{
+	struct thread *owner;
+
+	owner = lock->lk_owner;
+	if (owner == NULL) {
+		/* Between owners; worth another try. */
+		return true;
+	}
+	return owner->t_state == S_RUN && owner->t_cpu != curthread->t_cpu;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	unsigned spins;
+	bool contended;
+
+	KASSERT(lock != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	if (lock->lk_owner == curthread) {
+		panic("Deadlock on lock %s\n", lock->lk_name);
+	}
+
 	/* Call this (atomically) before waiting for a lock */
-	//HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+
+	/* Fast path: a single LL/SC when nobody holds the lock. */
+	contended = false;
+	while (!lock_tryget(lock)) {
+		contended = true;
 
-	// Write this
+		/*
+		 * Spin, boundedly, while the holder is running
+		 * elsewhere.
+		 */
+		for (spins = 0; spins < lock->lk_spinmax; spins++) {
+			if (!lock_owner_running(lock)) {
+				break;
+			}
+			if (lock_tryget(lock)) {
+				goto gotit;
+			}
+		}
 
-	(void)lock;  // suppress warning until code gets written
+		/*
+		 * Sleep. Announce ourselves in lk_waiters before the
+		 * final try, so that lock_release, which clears
+		 * lk_held before checking lk_waiters, either lets
+		 * that try succeed or sees us and wakes us up.
+		 */
+		spinlock_acquire(&lock->lk_spinlock);
+		lock->lk_waiters++;
+		membar_any_any();
+		if (lock_tryget(lock)) {
+			lock->lk_waiters--;
+			spinlock_release(&lock->lk_spinlock);
+			break;
+		}
+		lock->lk_sleeps++;
+		wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+		lock->lk_waiters--;
+		spinlock_release(&lock->lk_spinlock);
+	}
+ gotit:
+	lock->lk_owner = curthread;
+	if (contended) {
+		/* We hold the lock, so this doesn't need to be atomic */
+		lock->lk_contended++;
+	}
 
 	/* Call this (atomically) once the lock is acquired */
-	//HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
 	/* Call this (atomically) when the lock is released */
-	//HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 
-	// Write this
+	lock->lk_owner = NULL;
+	membar_any_store();
+	spinlock_data_set(&lock->lk_held, 0);
 
-	(void)lock;  // suppress warning until code gets written
+	/*
+	 * Hand off to a sleeper, if there is one. The barrier pairs
+	 * with the one in lock_acquire; see there.
+	 */
+	membar_any_any();
+	if (lock->lk_waiters > 0) {
+		spinlock_acquire(&lock->lk_spinlock);
+		wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+		spinlock_release(&lock->lk_spinlock);
+	}
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-	// Write this
-
-	(void)lock;  // suppress warning until code gets written
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
 
-	return true; // dummy until code gets written
+	/* Only we can set lk_owner to curthread, so no lock is needed */
+	return lock->lk_owner == curthread;
 }
 
 ////////////////////////////////////////////////////////////
@@ -228,7 +440,14 @@ cv_create(const char *name)
 		return NULL;
 	}
 
-	// add stuff here as needed
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		kfree(cv->cv_name);
+		kfree(cv);
+		return NULL;
+	}
+
+	spinlock_init(&cv->cv_spinlock);
 
 	return cv;
 }
@@ -238,8 +457,9 @@ cv_destroy(struct cv *cv)
 {
 	KASSERT(cv != NULL);
 
-	// add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&cv->cv_spinlock);
+	wchan_destroy(cv->cv_wchan);
 	kfree(cv->cv_name);
 	kfree(cv);
 }
@@ -247,23 +467,310 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	/*
+	 * Get onto the wchan before letting go of the lock, so a
+	 * signal sent as soon as the lock is free can't be missed.
+	 */
+	spinlock_acquire(&cv->cv_spinlock);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan, &cv->cv_spinlock);
+	spinlock_release(&cv->cv_spinlock);
+	lock_acquire(lock);
+}
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+	struct sleeptimeout st;
+	struct timeout to;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	sleeptimeout_init(&st, &to, cv->cv_wchan, &cv->cv_spinlock);
+
+	spinlock_acquire(&cv->cv_spinlock);
+	timeout(&to, ticks);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan, &cv->cv_spinlock);
+	spinlock_release(&cv->cv_spinlock);
+
+	untimeout(&to);
+	lock_acquire(lock);
+	return st.st_fired ? ETIMEDOUT : 0;
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_spinlock);
+	wchan_wakeone(cv->cv_wchan, &cv->cv_spinlock);
+	spinlock_release(&cv->cv_spinlock);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_spinlock);
+	wchan_wakeall(cv->cv_wchan, &cv->cv_spinlock);
+	spinlock_release(&cv->cv_spinlock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+	unsigned i;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_readwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_readwchan == NULL) {
+		goto fail_name;
+	}
+	rw->rw_writewchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_writewchan == NULL) {
+		goto fail_readwchan;
+	}
+	rw->rw_drainwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_drainwchan == NULL) {
+		goto fail_writewchan;
+	}
+
+	for (i=0; i<RWLOCK_NSLOTS; i++) {
+		spinlock_init(&rw->rw_slots[i].rs_lock);
+		rw->rw_slots[i].rs_readers = 0;
+	}
+	spinlock_init(&rw->rw_lock);
+	rw->rw_writers = 0;
+	rw->rw_writer = NULL;
+	rw->rw_handoff = 0;
+	rw->rw_readwaiters = 0;
+	rw->rw_readgen = 0;
+
+	return rw;
+
+ fail_writewchan:
+	wchan_destroy(rw->rw_writewchan);
+ fail_readwchan:
+	wchan_destroy(rw->rw_readwchan);
+ fail_name:
+	kfree(rw->rwlock_name);
+	kfree(rw);
+	return NULL;
+}
+
+/*
+ * Get the reader slot for the current CPU.
+ */
+static
+struct rwlock_slot *
+rwlock_myslot(struct rwlock *rw)
+{
+	return &rw->rw_slots[curcpu->c_number % RWLOCK_NSLOTS];
+}
+
+/*
+ * Count the readers. The slots are summed in unsigned arithmetic so
+ * that negative slots and a wrapped rw_handoff still add up right.
+ */
+static
+unsigned
+rwlock_readers(struct rwlock *rw)
+{
+	unsigned i, total;
+
+	total = rw->rw_handoff;
+	for (i=0; i<RWLOCK_NSLOTS; i++) {
+		spinlock_acquire(&rw->rw_slots[i].rs_lock);
+		total += (unsigned)rw->rw_slots[i].rs_readers;
+		spinlock_release(&rw->rw_slots[i].rs_lock);
+	}
+	return total;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	unsigned i;
+
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writers == 0);
+	KASSERT(rwlock_readers(rw) == 0);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	for (i=0; i<RWLOCK_NSLOTS; i++) {
+		spinlock_cleanup(&rw->rw_slots[i].rs_lock);
+	}
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_drainwchan);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	struct rwlock_slot *slot;
+	unsigned gen;
+
+	KASSERT(rw != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	if (rw->rw_writer == curthread) {
+		panic("Deadlock on rwlock %s\n", rw->rwlock_name);
+	}
+
+	/*
+	 * Fast path: with no writer around, count ourselves in our
+	 * own CPU's slot. A writer sets rw_writers before it looks
+	 * at any slot, and looks at each slot under its lock, so it
+	 * either sees our count or we see it.
+	 */
+	slot = rwlock_myslot(rw);
+	spinlock_acquire(&slot->rs_lock);
+	if (rw->rw_writers == 0) {
+		slot->rs_readers++;
+		spinlock_release(&slot->rs_lock);
+		return;
+	}
+	spinlock_release(&slot->rs_lock);
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw->rw_writers == 0) {
+		/* The writer left in the meantime. */
+		slot = rwlock_myslot(rw);
+		spinlock_acquire(&slot->rs_lock);
+		slot->rs_readers++;
+		spinlock_release(&slot->rs_lock);
+	}
+	else {
+		/*
+		 * Queue behind the writer. When it releases it
+		 * counts us into rw_handoff and bumps rw_readgen.
+		 */
+		rw->rw_readwaiters++;
+		gen = rw->rw_readgen;
+		while (rw->rw_readgen == gen) {
+			wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+		}
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	struct rwlock_slot *slot;
+
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer != curthread);
+
+	slot = rwlock_myslot(rw);
+	spinlock_acquire(&slot->rs_lock);
+	slot->rs_readers--;
+	spinlock_release(&slot->rs_lock);
+
+	/*
+	 * If a writer is waiting, it may be waiting for us. Waking it
+	 * when it isn't is harmless; it counts again.
+	 */
+	membar_any_any();
+	if (rw->rw_writers > 0) {
+		spinlock_acquire(&rw->rw_lock);
+		wchan_wakeone(rw->rw_drainwchan, &rw->rw_lock);
+		spinlock_release(&rw->rw_lock);
+	}
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	unsigned i;
+
+	KASSERT(rw != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	if (rw->rw_writer == curthread) {
+		panic("Deadlock on rwlock %s\n", rw->rwlock_name);
+	}
+
+	spinlock_acquire(&rw->rw_lock);
+
+	/* From here on no new readers get in through the fast path. */
+	rw->rw_writers++;
+	while (rw->rw_writer != NULL) {
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+	}
+	rw->rw_writer = curthread;
+
+	/* Wait for the readers already in to leave. */
+	while (rwlock_readers(rw) != 0) {
+		wchan_sleep(rw->rw_drainwchan, &rw->rw_lock);
+	}
+
+	/* Nobody is reading, so fold the counts back to zero. */
+	rw->rw_handoff = 0;
+	for (i=0; i<RWLOCK_NSLOTS; i++) {
+		spinlock_acquire(&rw->rw_slots[i].rs_lock);
+		rw->rw_slots[i].rs_readers = 0;
+		spinlock_release(&rw->rw_slots[i].rs_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	KASSERT(rw->rw_writers > 0);
+	rw->rw_writers--;
+
+	/*
+	 * Hand off to the readers that queued up behind us, all at
+	 * once, before any other writer can get in. They count as
+	 * holding the lock from now on.
+	 */
+	if (rw->rw_readwaiters > 0) {
+		rw->rw_handoff += rw->rw_readwaiters;
+		rw->rw_readwaiters = 0;
+		rw->rw_readgen++;
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+	wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+
+	spinlock_release(&rw->rw_lock);
 }
@@ -50,11 +50,33 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmem_cache.h>
+#include <clock.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning. A thread at priority P runs for SCHED_QUANTUM(P)
+ * hardclocks before being demoted; every SCHED_RESET_HARDCLOCKS all
+ * threads go back to the top priority so nothing starves.
+ */
+#define SCHED_QUANTUM(p)	(1U << (p))
+#define SCHED_RESET_HARDCLOCKS	(HZ / 2)
+
+/*
+ * A thread stolen by another cpu is left there for at least this
+ * many ticks of its own running time, unless a cpu is otherwise idle.
+ */
+#define SCHED_AFFINITY_TICKS	8
+
+/*
+ * Number of exited threads each cpu keeps, stacks and all, for
+ * thread_fork to reuse.
+ */
+#define THREAD_CACHE_MAX	16
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -75,6 +97,10 @@ unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
 static struct wchan *thread_count_wchan;
 
+/* Object caches for threads and wait channels. */
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *wchan_cache;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -115,33 +141,65 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Object cache constructor and destructor for threads: the list node
+ * is always unlinked while the thread is free, so set it up once.
  */
 static
-struct thread *
-thread_create(const char *name)
+void
+thread_ctor(void *obj)
 {
-	struct thread *thread;
+	struct thread *thread = obj;
 
-	DEBUGASSERT(name != NULL);
-	if (strlen(name) > MAX_NAME_LENGTH) {
-		return NULL;
-	}
+	threadlistnode_init(&thread->t_listnode, thread);
+}
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
-	}
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_cleanup(&thread->t_listnode);
+}
 
+/*
+ * Likewise for wait channels, whose thread list is empty whenever
+ * the channel is free.
+ */
+static
+void
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_init(&wc->wc_threads);
+}
+
+static
+void
+wchan_dtor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_cleanup(&wc->wc_threads);
+}
+
+/*
+ * Initialize a thread structure, other than its stack. This is used
+ * both for new threads and for ones being recycled.
+ */
+static
+void
+thread_init(struct thread *thread, const char *name)
+{
 	strcpy(thread->t_name, name);
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* t_listnode is set up by thread_ctor */
+	/* t_stack is set up by the caller */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -152,7 +210,37 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduling fields; new threads start at the top priority */
+	thread->t_priority = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_ticks = 0;
+	thread->t_affinity = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+	if (strlen(name) > MAX_NAME_LENGTH) {
+		return NULL;
+	}
+
+	thread = kmem_cache_alloc(thread_cache);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	thread_init(thread, name);
+	thread->t_stack = NULL;
 
 	return thread;
 }
@@ -170,6 +258,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -184,9 +273,30 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_kmcache = NULL;
+	c->c_cmcache = NULL;
+	c->c_timeouts = NULL;
+	c->c_asid = 0;
+	c->c_asidnext = 0;
+	c->c_asidgen = 0;
+	c->c_tlbfaults = 0;
+	c->c_tlbrefills = 0;
+	c->c_schedreset = 0;
+	c->c_demotions = 0;
+	c->c_boosts = 0;
+	c->c_resets = 0;
+	c->c_steals = 0;
+
+	threadlist_init(&c->c_threadcache);
+	spinlock_init(&c->c_threadcache_lock);
+	c->c_threadcache_hits = 0;
+	c->c_threadcache_misses = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -253,10 +363,63 @@ cpu_create(unsigned hardware_number)
 	}
 
 	cpu_machdep_init(c);
+	kmalloc_cpucache_init(c);
+	coremap_cpucache_init(c);
+	timeout_cpu_init(c);
 
 	return c;
 }
 
+/*
+ * Print each CPU's TLB fault counts. The counts aren't locked, so
+ * they may be slightly stale.
+ */
+void
+cpu_printtlbstats(void)
+{
+	unsigned i;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%u: %u TLB faults, %u refilled from cache, "
+			"%u ASID generations\n", c->c_number, c->c_tlbfaults,
+			c->c_tlbrefills, c->c_asidgen);
+	}
+}
+
+/*
+ * Print the run queues and scheduler counts for all CPUs.
+ */
+void
+cpu_printschedstats(void)
+{
+	unsigned i, p;
+	unsigned counts[SCHED_NPRIO];
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		for (p=0; p<SCHED_NPRIO; p++) {
+			counts[p] = c->c_runqueue[p].tl_count;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+
+		kprintf("cpu%u: runnable by priority:", c->c_number);
+		for (p=0; p<SCHED_NPRIO; p++) {
+			kprintf(" %u", counts[p]);
+		}
+		kprintf("\n");
+		kprintf("      %u demotions, %u boosts, %u resets, "
+			"%u steals\n", c->c_demotions, c->c_boosts,
+			c->c_resets, c->c_steals);
+		kprintf("      thread cache: %u cached, %u hits, %u misses\n",
+			c->c_threadcache.tl_count, c->c_threadcache_hits,
+			c->c_threadcache_misses);
+	}
+}
+
 /*
  * Destroy a thread.
  *
@@ -280,18 +443,119 @@ thread_destroy(struct thread *thread)
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
-	threadlistnode_cleanup(&thread->t_listnode);
+	KASSERT(thread->t_listnode.tln_next == NULL);
+	KASSERT(thread->t_listnode.tln_prev == NULL);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
+}
+
+/*
+ * Thread recycling.
+ *
+ * Rather than freeing an exited thread and its stack only to
+ * allocate them again for the next thread_fork, each cpu keeps up to
+ * THREAD_CACHE_MAX of them in c_threadcache. The stack's guard band
+ * is checked on the way in, so it needn't be rewritten on the way
+ * out. Everything else is reinitialized by thread_init.
+ *
+ * Threads without a freeable stack (the boot threads) aren't cached.
+ */
+
+/*
+ * Put a dead thread in the current cpu's cache, or destroy it if
+ * the cache is full.
+ */
+static
+void
+thread_recycle(struct thread *thread)
+{
+	struct cpu *c = curcpu->c_self;
+
+	KASSERT(thread != curthread);
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack != NULL) {
+		thread_checkstack(thread);
+		spinlock_acquire(&c->c_threadcache_lock);
+		if (c->c_threadcache.tl_count < THREAD_CACHE_MAX) {
+			thread_machdep_cleanup(&thread->t_machdep);
+			thread->t_wchan_name = "RECYCLED";
+			threadlist_addhead(&c->c_threadcache, thread);
+			spinlock_release(&c->c_threadcache_lock);
+			return;
+		}
+		spinlock_release(&c->c_threadcache_lock);
+	}
+	thread_destroy(thread);
+}
+
+/*
+ * Take a thread, with stack, from the current cpu's cache. Returns
+ * NULL if there isn't one.
+ */
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct cpu *c;
+	struct thread *thread;
+
+	/* This might migrate us between reading curcpu and locking; ok. */
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_threadcache_lock);
+	thread = threadlist_remhead(&c->c_threadcache);
+	if (thread != NULL) {
+		c->c_threadcache_hits++;
+	}
+	else {
+		c->c_threadcache_misses++;
+	}
+	spinlock_release(&c->c_threadcache_lock);
+	return thread;
+}
+
+/*
+ * Empty every cpu's thread cache. The threads are destroyed after
+ * the cache lock is released, since that calls kfree.
+ */
+unsigned
+thread_reclaim(void)
+{
+	struct threadlist victims;
+	struct thread *thread;
+	struct cpu *c;
+	unsigned i, total;
+
+	threadlist_init(&victims);
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_threadcache_lock);
+		while ((thread = threadlist_remhead(&c->c_threadcache))
+		       != NULL) {
+			threadlist_addtail(&victims, thread);
+		}
+		spinlock_release(&c->c_threadcache_lock);
+	}
+
+	total = 0;
+	while ((thread = threadlist_remhead(&victims)) != NULL) {
+		/* Undo thread_recycle so thread_destroy can redo it. */
+		thread_machdep_init(&thread->t_machdep);
+		thread_destroy(thread);
+		total++;
+	}
+	threadlist_cleanup(&victims);
+	return total;
 }
 
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) Most of them go into
+ * the thread cache for reuse.
  *
  * The list of zombies is per-cpu.
  */
@@ -304,7 +568,7 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_recycle(z);
 	}
 }
 
@@ -316,6 +580,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -330,9 +596,14 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		struct threadlist *tl = &curcpu->c_runqueue[i];
+
+		tl->tl_count = 0;
+		tl->tl_head.tln_next = &tl->tl_tail;
+		tl->tl_tail.tln_prev = &tl->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -375,6 +646,14 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	wchan_cache = kmem_cache_create("wchan", sizeof(struct wchan),
+					wchan_ctor, wchan_dtor);
+	if (thread_cache == NULL || wchan_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -455,6 +734,167 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Run queue operations. The run queue lock of the cpu must be held.
+ *
+ * runqueue_remhead takes the first thread of the highest priority,
+ * or returns NULL if there are no runnable threads.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NPRIO);
+
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount++;
+}
+
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned p;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (p=0; p<SCHED_NPRIO; p++) {
+		t = threadlist_remhead(&c->c_runqueue[p]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return the highest priority with a runnable thread, or SCHED_NPRIO
+ * if there are none.
+ */
+static
+unsigned
+runqueue_toppriority(struct cpu *c)
+{
+	unsigned p;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (p=0; p<SCHED_NPRIO; p++) {
+		if (!threadlist_isempty(&c->c_runqueue[p])) {
+			break;
+		}
+	}
+	return p;
+}
+
+/*
+ * Work stealing.
+ *
+ * Find the cpu with the most runnable threads, going by c_runcount
+ * without locking anything, and take one of its threads for the
+ * current cpu. Only that cpu's run queue lock is taken, and the
+ * current cpu's run queue lock must not be held.
+ *
+ * If IDLE is true the current cpu has nothing to run, so anything
+ * will do, though threads that haven't used up their t_affinity are
+ * taken only if there's nothing else. Otherwise we only steal to even
+ * out an imbalance of at least two threads, and leave such threads
+ * alone entirely.
+ *
+ * The stolen thread is returned with its t_cpu set to the current
+ * cpu; the caller should run it or put it on the run queue.
+ */
+static
+struct thread *
+thread_steal(bool idle)
+{
+	struct cpu *c, *victim;
+	struct thread *t, *found, *fallback;
+	unsigned i, p, n, most, mine;
+
+	mine = curcpu->c_runcount;
+	most = 0;
+	victim = NULL;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		n = c->c_runcount;
+		if (n > most) {
+			most = n;
+			victim = c;
+		}
+	}
+	if (victim == NULL || (!idle && most < mine + 2)) {
+		return NULL;
+	}
+
+	found = fallback = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (p=0; p<SCHED_NPRIO && found == NULL; p++) {
+		THREADLIST_FORALL(t, victim->c_runqueue[p]) {
+			/*
+			 * If the victim is idle, its curthread can be on
+			 * its run queue while it's still using that
+			 * thread's stack (see thread_switch). Don't
+			 * touch it.
+			 */
+			if (t == victim->c_curthread) {
+				continue;
+			}
+			if (t->t_affinity > 0) {
+				if (fallback == NULL) {
+					fallback = t;
+				}
+				continue;
+			}
+			found = t;
+			break;
+		}
+	}
+	if (found == NULL && idle) {
+		found = fallback;
+	}
+	if (found != NULL) {
+		threadlist_remove(&victim->c_runqueue[found->t_priority],
+				  found);
+		victim->c_runcount--;
+		found->t_cpu = curcpu->c_self;
+		found->t_affinity = SCHED_AFFINITY_TICKS;
+		curcpu->c_steals++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      found->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	return found;
+}
+
+/*
+ * Wake up one idle cpu other than BUSY (and ourselves), if there is
+ * one, so it can steal work. c_isidle is read without locking; at
+ * worst we send a useless interrupt or the work waits for BUSY.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -465,6 +905,7 @@ void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
+	bool hadwork;
 
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
@@ -479,7 +920,8 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	hadwork = targetcpu->c_runcount > 0;
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -488,6 +930,18 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!targetcpu->c_isidle && hadwork && target != curthread) {
+		/*
+		 * The target is busy and already had threads waiting,
+		 * so this one has to queue behind them. Idle cpus have
+		 * no clock tick and won't notice on their own, so poke
+		 * one to come steal it. Not when we're requeueing
+		 * ourselves in thread_switch: we're about to pick the
+		 * next thread anyway, and the rest will be stolen the
+		 * usual way.
+		 */
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -511,20 +965,35 @@ thread_fork(const char *name,
 	    void *data1, unsigned long data2)
 {
 	struct thread *newthread;
+	void *stack;
 	int result;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
+	DEBUGASSERT(name != NULL);
+	if (strlen(name) > MAX_NAME_LENGTH) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+	/* Reuse an exited thread and its stack, if one is handy */
+	newthread = thread_cache_get();
+	if (newthread != NULL) {
+		stack = newthread->t_stack;
+		thread_init(newthread, name);
+		newthread->t_stack = stack;
+	}
+	else {
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
+
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -606,7 +1075,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -620,6 +1089,18 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		/*
+		 * Threads that block before using up their quantum
+		 * are doing I/O or waiting on something; move them
+		 * up a level so they get the cpu promptly when they
+		 * wake up.
+		 */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+			curcpu->c_boosts++;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
+
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -640,10 +1121,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
-	 * curcpu->c_isidle must be true when cpu_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
+	 * Get the next thread. If there isn't one, try to steal one
+	 * from another cpu; failing that, call cpu_idle() and try
+	 * again. curcpu->c_isidle must be true when cpu_idle is
+	 * called. Unlock the runqueue while stealing and idling, to
+	 * make sure things can be added to it (and because we must
+	 * not hold two run queue locks at once).
 	 *
 	 * Note that we don't need to unlock the runqueue atomically
 	 * with idling; becoming unidle requires receiving an
@@ -659,10 +1142,25 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal(true);
+			if (next == NULL && timeout_cpu_pending()) {
+				/* Keep ticking; the timeouts need it. */
+				cpu_idle();
+			}
+			else if (next == NULL) {
+				/*
+				 * Stop the clock tick while idle; we
+				 * have nothing to charge it to and
+				 * anything that gives us work will
+				 * send an interrupt.
+				 */
+				mainbus_tick_stop();
+				cpu_idle();
+				mainbus_tick_start();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -847,139 +1345,131 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has a run queue for
+ * each of SCHED_NPRIO priority levels and always runs the first
+ * thread of the highest nonempty level; threads at the same level
+ * run round-robin.
+ *
+ *    - New threads start at the top level (priority 0).
+ *    - A thread that runs for its whole quantum (which is longer at
+ *      lower levels) without blocking is demoted one level.
+ *    - A thread that goes to sleep on a wchan is boosted one level.
+ *    - A running thread is preempted on the next tick if a thread
+ *      of higher priority becomes runnable.
+ *    - Every SCHED_RESET_HARDCLOCKS, schedule() moves everything
+ *      back to the top level, so CPU-bound threads can't starve
+ *      and threads whose behavior changes get reclassified.
  */
 
+/*
+ * Called on every hardclock(). Note that we're in an interrupt
+ * handler with interrupts off, so curthread can't change under us.
+ */
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool preempt;
+
+	if (curcpu->c_isidle) {
+		/* Nobody to charge */
+		return;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_affinity > 0) {
+		cur->t_affinity--;
+	}
+	KASSERT(cur->t_quantum > 0);
+	cur->t_quantum--;
+	if (cur->t_quantum == 0) {
+		/* Used up its quantum; demote it */
+		if (cur->t_priority < SCHED_NPRIO - 1) {
+			cur->t_priority++;
+			curcpu->c_demotions++;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
+
+		/*
+		 * If nothing else is runnable here there's no point
+		 * going through thread_switch. (c_runcount is read
+		 * without the lock; if we miss a thread that just
+		 * arrived, the next tick will see it.)
+		 */
+		preempt = curcpu->c_runcount > 0;
+	}
+	else if (curcpu->c_runcount == 0) {
+		preempt = false;
+	}
+	else {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		preempt = runqueue_toppriority(curcpu) < cur->t_priority;
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). It does the
+ * anti-starvation reset.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct cpu *c = curcpu->c_self;
+	struct thread *t;
+	unsigned p;
+
+	if (c->c_hardclocks - c->c_schedreset < SCHED_RESET_HARDCLOCKS) {
+		return;
+	}
+	c->c_schedreset = c->c_hardclocks;
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	for (p=1; p<SCHED_NPRIO; p++) {
+		while ((t = threadlist_remhead(&c->c_runqueue[p])) != NULL) {
+			t->t_priority = 0;
+			t->t_quantum = SCHED_QUANTUM(0);
+			threadlist_addtail(&c->c_runqueue[0], t);
+		}
+	}
+	if (!c->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_quantum = SCHED_QUANTUM(0);
+	}
+	c->c_resets++;
+	spinlock_release(&c->c_runqueue_lock);
 }
 
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * This is also called periodically from hardclock(). Idle cpus
+ * steal work as soon as they run out (see thread_switch), so this
+ * only has to even out busy cpus: if another cpu has at least two
+ * more runnable threads than we do, pull one of them over.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * which is fairly slow. So threads that were just moved are left
+ * alone for SCHED_AFFINITY_TICKS unless a cpu would otherwise idle.
+ * System/161 does not (yet) model such cache effects, but this also
+ * keeps threads from bouncing back and forth.
  */
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
-	}
-
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
-	spinlock_release(&curcpu->c_runqueue_lock);
-
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
+	t = thread_steal(false);
+	if (t != NULL) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
+		runqueue_add(curcpu, t);
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
 }
 
 ////////////////////////////////////////////////////////////
@@ -1001,11 +1491,10 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 
 	return wc;
@@ -1018,8 +1507,8 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
-	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	kmem_cache_free(wchan_cache, wc);
 }
 
 /*
@@ -1107,6 +1596,26 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Wake up one particular thread, if it's sleeping on a wait channel.
+ */
+bool
+wchan_wakethread(struct wchan *wc, struct spinlock *lk, struct thread *target)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (t == target) {
+			threadlist_remove(&wc->wc_threads, t);
+			thread_make_runnable(t, false);
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1193,6 +1702,31 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to the CPUs in CPUMASK other than the
+ * current one. Returns the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_mask(uint32_t cpumask, const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	/* CPUMASK only has room for the first 32 CPUs. */
+	for (i=0; i < cpuarray_num(&allcpus) && i < 32; i++) {
+		if ((cpumask & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1200,7 +1734,8 @@ void
 interprocessor_interrupt(void)
 {
 	uint32_t bits;
-	unsigned i;
+	struct tlbshootdown shootdown[TLBSHOOTDOWN_MAX];
+	unsigned i, numshootdown;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1227,20 +1762,28 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	numshootdown = 0;
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * Take the requests off the queue and do them after
+		 * releasing the ipi lock: vm_tlbshootdown signals the
+		 * sender, and waking a thread can itself send an IPI
+		 * (IPI_UNIDLE) to a cpu whose ipi lock is held by
+		 * someone waiting for our semaphore.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		numshootdown = curcpu->c_numshootdown;
+		for (i=0; i<numshootdown; i++) {
+			shootdown[i] = curcpu->c_shootdown[i];
 		}
 		curcpu->c_numshootdown = 0;
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	for (i=0; i<numshootdown; i++) {
+		vm_tlbshootdown(&shootdown[i]);
+	}
 }
 
 /*
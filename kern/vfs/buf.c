@@ -0,0 +1,1019 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Buffer cache. See buf.h.
+ *
+ * Locking: buf_lock protects everything here except buffer contents.
+ * A buffer with I/O in progress is marked busy (and always has a
+ * reference, so it can't be reused meanwhile); anyone else who wants
+ * it waits on buf_wchan, as does anyone waiting for a buffer to be
+ * released so it can be reused.
+ *
+ * Buffers are allocated as needed up to buf_max, which is based on
+ * the amount of RAM, and are never freed.
+ *
+ * Prefetch requests go on a small queue and are read in by the
+ * readahead thread. It only ever fills buffers it made itself, so it
+ * can't clobber a buffer someone got with buf_get and is filling.
+ * If the queue is full, requests are dropped.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <clock.h>
+#include <uio.h>
+#include <device.h>
+#include <mainbus.h>
+#include <buf.h>
+
+/* Use 1/BUF_RAMFRACTION of RAM for buffers, but at least BUF_MINBUFS. */
+#define BUF_RAMFRACTION	16
+#define BUF_MINBUFS	32
+
+/* Size of the hash table; must be a power of 2. */
+#define BUF_NBUCKETS	128
+
+/* How often the syncer thread writes dirty buffers, in seconds. */
+#define BUF_SYNCSECS	5
+
+/* Size of the prefetch queue. */
+#define BUF_PREFETCHQ	32
+
+struct buf {
+	struct device *b_dev;		/* device, or NULL if unused */
+	daddr_t b_block;		/* block number on b_dev */
+	void *b_data;			/* contents */
+	unsigned b_refcount;		/* number of users */
+	bool b_valid;			/* contents are valid */
+	bool b_dirty;			/* contents need writing */
+	bool b_busy;			/* I/O in progress */
+	struct buf *b_hashnext;		/* next in hash bucket */
+	struct buf *b_lruprev;		/* LRU list (unreferenced buffers) */
+	struct buf *b_lrunext;
+};
+
+static struct spinlock buf_lock = SPINLOCK_INITIALIZER;
+static struct wchan *buf_wchan;
+
+static struct buf **buf_all;		/* all buffers */
+static unsigned buf_num;		/* number of buffers */
+static unsigned buf_max;		/* most buffers we'll make */
+
+/* Prefetch queue */
+struct bufprefetch {
+	struct device *bp_dev;
+	daddr_t bp_block;
+	unsigned bp_num;
+};
+static struct bufprefetch buf_pfq[BUF_PREFETCHQ];
+static unsigned buf_pfhead;		/* next request to do */
+static unsigned buf_pfcount;		/* number of requests queued */
+static struct device *buf_pfdev;	/* device being prefetched from */
+static struct wchan *buf_pfwchan;	/* readahead thread sleeps here */
+
+static struct buf *buf_hash[BUF_NBUCKETS];
+static struct buf *buf_lruhead;		/* least recently used */
+static struct buf *buf_lrutail;		/* most recently used */
+
+/* Statistics */
+static unsigned buf_hits;		/* buf_read found it cached */
+static unsigned buf_misses;		/* buf_read had to read it */
+static unsigned buf_writes;		/* buffers written */
+static unsigned buf_runios;		/* multi-block transfers */
+static unsigned buf_runblocks;		/* blocks in those transfers */
+static unsigned buf_prefetched;		/* blocks read by prefetching */
+static unsigned buf_pfdropped;		/* prefetches dropped, queue full */
+
+////////////////////////////////////////////////////////////
+// lists
+
+static
+unsigned
+buf_hashfunc(struct device *dev, daddr_t block)
+{
+	return (((uintptr_t)dev >> 4) ^ block) & (BUF_NBUCKETS - 1);
+}
+
+static
+struct buf *
+buf_lookup(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hash[buf_hashfunc(dev, block)]; b != NULL;
+	     b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_hashinsert(struct buf *b)
+{
+	unsigned bucket;
+
+	bucket = buf_hashfunc(b->b_dev, b->b_block);
+	b->b_hashnext = buf_hash[bucket];
+	buf_hash[bucket] = b;
+}
+
+static
+void
+buf_hashremove(struct buf *b)
+{
+	struct buf **bp;
+
+	for (bp = &buf_hash[buf_hashfunc(b->b_dev, b->b_block)]; *bp != b;
+	     bp = &(*bp)->b_hashnext) {
+		KASSERT(*bp != NULL);
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+void
+buf_lruappend(struct buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = buf_lrutail;
+	if (buf_lrutail != NULL) {
+		buf_lrutail->b_lrunext = b;
+	}
+	else {
+		buf_lruhead = b;
+	}
+	buf_lrutail = b;
+}
+
+static
+void
+buf_lruremove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(buf_lruhead == b);
+		buf_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(buf_lrutail == b);
+		buf_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+buf_ref(struct buf *b)
+{
+	if (b->b_refcount == 0) {
+		buf_lruremove(b);
+	}
+	b->b_refcount++;
+}
+
+static
+void
+buf_unref(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	b->b_refcount--;
+	if (b->b_refcount == 0) {
+		KASSERT(!b->b_busy);
+		buf_lruappend(b);
+		if (!wchan_isempty(buf_wchan, &buf_lock)) {
+			wchan_wakeall(buf_wchan, &buf_lock);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Read or write N buffers holding consecutive blocks of the same
+ * device, in one transfer, retrying I/O errors. The buffers must be
+ * busy.
+ */
+static
+int
+buf_iorun(struct buf **bufs, unsigned n, enum uio_rw rw)
+{
+	struct iovec iov[BUF_MAXRUN];
+	struct uio ku;
+	unsigned i;
+	int result;
+	int tries = 0;
+
+	KASSERT(n > 0 && n <= BUF_MAXRUN);
+
+	for (i=0; i<n; i++) {
+		KASSERT(bufs[i]->b_busy);
+		KASSERT(bufs[i]->b_dev == bufs[0]->b_dev);
+		KASSERT(bufs[i]->b_block == bufs[0]->b_block + i);
+		iov[i].iov_kbase = bufs[i]->b_data;
+		iov[i].iov_len = BUF_BLOCKSIZE;
+	}
+
+ retry:
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)bufs[0]->b_block * BUF_BLOCKSIZE;
+	ku.uio_resid = n * BUF_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+
+	result = DEVOP_IO(bufs[0]->b_dev, &ku);
+	if (result == EINVAL) {
+		/*
+		 * The block was out of range, or some other thing
+		 * that's our fault.
+		 */
+		panic("buf: block %u: DEVOP_IO returned EINVAL\n",
+		      bufs[0]->b_block);
+	}
+	if (result == EIO && tries < 10) {
+		if (tries == 0) {
+			kprintf("buf: block %u I/O error, retrying\n",
+				bufs[0]->b_block);
+		}
+		tries++;
+		/* uiomove advanced the iovecs; put them back */
+		for (i=0; i<n; i++) {
+			iov[i].iov_kbase = bufs[i]->b_data;
+			iov[i].iov_len = BUF_BLOCKSIZE;
+		}
+		goto retry;
+	}
+	if (result == EIO) {
+		kprintf("buf: block %u I/O error, giving up after %d "
+			"retries\n", bufs[0]->b_block, tries);
+	}
+	return result;
+}
+
+/*
+ * Write out N dirty buffers holding consecutive blocks, in one
+ * transfer. We must hold a reference to each, and the lock, which is
+ * released during the write.
+ *
+ * The buffers are marked clean before the write, so if someone
+ * changes one while the write is in progress and marks it dirty
+ * again, it stays dirty.
+ */
+static
+int
+buf_writerun(struct buf **bufs, unsigned n)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&buf_lock));
+
+	for (i=0; i<n; i++) {
+		KASSERT(bufs[i]->b_refcount > 0);
+		KASSERT(bufs[i]->b_dirty);
+		KASSERT(!bufs[i]->b_busy);
+		bufs[i]->b_busy = true;
+		bufs[i]->b_dirty = false;
+	}
+	spinlock_release(&buf_lock);
+
+	result = buf_iorun(bufs, n, UIO_WRITE);
+
+	spinlock_acquire(&buf_lock);
+	for (i=0; i<n; i++) {
+		bufs[i]->b_busy = false;
+		if (result) {
+			bufs[i]->b_dirty = true;
+		}
+	}
+	buf_writes += n;
+	if (n > 1) {
+		buf_runios++;
+		buf_runblocks += n;
+	}
+	wchan_wakeall(buf_wchan, &buf_lock);
+	return result;
+}
+
+/*
+ * Write out a single dirty buffer, as above.
+ */
+static
+int
+buf_writeout(struct buf *b)
+{
+	return buf_writerun(&b, 1);
+}
+
+////////////////////////////////////////////////////////////
+// getting buffers
+
+static
+struct buf *
+buf_create(void)
+{
+	struct buf *b;
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(BUF_BLOCKSIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_refcount = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_busy = false;
+	b->b_hashnext = NULL;
+	b->b_lruprev = b->b_lrunext = NULL;
+	return b;
+}
+
+/*
+ * Find or make the buffer for block BLOCK of DEV, and return it
+ * referenced and not busy. Its contents may not be valid. The lock
+ * must be held; it may be released and reacquired.
+ *
+ * If every buffer is in use, wait for one to be released, unless
+ * WAIT is false, in which case fail with EAGAIN. Callers that already
+ * hold buffers use that so they can't end up waiting on each other.
+ */
+static
+int
+buf_find(struct device *dev, daddr_t block, bool wait, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&buf_lock));
+	KASSERT(dev->d_blocksize == BUF_BLOCKSIZE);
+
+	while (1) {
+		b = buf_lookup(dev, block);
+		if (b != NULL) {
+			buf_ref(b);
+			while (b->b_busy) {
+				wchan_sleep(buf_wchan, &buf_lock);
+			}
+			*ret = b;
+			return 0;
+		}
+
+		if (buf_num < buf_max) {
+			/* Make another buffer and start over. */
+			spinlock_release(&buf_lock);
+			b = buf_create();
+			spinlock_acquire(&buf_lock);
+			if (b == NULL) {
+				if (buf_num == 0) {
+					return ENOMEM;
+				}
+				/* Make do with what we have. */
+				buf_max = buf_num;
+				continue;
+			}
+			buf_all[buf_num++] = b;
+			buf_lruappend(b);
+			continue;
+		}
+
+		/* Reuse the least recently used buffer. */
+		b = buf_lruhead;
+		if (b == NULL) {
+			/* Everything's in use. */
+			if (!wait) {
+				return EAGAIN;
+			}
+			wchan_sleep(buf_wchan, &buf_lock);
+			continue;
+		}
+		buf_ref(b);
+		if (b->b_dirty) {
+			result = buf_writeout(b);
+			(void)result;
+			/* Someone may have wanted it meanwhile; start over. */
+			buf_unref(b);
+			continue;
+		}
+
+		if (b->b_dev != NULL) {
+			buf_hashremove(b);
+		}
+		b->b_dev = dev;
+		b->b_block = block;
+		b->b_valid = false;
+		buf_hashinsert(b);
+		*ret = b;
+		return 0;
+	}
+}
+
+/*
+ * Make sure a buffer we hold a reference to has valid contents,
+ * reading it in if necessary. The lock must be held; it's released
+ * during the read.
+ */
+static
+int
+buf_fill(struct buf *b)
+{
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&buf_lock));
+	KASSERT(b->b_refcount > 0);
+
+	while (b->b_busy) {
+		wchan_sleep(buf_wchan, &buf_lock);
+	}
+	if (b->b_valid) {
+		buf_hits++;
+		return 0;
+	}
+
+	buf_misses++;
+	b->b_busy = true;
+	spinlock_release(&buf_lock);
+
+	result = buf_iorun(&b, 1, UIO_READ);
+
+	spinlock_acquire(&buf_lock);
+	b->b_busy = false;
+	if (result == 0) {
+		b->b_valid = true;
+	}
+	wchan_wakeall(buf_wchan, &buf_lock);
+	return result;
+}
+
+int
+buf_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	spinlock_acquire(&buf_lock);
+	result = buf_find(dev, block, true, &b);
+	if (result) {
+		spinlock_release(&buf_lock);
+		return result;
+	}
+
+	result = buf_fill(b);
+	if (result) {
+		buf_unref(b);
+		spinlock_release(&buf_lock);
+		return result;
+	}
+	spinlock_release(&buf_lock);
+
+	*ret = b;
+	return 0;
+}
+
+int
+buf_readrun(struct device *dev, daddr_t block, unsigned *np,
+	    struct buf **bufs)
+{
+	bool mine[BUF_MAXRUN];
+	unsigned n, i, j, k;
+	int result;
+
+	n = *np;
+	KASSERT(n > 0 && n <= BUF_MAXRUN);
+
+	spinlock_acquire(&buf_lock);
+
+	/*
+	 * Get the buffers. Only wait for a free buffer for the first
+	 * one; if the cache is that short, make do with a shorter run.
+	 */
+	for (i=0; i<n; i++) {
+		result = buf_find(dev, block + i, i == 0, &bufs[i]);
+		if (result) {
+			if (i == 0) {
+				spinlock_release(&buf_lock);
+				return result;
+			}
+			n = i;
+			break;
+		}
+	}
+
+	/*
+	 * Claim the ones that need reading. Skip any that someone
+	 * else has busy; they get dealt with below.
+	 */
+	for (i=0; i<n; i++) {
+		mine[i] = !bufs[i]->b_valid && !bufs[i]->b_busy;
+		if (mine[i]) {
+			bufs[i]->b_busy = true;
+			buf_misses++;
+		}
+	}
+	spinlock_release(&buf_lock);
+
+	/* Read each consecutive group of them in one transfer. */
+	for (i=0; i<n; i = j) {
+		if (!mine[i]) {
+			j = i + 1;
+			continue;
+		}
+		for (j = i + 1; j < n && mine[j]; j++) {
+			/* nothing */
+		}
+		result = buf_iorun(&bufs[i], j - i, UIO_READ);
+
+		spinlock_acquire(&buf_lock);
+		for (k=i; k<j; k++) {
+			bufs[k]->b_busy = false;
+			if (result == 0) {
+				bufs[k]->b_valid = true;
+			}
+		}
+		if (result == 0 && j - i > 1) {
+			buf_runios++;
+			buf_runblocks += j - i;
+		}
+		wchan_wakeall(buf_wchan, &buf_lock);
+		spinlock_release(&buf_lock);
+	}
+
+	/*
+	 * Now pick up anything still not valid the ordinary way. If
+	 * something fails, stop the run there.
+	 */
+	spinlock_acquire(&buf_lock);
+	for (i=0; i<n; i++) {
+		if (bufs[i]->b_valid) {
+			continue;
+		}
+		result = buf_fill(bufs[i]);
+		if (result) {
+			for (j=i; j<n; j++) {
+				buf_unref(bufs[j]);
+			}
+			if (i == 0) {
+				spinlock_release(&buf_lock);
+				return result;
+			}
+			n = i;
+			break;
+		}
+	}
+	spinlock_release(&buf_lock);
+
+	*np = n;
+	return 0;
+}
+
+int
+buf_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	int result;
+
+	spinlock_acquire(&buf_lock);
+	result = buf_find(dev, block, true, ret);
+	spinlock_release(&buf_lock);
+	return result;
+}
+
+void
+buf_release(struct buf *b)
+{
+	spinlock_acquire(&buf_lock);
+	buf_unref(b);
+	spinlock_release(&buf_lock);
+}
+
+void *
+buf_map(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_data;
+}
+
+bool
+buf_isvalid(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_valid;
+}
+
+void
+buf_markdirty(struct buf *b)
+{
+	spinlock_acquire(&buf_lock);
+	KASSERT(b->b_refcount > 0);
+	b->b_valid = true;
+	b->b_dirty = true;
+	spinlock_release(&buf_lock);
+}
+
+////////////////////////////////////////////////////////////
+// prefetching
+
+void
+buf_prefetch(struct device *dev, daddr_t block, unsigned n)
+{
+	unsigned i;
+
+	KASSERT(n > 0 && n <= BUF_MAXRUN);
+
+	spinlock_acquire(&buf_lock);
+	if (buf_pfcount == BUF_PREFETCHQ) {
+		buf_pfdropped++;
+		spinlock_release(&buf_lock);
+		return;
+	}
+	i = (buf_pfhead + buf_pfcount) % BUF_PREFETCHQ;
+	buf_pfq[i].bp_dev = dev;
+	buf_pfq[i].bp_block = block;
+	buf_pfq[i].bp_num = n;
+	buf_pfcount++;
+	wchan_wakeone(buf_pfwchan, &buf_lock);
+	spinlock_release(&buf_lock);
+}
+
+bool
+buf_incache(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+	bool ret;
+
+	spinlock_acquire(&buf_lock);
+	b = buf_lookup(dev, block);
+	ret = b != NULL && (b->b_valid || b->b_busy);
+	spinlock_release(&buf_lock);
+	return ret;
+}
+
+/*
+ * Read in up to N blocks starting at BLOCK of DEV, in one transfer.
+ * Stop at the first block that's already in the cache, or if there's
+ * no free buffer. The lock is held, and released during the read.
+ */
+static
+void
+buf_prefetchrun(struct device *dev, daddr_t block, unsigned n)
+{
+	struct buf *bufs[BUF_MAXRUN];
+	struct buf *b;
+	unsigned got, i;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&buf_lock));
+
+	for (got = 0; got < n; got++) {
+		if (buf_lookup(dev, block + got) != NULL) {
+			break;
+		}
+		result = buf_find(dev, block + got, false, &b);
+		if (result) {
+			break;
+		}
+		/* Someone else may have gotten there first */
+		if (b->b_valid || b->b_busy || b->b_refcount > 1) {
+			buf_unref(b);
+			break;
+		}
+		b->b_busy = true;
+		bufs[got] = b;
+	}
+	if (got == 0) {
+		return;
+	}
+
+	spinlock_release(&buf_lock);
+	result = buf_iorun(bufs, got, UIO_READ);
+	spinlock_acquire(&buf_lock);
+
+	for (i=0; i<got; i++) {
+		bufs[i]->b_busy = false;
+		if (result == 0) {
+			bufs[i]->b_valid = true;
+		}
+	}
+	wchan_wakeall(buf_wchan, &buf_lock);
+	for (i=0; i<got; i++) {
+		buf_unref(bufs[i]);
+	}
+	if (result == 0) {
+		buf_prefetched += got;
+		if (got > 1) {
+			buf_runios++;
+			buf_runblocks += got;
+		}
+	}
+}
+
+/*
+ * Readahead thread: do prefetch requests.
+ */
+static
+void
+buf_readahead(void *data1, unsigned long data2)
+{
+	struct bufprefetch req;
+
+	(void)data1;
+	(void)data2;
+
+	spinlock_acquire(&buf_lock);
+	while (1) {
+		while (buf_pfcount == 0) {
+			wchan_sleep(buf_pfwchan, &buf_lock);
+		}
+		req = buf_pfq[buf_pfhead];
+		buf_pfhead = (buf_pfhead + 1) % BUF_PREFETCHQ;
+		buf_pfcount--;
+
+		buf_pfdev = req.bp_dev;
+		buf_prefetchrun(req.bp_dev, req.bp_block, req.bp_num);
+		buf_pfdev = NULL;
+		wchan_wakeall(buf_wchan, &buf_lock);
+	}
+}
+
+/*
+ * Throw away queued prefetches for DEV and wait for any in progress
+ * to finish. The lock must be held.
+ */
+static
+void
+buf_prefetchcancel(struct device *dev)
+{
+	unsigned i, j, n;
+
+	KASSERT(spinlock_do_i_hold(&buf_lock));
+
+	n = buf_pfcount;
+	buf_pfcount = 0;
+	for (i=0; i<n; i++) {
+		j = (buf_pfhead + i) % BUF_PREFETCHQ;
+		if (buf_pfq[j].bp_dev == dev) {
+			continue;
+		}
+		buf_pfq[(buf_pfhead + buf_pfcount) % BUF_PREFETCHQ] =
+			buf_pfq[j];
+		buf_pfcount++;
+	}
+
+	while (buf_pfdev == dev) {
+		wchan_sleep(buf_wchan, &buf_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// syncing
+
+/*
+ * Check if B is a dirty buffer for block BLOCK of DEV that can be
+ * added to a write run.
+ */
+static
+bool
+buf_canwrite(struct buf *b, struct device *dev, daddr_t block)
+{
+	return b != NULL && b->b_dev == dev && b->b_block == block &&
+		b->b_dirty && !b->b_busy;
+}
+
+/*
+ * Write out the dirty buffer B, along with any dirty neighbors, in
+ * one transfer. B must be referenced and not busy. The lock is held
+ * and released during the write.
+ */
+static
+int
+buf_writecluster(struct buf *b)
+{
+	struct buf *run[BUF_MAXRUN];
+	struct device *dev = b->b_dev;
+	daddr_t start;
+	unsigned n, i;
+	int result;
+
+	/* Back up to the start of the run, keeping B in range */
+	start = b->b_block;
+	while (start > 0 && b->b_block - start < BUF_MAXRUN - 1 &&
+	       buf_canwrite(buf_lookup(dev, start - 1), dev, start - 1)) {
+		start--;
+	}
+
+	n = 0;
+	while (n < BUF_MAXRUN) {
+		run[n] = buf_lookup(dev, start + n);
+		if (!buf_canwrite(run[n], dev, start + n)) {
+			break;
+		}
+		if (run[n] != b) {
+			buf_ref(run[n]);
+		}
+		n++;
+	}
+	KASSERT(b->b_block >= start && b->b_block < start + n);
+
+	result = buf_writerun(run, n);
+
+	for (i=0; i<n; i++) {
+		if (run[i] != b) {
+			buf_unref(run[i]);
+		}
+	}
+	return result;
+}
+
+int
+buf_sync(struct device *dev)
+{
+	struct buf *b;
+	unsigned i;
+	int result, ret = 0;
+
+	spinlock_acquire(&buf_lock);
+	/* buf_num can grow while we're at it; that's fine. */
+	for (i=0; i<buf_num; i++) {
+		b = buf_all[i];
+		if (dev != NULL && b->b_dev != dev) {
+			continue;
+		}
+		/*
+		 * A busy buffer may be in the middle of being written
+		 * by someone else (e.g. the syncer), in which case it
+		 * already looks clean; wait for that to finish so we
+		 * don't return before the data is on disk.
+		 */
+		if (!b->b_dirty && !b->b_busy) {
+			continue;
+		}
+		buf_ref(b);
+		while (b->b_busy) {
+			wchan_sleep(buf_wchan, &buf_lock);
+		}
+		if (b->b_dirty) {
+			result = buf_writecluster(b);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+		buf_unref(b);
+	}
+	spinlock_release(&buf_lock);
+	return ret;
+}
+
+void
+buf_drop(struct device *dev)
+{
+	struct buf *b;
+	unsigned i;
+
+	spinlock_acquire(&buf_lock);
+	buf_prefetchcancel(dev);
+	for (i=0; i<buf_num; i++) {
+		b = buf_all[i];
+		/*
+		 * The syncer may still be holding the buffer for a
+		 * write; wait for it to let go. (Once it does, the
+		 * buffer may get reused for something else.)
+		 */
+		while (b->b_dev == dev && b->b_refcount > 0) {
+			wchan_sleep(buf_wchan, &buf_lock);
+		}
+		if (b->b_dev != dev) {
+			continue;
+		}
+		if (b->b_dirty) {
+			kprintf("buf: Discarding dirty block %u\n",
+				b->b_block);
+		}
+		buf_hashremove(b);
+		b->b_dev = NULL;
+		b->b_valid = false;
+		b->b_dirty = false;
+	}
+	spinlock_release(&buf_lock);
+}
+
+/*
+ * Syncer thread: write dirty buffers every so often, so they don't
+ * sit in memory indefinitely.
+ */
+static
+void
+buf_syncer(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		clocksleep(BUF_SYNCSECS);
+		buf_sync(NULL);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// setup and stats
+
+void
+buf_bootstrap(void)
+{
+	int result;
+
+	buf_max = mainbus_ramsize() / BUF_RAMFRACTION / BUF_BLOCKSIZE;
+	if (buf_max < BUF_MINBUFS) {
+		buf_max = BUF_MINBUFS;
+	}
+	buf_all = kmalloc(buf_max * sizeof(buf_all[0]));
+	buf_wchan = wchan_create("buf");
+	buf_pfwchan = wchan_create("readahead");
+	if (buf_all == NULL || buf_wchan == NULL || buf_pfwchan == NULL) {
+		panic("buf: Out of memory\n");
+	}
+	buf_num = 0;
+
+	result = thread_fork("syncer", NULL, buf_syncer, NULL, 0);
+	if (result) {
+		panic("buf: thread_fork: %s\n", strerror(result));
+	}
+	result = thread_fork("readahead", NULL, buf_readahead, NULL, 0);
+	if (result) {
+		panic("buf: thread_fork: %s\n", strerror(result));
+	}
+}
+
+void
+buf_printstats(void)
+{
+	unsigned hits, misses, writes, runios, runblocks, num, max;
+	unsigned prefetched, pfdropped;
+
+	spinlock_acquire(&buf_lock);
+	hits = buf_hits;
+	misses = buf_misses;
+	writes = buf_writes;
+	runios = buf_runios;
+	runblocks = buf_runblocks;
+	prefetched = buf_prefetched;
+	pfdropped = buf_pfdropped;
+	num = buf_num;
+	max = buf_max;
+	spinlock_release(&buf_lock);
+
+	kprintf("Buffer cache: %u of %u buffers in use\n", num, max);
+	kprintf("    %u hits, %u misses (%u%% hit rate), %u writes\n",
+		hits, misses,
+		hits + misses == 0 ? 0 : hits * 100 / (hits + misses),
+		writes);
+	kprintf("    %u multi-block transfers, %u blocks\n",
+		runios, runblocks);
+	kprintf("    %u blocks prefetched, %u prefetches dropped\n",
+		prefetched, pfdropped);
+}
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name cache. See dcache.h.
+ *
+ * Locking: the vfs biglock protects everything here. Lookups already
+ * hold it while they walk a path, so taking it again costs little.
+ *
+ * Entries live in a fixed array. All of them, used or not, are on
+ * the LRU list; unused ones are kept at the front so they're taken
+ * first. Used entries are also in the hash table.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+#include <dcache.h>
+
+/* Number of entries. */
+#define DCACHE_NENTRIES	256
+
+/* Size of the hash table; must be a power of 2. */
+#define DCACHE_NBUCKETS	64
+
+struct dcentry {
+	struct vnode *dc_dir;		/* directory, or NULL if unused */
+	struct vnode *dc_vn;		/* target, or NULL if negative */
+	char dc_name[DCACHE_NAMELEN+1];	/* name in dc_dir */
+	struct dcentry *dc_hashnext;	/* next in hash bucket */
+	struct dcentry *dc_lruprev;	/* LRU list */
+	struct dcentry *dc_lrunext;
+};
+
+static struct dcentry dcache_entries[DCACHE_NENTRIES];
+static struct dcentry *dcache_hash[DCACHE_NBUCKETS];
+static struct dcentry *dcache_lruhead;	/* least recently used */
+static struct dcentry *dcache_lrutail;	/* most recently used */
+
+/* Statistics */
+static unsigned dcache_hits;		/* found a vnode */
+static unsigned dcache_neghits;		/* found a negative entry */
+static unsigned dcache_misses;		/* had to ask the filesystem */
+static unsigned dcache_evictions;	/* entries recycled for others */
+
+////////////////////////////////////////////////////////////
+// lists
+
+static
+unsigned
+dcache_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h;
+
+	h = (uintptr_t)dir >> 4;
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h & (DCACHE_NBUCKETS - 1);
+}
+
+static
+struct dcentry *
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc;
+
+	for (dc = dcache_hash[dcache_hashfunc(dir, name)]; dc != NULL;
+	     dc = dc->dc_hashnext) {
+		if (dc->dc_dir == dir && !strcmp(dc->dc_name, name)) {
+			return dc;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+dcache_hashinsert(struct dcentry *dc)
+{
+	unsigned bucket;
+
+	bucket = dcache_hashfunc(dc->dc_dir, dc->dc_name);
+	dc->dc_hashnext = dcache_hash[bucket];
+	dcache_hash[bucket] = dc;
+}
+
+static
+void
+dcache_hashremove(struct dcentry *dc)
+{
+	struct dcentry **dcp;
+
+	for (dcp = &dcache_hash[dcache_hashfunc(dc->dc_dir, dc->dc_name)];
+	     *dcp != dc; dcp = &(*dcp)->dc_hashnext) {
+		KASSERT(*dcp != NULL);
+	}
+	*dcp = dc->dc_hashnext;
+	dc->dc_hashnext = NULL;
+}
+
+static
+void
+dcache_lruremove(struct dcentry *dc)
+{
+	if (dc->dc_lruprev != NULL) {
+		dc->dc_lruprev->dc_lrunext = dc->dc_lrunext;
+	}
+	else {
+		KASSERT(dcache_lruhead == dc);
+		dcache_lruhead = dc->dc_lrunext;
+	}
+	if (dc->dc_lrunext != NULL) {
+		dc->dc_lrunext->dc_lruprev = dc->dc_lruprev;
+	}
+	else {
+		KASSERT(dcache_lrutail == dc);
+		dcache_lrutail = dc->dc_lruprev;
+	}
+	dc->dc_lruprev = dc->dc_lrunext = NULL;
+}
+
+static
+void
+dcache_lruappend(struct dcentry *dc)
+{
+	dc->dc_lrunext = NULL;
+	dc->dc_lruprev = dcache_lrutail;
+	if (dcache_lrutail != NULL) {
+		dcache_lrutail->dc_lrunext = dc;
+	}
+	else {
+		dcache_lruhead = dc;
+	}
+	dcache_lrutail = dc;
+}
+
+static
+void
+dcache_lruprepend(struct dcentry *dc)
+{
+	dc->dc_lruprev = NULL;
+	dc->dc_lrunext = dcache_lruhead;
+	if (dcache_lruhead != NULL) {
+		dcache_lruhead->dc_lruprev = dc;
+	}
+	else {
+		dcache_lrutail = dc;
+	}
+	dcache_lruhead = dc;
+}
+
+/*
+ * Empty out an entry and move it to the front of the LRU list for
+ * reuse. Dropping the references may reclaim the vnodes, which must
+ * not come back into the name cache.
+ */
+static
+void
+dcache_release(struct dcentry *dc)
+{
+	struct vnode *dir, *vn;
+
+	KASSERT(dc->dc_dir != NULL);
+
+	dcache_hashremove(dc);
+	dcache_lruremove(dc);
+	dcache_lruprepend(dc);
+
+	dir = dc->dc_dir;
+	vn = dc->dc_vn;
+	dc->dc_dir = NULL;
+	dc->dc_vn = NULL;
+	dc->dc_name[0] = 0;
+
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	VOP_DECREF(dir);
+}
+
+/*
+ * Check if a name can go in the cache.
+ */
+static
+bool
+dcache_cacheable(struct vnode *dir, const char *name)
+{
+	if (dir->vn_fs == NULL) {
+		/* device */
+		return false;
+	}
+	if (strlen(name) > DCACHE_NAMELEN) {
+		return false;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// external interface
+
+void
+dcache_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<DCACHE_NENTRIES; i++) {
+		dcache_entries[i].dc_dir = NULL;
+		dcache_entries[i].dc_vn = NULL;
+		dcache_entries[i].dc_name[0] = 0;
+		dcache_entries[i].dc_hashnext = NULL;
+		dcache_lruappend(&dcache_entries[i]);
+	}
+}
+
+bool
+dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct dcentry *dc;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!dcache_cacheable(dir, name)) {
+		return false;
+	}
+
+	dc = dcache_find(dir, name);
+	if (dc == NULL) {
+		dcache_misses++;
+		return false;
+	}
+
+	/* Mark it most recently used */
+	dcache_lruremove(dc);
+	dcache_lruappend(dc);
+
+	if (dc->dc_vn == NULL) {
+		dcache_neghits++;
+	}
+	else {
+		dcache_hits++;
+		VOP_INCREF(dc->dc_vn);
+	}
+	*ret = dc->dc_vn;
+	return true;
+}
+
+void
+dcache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct dcentry *dc;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!dcache_cacheable(dir, name)) {
+		return;
+	}
+
+	/* Get the new references first, in case recycling drops the last */
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+
+	dc = dcache_find(dir, name);
+	if (dc == NULL) {
+		dc = dcache_lruhead;
+	}
+	if (dc->dc_dir != NULL) {
+		if (dc->dc_dir != dir || strcmp(dc->dc_name, name)) {
+			dcache_evictions++;
+		}
+		dcache_release(dc);
+	}
+
+	dc->dc_dir = dir;
+	dc->dc_vn = vn;
+	strcpy(dc->dc_name, name);
+	dcache_hashinsert(dc);
+	dcache_lruremove(dc);
+	dcache_lruappend(dc);
+}
+
+void
+dcache_purge(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!dcache_cacheable(dir, name)) {
+		return;
+	}
+
+	dc = dcache_find(dir, name);
+	if (dc != NULL) {
+		dcache_release(dc);
+	}
+}
+
+void
+dcache_purgefs(struct fs *fs)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<DCACHE_NENTRIES; i++) {
+		if (dcache_entries[i].dc_dir != NULL &&
+		    dcache_entries[i].dc_dir->vn_fs == fs) {
+			dcache_release(&dcache_entries[i]);
+		}
+	}
+}
+
+void
+dcache_printstats(void)
+{
+	unsigned hits, neghits, misses, evictions, num, i;
+
+	vfs_biglock_acquire();
+	hits = dcache_hits;
+	neghits = dcache_neghits;
+	misses = dcache_misses;
+	evictions = dcache_evictions;
+	num = 0;
+	for (i=0; i<DCACHE_NENTRIES; i++) {
+		if (dcache_entries[i].dc_dir != NULL) {
+			num++;
+		}
+	}
+	vfs_biglock_release();
+
+	kprintf("Name cache: %u of %u entries in use\n",
+		num, DCACHE_NENTRIES);
+	kprintf("    %u hits, %u negative hits, %u misses "
+		"(%u%% hit rate), %u evictions\n",
+		hits, neghits, misses,
+		hits + neghits + misses == 0 ? 0 :
+		(hits + neghits) * 100 / (hits + neghits + misses),
+		evictions);
+}
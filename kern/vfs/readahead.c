@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Read-ahead policy. See readahead.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <readahead.h>
+
+void
+readahead_init(struct readahead *ra, unsigned min, unsigned max)
+{
+	KASSERT(min > 0 && min <= max);
+
+	ra->ra_next = 0;
+	ra->ra_end = 0;
+	ra->ra_run = 0;
+	ra->ra_window = min;
+	ra->ra_min = min;
+	ra->ra_max = max;
+}
+
+enum ra_pattern
+readahead_access(struct readahead *ra, off_t start, off_t end)
+{
+	enum ra_pattern ret;
+
+	KASSERT(start <= end);
+
+	if (start != ra->ra_next) {
+		/* Broke the stream; start over. */
+		ra->ra_run = 0;
+		ra->ra_window = ra->ra_min;
+		ra->ra_end = 0;
+	}
+	ra->ra_run++;
+	ra->ra_next = end;
+
+	if (ra->ra_run < 2 && start != 0) {
+		/* One read isn't a pattern, unless it's at the start. */
+		return RA_RANDOM;
+	}
+	ret = start < ra->ra_end ? RA_READAHEAD : RA_SEQUENTIAL;
+	if (end > ra->ra_end) {
+		/* Read past the read-ahead; it starts from here */
+		ra->ra_end = end;
+	}
+	return ret;
+}
+
+void
+readahead_adjust(struct readahead *ra, bool hit)
+{
+	if (hit) {
+		ra->ra_window *= 2;
+		if (ra->ra_window > ra->ra_max) {
+			ra->ra_window = ra->ra_max;
+		}
+	}
+	else {
+		ra->ra_window /= 2;
+		if (ra->ra_window < ra->ra_min) {
+			ra->ra_window = ra->ra_min;
+		}
+	}
+}
+
+bool
+readahead_next(struct readahead *ra, off_t pos, off_t *start, off_t *end)
+{
+	KASSERT(pos <= ra->ra_end);
+
+	if (ra->ra_end - pos > ra->ra_window / 2) {
+		/* Still plenty left. */
+		return false;
+	}
+	*start = ra->ra_end;
+	*end = pos + ra->ra_window;
+	if (*end <= *start) {
+		return false;
+	}
+	ra->ra_end = *end;
+	return true;
+}
@@ -43,6 +43,10 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <buf.h>
+#include <dcache.h>
+#include <sfs.h>
+#include "opt-sfs.h"
 
 /*
  * Structure for a single named device.
@@ -114,6 +118,11 @@ vfs_bootstrap(void)
 
 	devnull_create();
 	semfs_bootstrap();
+	buf_bootstrap();
+	dcache_bootstrap();
+#if OPT_SFS
+	sfs_bootstrap();
+#endif
 }
 
 /*
@@ -654,6 +663,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* drop the name cache's references to its vnodes */
+	dcache_purgefs(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -745,6 +757,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		dcache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -39,6 +39,7 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 static struct vnode *bootfs_vnode = NULL;
 
@@ -234,16 +235,121 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up a single path component NAME in DIR, going through the
+ * name cache. Hands back a new reference.
+ */
+static
+int
+lookup_component(struct vnode *dir, char *name, struct vnode **ret)
+{
+	struct vnode *vn;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (dcache_lookup(dir, name, &vn)) {
+		if (vn == NULL) {
+			return ENOENT;
+		}
+		*ret = vn;
+		return 0;
+	}
+
+	result = VOP_LOOKUP(dir, name, &vn);
+	if (result == ENOENT) {
+		dcache_enter(dir, name, NULL);
+		return result;
+	}
+	if (result) {
+		return result;
+	}
+
+	dcache_enter(dir, name, vn);
+	*ret = vn;
+	return 0;
+}
+
+/*
+ * Walk PATH one component at a time starting from STARTVN, so each
+ * step can be answered from the name cache. Repeated and trailing
+ * slashes are ignored. If LASTRET is not NULL, stop before the last
+ * component and hand it back there (as a pointer into PATH), with
+ * the directory it's in in *RET; if there's no last component, fail
+ * with EINVAL.
+ *
+ * Does not consume the reference to STARTVN.
+ */
+static
+int
+lookup_walk(struct vnode *startvn, char *path, struct vnode **ret,
+	    char **lastret)
+{
+	struct vnode *dir, *vn;
+	char *name, *s;
+	int result;
+
+	VOP_INCREF(startvn);
+	dir = startvn;
+
+	while (1) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == 0) {
+			break;
+		}
+
+		name = path;
+		s = strchr(path, '/');
+		if (s != NULL) {
+			*s = 0;
+			path = s+1;
+			while (*path == '/') {
+				path++;
+			}
+		}
+		else {
+			path = name + strlen(name);
+		}
+
+		if (lastret != NULL && *path == 0) {
+			*lastret = name;
+			*ret = dir;
+			return 0;
+		}
+
+		result = lookup_component(dir, name, &vn);
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+		dir = vn;
+	}
+
+	if (lastret != NULL) {
+		VOP_DECREF(dir);
+		return EINVAL;
+	}
+	*ret = dir;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * The directory part of the path is walked here, through the name
+ * cache; the filesystem's VOP_LOOKUP only ever sees one component,
+ * and VOP_LOOKPARENT only the last one.
  */
 
 int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *name;
 	int result;
 
 	vfs_biglock_acquire();
@@ -263,7 +369,12 @@ vfs_lookparent(char *path, struct vnode **retval,
 		result = EINVAL;
 	}
 	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		result = lookup_walk(startvn, path, &dir, &name);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(dir, name, retval,
+						buf, buflen);
+			VOP_DECREF(dir);
+		}
 	}
 
 	VOP_DECREF(startvn);
@@ -292,7 +403,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = lookup_walk(startvn, path, retval, NULL);
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
@@ -29,6 +29,11 @@
 
 /*
  * High-level VFS operations on pathnames.
+ *
+ * Operations that add, remove, or rename names purge the affected
+ * names from the name cache. They hold the vfs biglock across the
+ * operation and the purge, so a lookup can't put a stale entry back
+ * in between.
  */
 
 #include <types.h>
@@ -38,6 +43,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 
 /* Does most of the work for open(). */
@@ -73,7 +79,10 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
+		vfs_biglock_acquire();
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		dcache_purge(dir, name);
+		vfs_biglock_release();
 
 		VOP_DECREF(dir);
 	}
@@ -145,7 +154,10 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_REMOVE(dir, name);
+	dcache_purge(dir, name);
+	vfs_biglock_release();
 	VOP_DECREF(dir);
 
 	return result;
@@ -178,7 +190,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	dcache_purge(olddir, oldname);
+	dcache_purge(newdir, newname);
+	vfs_biglock_release();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -212,7 +228,10 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_LINK(newdir, newname, oldfile);
+	dcache_purge(newdir, newname);
+	vfs_biglock_release();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -239,7 +258,10 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_SYMLINK(newdir, newname, contents);
+	dcache_purge(newdir, newname);
+	vfs_biglock_release();
 	VOP_DECREF(newdir);
 
 	return result;
@@ -285,7 +307,10 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_MKDIR(parent, name, mode);
+	dcache_purge(parent, name);
+	vfs_biglock_release();
 
 	VOP_DECREF(parent);
 
@@ -307,7 +332,18 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	/*
+	 * Name cache entries for names inside the directory hold
+	 * references to it, which would keep it from being reclaimed.
+	 * Entries aren't indexed by directory, so just purge the whole
+	 * filesystem; rmdir is rare.
+	 */
+	vfs_biglock_acquire();
+	if (parent->vn_fs != NULL) {
+		dcache_purgefs(parent->vn_fs);
+	}
 	result = VOP_RMDIR(parent, name);
+	vfs_biglock_release();
 
 	VOP_DECREF(parent);
 
@@ -27,11 +27,14 @@
  * SUCH DAMAGE.
  */
 
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <kmem_cache.h>
+#include <pagetable.h>
 #include <proc.h>
 
 /*
@@ -40,38 +43,114 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/* Initial size of the stack region; it grows from there. */
+#define VM_INITSTACKPAGES 1
+
+static struct kmem_cache *as_cache;
+
+/*
+ * Set up the object cache for address spaces. Called from
+ * vm_bootstrap.
+ */
+void
+as_bootstrap(void)
+{
+	as_cache = kmem_cache_create("addrspace", sizeof(struct addrspace),
+				     NULL, NULL);
+	if (as_cache == NULL) {
+		panic("as_bootstrap: Out of memory\n");
+	}
+}
+
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
+	unsigned i;
 
-	as = kmalloc(sizeof(struct addrspace));
+	as = kmem_cache_alloc(as_cache);
 	if (as == NULL) {
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kmem_cache_free(as_cache, as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_stack = NULL;
+	as->as_loading = false;
+	for (i=0; i<VM_MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
 
 	return as;
 }
 
+/*
+ * Add a region to an address space. Returns the region, or NULL if
+ * out of memory.
+ */
+static
+struct region *
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages,
+	     bool readable, bool writeable, bool executable)
+{
+	struct region *rg;
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return NULL;
+	}
+	rg->rg_base = base;
+	rg->rg_npages = npages;
+	rg->rg_readable = readable;
+	rg->rg_writeable = writeable;
+	rg->rg_executable = executable;
+
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+	return rg;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		newrg = as_addregion(newas, rg->rg_base, rg->rg_npages,
+				     rg->rg_readable, rg->rg_writeable,
+				     rg->rg_executable);
+		if (newrg == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		if (rg == old->as_stack) {
+			newas->as_stack = newrg;
+		}
+	}
+
+	result = pt_copy(old->as_pt, newas->as_pt);
+
 	/*
-	 * Write this.
+	 * OLD's pages may now be shared, so drop any writeable TLB
+	 * entries for them. OLD is the current address space.
 	 */
+	vm_tlbflush_as(old);
 
-	(void)old;
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
@@ -80,11 +159,15 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
 
-	kfree(as);
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		kfree(rg);
+	}
+	pt_destroy(as->as_pt);
+	kmem_cache_free(as_cache, as);
 }
 
 void
@@ -101,78 +184,123 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	vm_tlbactivate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do; TLB entries are tagged with their address
+	 * space, so they can stay until the next as_activate.
 	 */
 }
 
+/*
+ * Return true if the pages [VADDR, VADDR+NPAGES*PAGE_SIZE) overlap
+ * any region of AS other than SKIP.
+ */
+static
+bool
+as_overlaps(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	    struct region *skip)
+{
+	struct region *rg;
+	vaddr_t end, rgend;
+
+	end = vaddr + npages * PAGE_SIZE;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg == skip) {
+			continue;
+		}
+		rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		if (vaddr < rgend && rg->rg_base < end) {
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Only
+ * writeability is enforced, as the MIPS TLB has no way to deny reads
+ * or execution of a page that can be read at all.
+ *
+ * No memory is allocated here; pages come into being when touched.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	npages = memsize / PAGE_SIZE;
+	if (npages == 0 || vaddr >= USERSPACETOP ||
+	    npages > (USERSPACETOP - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+	if (as_overlaps(as, vaddr, npages, NULL)) {
+		return EINVAL;
+	}
+
+	if (as_addregion(as, vaddr, npages, readable != 0, writeable != 0,
+			 executable != 0) == NULL) {
+		return ENOMEM;
+	}
+	return 0;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Let the loader write into read-only regions. Nothing needs
+	 * to be allocated; the pages are made as the loader touches
+	 * them.
 	 */
-
-	(void)as;
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	as->as_loading = false;
 
-	(void)as;
+	/* Drop any writeable mappings of read-only pages. */
+	vm_tlbflush_as(as);
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	vaddr_t base;
 
-	(void)as;
+	KASSERT(as->as_stack == NULL);
+
+	base = USERSTACK - VM_INITSTACKPAGES * PAGE_SIZE;
+	if (as_overlaps(as, base, VM_INITSTACKPAGES, NULL)) {
+		return EINVAL;
+	}
+
+	as->as_stack = as_addregion(as, base, VM_INITSTACKPAGES,
+				    true, true, false);
+	if (as->as_stack == NULL) {
+		return ENOMEM;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +308,35 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	size_t npages;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_base &&
+		    vaddr - rg->rg_base < rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+
+	/*
+	 * Not in any region. If it's below the stack, within the
+	 * stack size limit, and doesn't run into anything else, grow
+	 * the stack down to cover it.
+	 */
+	rg = as->as_stack;
+	if (rg == NULL || vaddr >= rg->rg_base ||
+	    vaddr < USERSTACK - VM_STACKPAGES * PAGE_SIZE) {
+		return NULL;
+	}
+	vaddr &= PAGE_FRAME;
+	npages = (rg->rg_base - vaddr) / PAGE_SIZE;
+	if (as_overlaps(as, vaddr, npages, rg)) {
+		return NULL;
+	}
+	rg->rg_base = vaddr;
+	rg->rg_npages += npages;
+	return rg;
+}
@@ -0,0 +1,848 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Physical page allocator (the coremap). See coremap.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <current.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+
+/*
+ * The largest free block is 2^CM_MAXORDER pages (4M). Bigger blocks
+ * wouldn't buy anything; nothing allocates that much at once.
+ */
+#define CM_MAXORDER 10
+#define CM_NORDERS (CM_MAXORDER + 1)
+
+/*
+ * Page number used as a null link. Page 0 holds the exception
+ * handlers, so it's never free and never allocated.
+ */
+#define CM_NONE 0
+
+/* cme_order for pages that aren't the first page of a free block */
+#define CM_NOORDER 0xff
+
+/* Page states */
+#define CME_FIXED   0	/* kernel image, coremap, or stolen at boot */
+#define CME_FREE    1	/* free, in a block on the buddy lists */
+#define CME_CACHED  2	/* free, in a per-cpu cache */
+#define CME_INUSE   3	/* allocated */
+
+struct coremap_entry {
+	unsigned cme_next;	/* free list / cache link */
+	unsigned cme_prev;	/* free list back link */
+	unsigned cme_npages;	/* on first page of allocation: its size */
+	uint16_t cme_refcount;	/* on first page of allocation: users */
+	uint8_t cme_state;	/* CME_* */
+	uint8_t cme_order;	/* on first page of free block: its order */
+
+	/* For user pages that may be paged out; see coremap_setowner. */
+	struct addrspace *cme_as;	/* owner, or NULL if none */
+	vaddr_t cme_vaddr;		/* where it's mapped in cme_as */
+	bool cme_pinned;		/* chosen for eviction */
+	bool cme_referenced;		/* used since the clock last came by */
+};
+
+static struct coremap_entry *coremap;	/* NULL until bootstrapped */
+static unsigned cm_npages;		/* number of coremap entries */
+static unsigned cm_nfree;		/* pages on the buddy lists */
+static unsigned cm_freelists[CM_NORDERS]; /* free blocks of each order */
+static unsigned cm_clockhand;		/* next page for the clock to look at */
+static struct wchan *cm_pinwchan;	/* waiting for pages to be unpinned */
+
+/*
+ * One lock for the buddy lists and the entries of pages not owned by
+ * anyone else. Single pages are mostly handled by the per-cpu caches
+ * below, which come here only in batches.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Per-cpu caches of free single pages. A cache holds at most
+ * CM_CACHESIZE pages; when it runs out or overflows, CM_CACHEBATCH
+ * pages are moved to or from the buddy lists at a time. Cached pages
+ * are linked through cme_next.
+ */
+#define CM_CACHESIZE 32
+#define CM_CACHEBATCH 8
+
+struct coremap_cpucache {
+	struct spinlock cc_lock;
+	unsigned cc_pages;		/* first cached page */
+	unsigned cc_count;		/* number of cached pages */
+	struct coremap_cpucache *cc_next; /* next on cmcaches list */
+};
+
+/*
+ * List of all the per-cpu caches. As with kmalloc's magazines,
+ * entries are added under coremap_lock and never removed, so it can be
+ * walked without the lock once the head has been read.
+ */
+static struct coremap_cpucache *cmcaches;
+
+////////////////////////////////////////////////////////////
+// buddy lists
+
+/*
+ * Put the free block of 2^ORDER pages at PAGE on its free list.
+ */
+static
+void
+cm_link(unsigned page, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(order <= CM_MAXORDER);
+	KASSERT(page % (1U << order) == 0);
+
+	cme->cme_state = CME_FREE;
+	cme->cme_order = order;
+	cme->cme_prev = CM_NONE;
+	cme->cme_next = cm_freelists[order];
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = page;
+	}
+	cm_freelists[order] = page;
+}
+
+/*
+ * Take the free block at PAGE off its free list.
+ */
+static
+void
+cm_unlink(unsigned page)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(cme->cme_state == CME_FREE);
+	KASSERT(cme->cme_order <= CM_MAXORDER);
+
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		KASSERT(cm_freelists[cme->cme_order] == page);
+		cm_freelists[cme->cme_order] = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cme->cme_next = cme->cme_prev = CM_NONE;
+	cme->cme_order = CM_NOORDER;
+}
+
+/*
+ * Add the free block of 2^ORDER pages at PAGE to the lists, merging
+ * it with its buddy for as long as the buddy is free too.
+ */
+static
+void
+cm_freeblock(unsigned page, unsigned order)
+{
+	unsigned buddy;
+
+	while (order < CM_MAXORDER) {
+		buddy = page ^ (1U << order);
+		if (buddy >= cm_npages ||
+		    coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		cm_unlink(buddy);
+		page &= ~(1U << order);
+		order++;
+	}
+	cm_link(page, order);
+}
+
+/*
+ * Free the NPAGES pages starting at PAGE, which need not be a power
+ * of two, by splitting them into the largest aligned blocks possible.
+ */
+static
+void
+cm_freerange(unsigned page, unsigned npages)
+{
+	unsigned end, order, i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	end = page + npages;
+	KASSERT(end <= cm_npages);
+
+	for (i=page; i<end; i++) {
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_order = CM_NOORDER;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_pinned = false;
+		coremap[i].cme_referenced = false;
+	}
+	cm_nfree += npages;
+
+	while (page < end) {
+		order = 0;
+		while (order < CM_MAXORDER &&
+		       page % (2U << order) == 0 &&
+		       page + (2U << order) <= end) {
+			order++;
+		}
+		cm_freeblock(page, order);
+		page += 1U << order;
+	}
+}
+
+/*
+ * Allocate NPAGES contiguous pages from the lists. Returns the first
+ * page number, or CM_NONE if there's no block big enough.
+ */
+static
+unsigned
+cm_allocrange(unsigned npages)
+{
+	unsigned order, k, page, i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(npages > 0);
+
+	order = 0;
+	while ((1U << order) < npages) {
+		order++;
+	}
+	if (order > CM_MAXORDER) {
+		return CM_NONE;
+	}
+
+	/* Find the smallest block that will do. */
+	for (k = order; k <= CM_MAXORDER; k++) {
+		if (cm_freelists[k] != CM_NONE) {
+			break;
+		}
+	}
+	if (k > CM_MAXORDER) {
+		return CM_NONE;
+	}
+	page = cm_freelists[k];
+	cm_unlink(page);
+
+	/* Split it down to size, putting the upper halves back. */
+	while (k > order) {
+		k--;
+		cm_link(page + (1U << k), k);
+	}
+
+	KASSERT(cm_nfree >= (1U << order));
+	cm_nfree -= 1U << order;
+
+	for (i=0; i<npages; i++) {
+		KASSERT(coremap[page + i].cme_state == CME_FREE);
+		coremap[page + i].cme_state = CME_INUSE;
+	}
+	coremap[page].cme_npages = npages;
+	coremap[page].cme_refcount = 1;
+
+	/* Give back the part we didn't need. */
+	if (npages < (1U << order)) {
+		cm_freerange(page + npages, (1U << order) - npages);
+	}
+
+	return page;
+}
+
+////////////////////////////////////////////////////////////
+// per-cpu caches
+
+/*
+ * Set up the page cache for cpu C. Called from cpu_create.
+ */
+void
+coremap_cpucache_init(struct cpu *c)
+{
+	struct coremap_cpucache *cc;
+
+	cc = kmalloc(sizeof(*cc));
+	if (cc == NULL) {
+		/* Not fatal; this cpu will just always use the lists. */
+		kprintf("coremap: cpu%u: no memory for page cache\n",
+			c->c_number);
+		return;
+	}
+
+	spinlock_init(&cc->cc_lock);
+	cc->cc_pages = CM_NONE;
+	cc->cc_count = 0;
+
+	spinlock_acquire(&coremap_lock);
+	cc->cc_next = cmcaches;
+	cmcaches = cc;
+	spinlock_release(&coremap_lock);
+
+	c->c_cmcache = cc;
+}
+
+/*
+ * Get the current cpu's page cache, if it has one. As with kmalloc,
+ * if we migrate right after looking we'll just use another cpu's
+ * cache once.
+ */
+static
+struct coremap_cpucache *
+cm_mine(void)
+{
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	return curcpu->c_cmcache;
+}
+
+/*
+ * Move up to N pages from cache CC back to the buddy lists. Returns
+ * the number moved.
+ */
+static
+unsigned
+cm_spill(struct coremap_cpucache *cc, unsigned n)
+{
+	unsigned page, moved;
+
+	KASSERT(spinlock_do_i_hold(&cc->cc_lock));
+
+	spinlock_acquire(&coremap_lock);
+	for (moved = 0; moved < n && cc->cc_count > 0; moved++) {
+		page = cc->cc_pages;
+		KASSERT(coremap[page].cme_state == CME_CACHED);
+		cc->cc_pages = coremap[page].cme_next;
+		cc->cc_count--;
+		cm_freerange(page, 1);
+	}
+	spinlock_release(&coremap_lock);
+	return moved;
+}
+
+/*
+ * Get one page from cache CC, refilling it from the lists if it's
+ * empty. Returns CM_NONE if there's nothing to be had.
+ */
+static
+unsigned
+cm_cache_get(struct coremap_cpucache *cc)
+{
+	unsigned page, i;
+
+	spinlock_acquire(&cc->cc_lock);
+	if (cc->cc_count == 0) {
+		spinlock_acquire(&coremap_lock);
+		for (i=0; i<CM_CACHEBATCH; i++) {
+			page = cm_allocrange(1);
+			if (page == CM_NONE) {
+				break;
+			}
+			coremap[page].cme_state = CME_CACHED;
+			coremap[page].cme_npages = 0;
+			coremap[page].cme_next = cc->cc_pages;
+			cc->cc_pages = page;
+			cc->cc_count++;
+		}
+		spinlock_release(&coremap_lock);
+	}
+
+	page = cc->cc_pages;
+	if (page != CM_NONE) {
+		KASSERT(coremap[page].cme_state == CME_CACHED);
+		cc->cc_pages = coremap[page].cme_next;
+		cc->cc_count--;
+		coremap[page].cme_next = CM_NONE;
+		coremap[page].cme_state = CME_INUSE;
+		coremap[page].cme_npages = 1;
+		coremap[page].cme_refcount = 1;
+	}
+	spinlock_release(&cc->cc_lock);
+
+	return page;
+}
+
+/*
+ * Put the single page PAGE in cache CC, spilling some pages to the
+ * lists first if it's full.
+ */
+static
+void
+cm_cache_put(struct coremap_cpucache *cc, unsigned page)
+{
+	spinlock_acquire(&cc->cc_lock);
+	if (cc->cc_count >= CM_CACHESIZE) {
+		cm_spill(cc, CM_CACHEBATCH);
+	}
+	coremap[page].cme_state = CME_CACHED;
+	coremap[page].cme_npages = 0;
+	coremap[page].cme_next = cc->cc_pages;
+	cc->cc_pages = page;
+	cc->cc_count++;
+	spinlock_release(&cc->cc_lock);
+}
+
+/*
+ * Empty every cpu's cache back onto the lists, so the pages can be
+ * merged into bigger blocks. Returns the number of pages freed up.
+ */
+static
+unsigned
+cm_reclaim(void)
+{
+	struct coremap_cpucache *cc;
+	unsigned total;
+
+	spinlock_acquire(&coremap_lock);
+	cc = cmcaches;
+	spinlock_release(&coremap_lock);
+
+	total = 0;
+	for (; cc != NULL; cc = cc->cc_next) {
+		spinlock_acquire(&cc->cc_lock);
+		total += cm_spill(cc, cc->cc_count);
+		spinlock_release(&cc->cc_lock);
+	}
+	return total;
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+/*
+ * Take over physical memory from ram.c. The coremap itself is stolen
+ * from the bottom of free memory.
+ */
+void
+coremap_bootstrap(void)
+{
+	struct coremap_entry *entries;
+	paddr_t pa, firstfree, lastpaddr;
+	unsigned i, npages;
+
+	KASSERT(coremap == NULL);
+
+	cm_pinwchan = wchan_create("coremap");
+	if (cm_pinwchan == NULL) {
+		panic("coremap: wchan_create failed\n");
+	}
+
+	/* This must come first; ram_getfirstfree resets it. */
+	lastpaddr = ram_getsize();
+	npages = lastpaddr / PAGE_SIZE;
+
+	pa = ram_stealmem(DIVROUNDUP(npages * sizeof(*entries), PAGE_SIZE));
+	if (pa == 0) {
+		panic("coremap: No memory for the coremap\n");
+	}
+	entries = (struct coremap_entry *)PADDR_TO_KVADDR(pa);
+
+	firstfree = ram_getfirstfree();
+	KASSERT(firstfree % PAGE_SIZE == 0);
+	KASSERT(firstfree > 0 && firstfree <= lastpaddr);
+
+	for (i=0; i<npages; i++) {
+		entries[i].cme_next = CM_NONE;
+		entries[i].cme_prev = CM_NONE;
+		entries[i].cme_npages = 0;
+		entries[i].cme_refcount = 0;
+		entries[i].cme_as = NULL;
+		entries[i].cme_vaddr = 0;
+		entries[i].cme_pinned = false;
+		entries[i].cme_referenced = false;
+		entries[i].cme_state = CME_FIXED;
+		entries[i].cme_order = CM_NOORDER;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<CM_NORDERS; i++) {
+		cm_freelists[i] = CM_NONE;
+	}
+	cm_npages = npages;
+	cm_nfree = 0;
+	cm_clockhand = firstfree / PAGE_SIZE;
+	coremap = entries;
+	cm_freerange(firstfree / PAGE_SIZE, npages - firstfree / PAGE_SIZE);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Allocate NPAGES contiguous pages, from this cpu's cache if it's a
+ * single page. Returns CM_NONE on failure.
+ */
+static
+unsigned
+cm_tryalloc(unsigned npages)
+{
+	struct coremap_cpucache *cc;
+	unsigned page;
+
+	if (npages == 1 && (cc = cm_mine()) != NULL) {
+		return cm_cache_get(cc);
+	}
+
+	spinlock_acquire(&coremap_lock);
+	page = cm_allocrange(npages);
+	spinlock_release(&coremap_lock);
+	return page;
+}
+
+paddr_t
+coremap_alloc(unsigned npages)
+{
+	paddr_t pa;
+	unsigned page;
+
+	KASSERT(npages > 0);
+
+	if (coremap == NULL) {
+		/* Too early; steal it. */
+		spinlock_acquire(&coremap_lock);
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	page = cm_tryalloc(npages);
+	if (page == CM_NONE && curcpu->c_spinlocks == 0 &&
+	    thread_reclaim() > 0) {
+		/*
+		 * Exited threads' cached stacks may have given some
+		 * pages back. (Freeing them needs kfree, so don't try
+		 * if the caller might hold a heap lock.)
+		 */
+		page = cm_tryalloc(npages);
+	}
+	if (page == CM_NONE && cm_reclaim() > 0) {
+		/*
+		 * The pages we need may have been sitting in other
+		 * cpus' caches, or kept from merging by them.
+		 */
+		page = cm_tryalloc(npages);
+	}
+	if (page == CM_NONE) {
+		return 0;
+	}
+	return (paddr_t)page * PAGE_SIZE;
+}
+
+void
+coremap_free(paddr_t pa)
+{
+	struct coremap_cpucache *cc;
+	unsigned page, npages;
+
+	KASSERT(pa % PAGE_SIZE == 0);
+
+	if (coremap == NULL) {
+		/* Stolen memory can't be given back. */
+		return;
+	}
+
+	page = pa / PAGE_SIZE;
+	KASSERT(page < cm_npages);
+
+	/*
+	 * Since the caller owns these pages, nobody else will touch
+	 * their entries; we can look without the lock.
+	 */
+	if (coremap[page].cme_state == CME_FIXED) {
+		/* Stolen before we took over; leak it as before. */
+		return;
+	}
+	npages = coremap[page].cme_npages;
+	if (coremap[page].cme_state != CME_INUSE || npages == 0) {
+		panic("coremap_free: 0x%lx is not an allocated block\n",
+		      (unsigned long)pa);
+	}
+	KASSERT(coremap[page].cme_refcount > 0);
+
+	/*
+	 * A page with an owner might be in the middle of being paged
+	 * out; if so, wait for that to finish (or give up).
+	 */
+	if (coremap[page].cme_as != NULL) {
+		spinlock_acquire(&coremap_lock);
+		while (coremap[page].cme_pinned) {
+			wchan_sleep(cm_pinwchan, &coremap_lock);
+		}
+		coremap[page].cme_as = NULL;
+		spinlock_release(&coremap_lock);
+	}
+
+	/*
+	 * If the page is shared, just drop our reference. (If the
+	 * count is 1 we're the only user, so nobody can be adding a
+	 * reference behind our back and we needn't lock to look.)
+	 */
+	if (coremap[page].cme_refcount > 1) {
+		spinlock_acquire(&coremap_lock);
+		coremap[page].cme_refcount--;
+		if (coremap[page].cme_refcount > 0) {
+			spinlock_release(&coremap_lock);
+			return;
+		}
+		spinlock_release(&coremap_lock);
+	}
+
+	if (npages == 1 && (cc = cm_mine()) != NULL) {
+		cm_cache_put(cc, page);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	cm_freerange(page, npages);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a reference to the page at PA, which must be a single allocated
+ * page the caller already holds a reference to.
+ */
+void
+coremap_addref(paddr_t pa)
+{
+	unsigned page;
+
+	KASSERT(coremap != NULL);
+	KASSERT(pa % PAGE_SIZE == 0);
+
+	page = pa / PAGE_SIZE;
+	KASSERT(page < cm_npages);
+	KASSERT(coremap[page].cme_state == CME_INUSE);
+	KASSERT(coremap[page].cme_npages == 1);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[page].cme_refcount > 0);
+	if (coremap[page].cme_refcount == 0xffff) {
+		panic("coremap: too many references to page 0x%lx\n",
+		      (unsigned long)pa);
+	}
+	coremap[page].cme_refcount++;
+	/* Shared pages aren't paged out; see coremap_pickvictim. */
+	coremap[page].cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of references to the page at PA. If the caller
+ * holds the only one, the answer can't change until it lets go.
+ */
+unsigned
+coremap_refcount(paddr_t pa)
+{
+	unsigned page;
+
+	KASSERT(coremap != NULL);
+
+	page = pa / PAGE_SIZE;
+	KASSERT(page < cm_npages);
+	KASSERT(coremap[page].cme_state == CME_INUSE);
+
+	return coremap[page].cme_refcount;
+}
+
+////////////////////////////////////////////////////////////
+// paging support
+
+/*
+ * Record that the single user page at PA is mapped at VADDR in AS and
+ * nowhere else, which makes it a candidate for paging out. With AS
+ * NULL, it isn't any more. Only the owner, or whoever has the page
+ * pinned, should call this.
+ */
+void
+coremap_setowner(paddr_t pa, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(coremap != NULL);
+	KASSERT(pa / PAGE_SIZE < cm_npages);
+
+	cme = &coremap[pa / PAGE_SIZE];
+	KASSERT(cme->cme_state == CME_INUSE);
+	KASSERT(cme->cme_npages == 1);
+
+	if (cme->cme_as == as && cme->cme_vaddr == vaddr) {
+		/* Nothing to do; avoid the lock on the fault path. */
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(as == NULL || cme->cme_refcount == 1);
+	cme->cme_as = as;
+	cme->cme_vaddr = vaddr;
+	cme->cme_referenced = true;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Note that the page at PA has been used, for the clock. No lock;
+ * a lost update just costs a page another trip around the clock.
+ */
+void
+coremap_touch(paddr_t pa)
+{
+	KASSERT(coremap != NULL);
+	KASSERT(pa / PAGE_SIZE < cm_npages);
+
+	coremap[pa / PAGE_SIZE].cme_referenced = true;
+}
+
+/*
+ * Choose a page to page out, using the clock (second-chance)
+ * algorithm over the pages that have an owner. The page is pinned and
+ * its owner handed back through AS and VADDR; the caller must unpin
+ * it with coremap_unpin whether or not it manages to page it out.
+ * Returns 0 if there's nothing that can be paged out.
+ */
+paddr_t
+coremap_pickvictim(struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+	unsigned i, page;
+
+	KASSERT(coremap != NULL);
+
+	spinlock_acquire(&coremap_lock);
+	/* Twice around is enough to get past all the second chances. */
+	for (i=0; i < 2 * cm_npages; i++) {
+		page = cm_clockhand;
+		cm_clockhand = (cm_clockhand + 1) % cm_npages;
+
+		cme = &coremap[page];
+		if (cme->cme_state != CME_INUSE || cme->cme_as == NULL ||
+		    cme->cme_pinned || cme->cme_refcount != 1) {
+			continue;
+		}
+		if (cme->cme_referenced) {
+			cme->cme_referenced = false;
+			continue;
+		}
+
+		cme->cme_pinned = true;
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)page * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+/*
+ * Unpin a page pinned by coremap_pickvictim.
+ */
+void
+coremap_unpin(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(coremap != NULL);
+	KASSERT(pa / PAGE_SIZE < cm_npages);
+
+	cme = &coremap[pa / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_pinned);
+	cme->cme_pinned = false;
+	wchan_wakeall(cm_pinwchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of free pages. This is called on every page
+ * allocation, so it doesn't lock anything; the answer is only a
+ * rough snapshot, which is all that deciding whether to page things
+ * out needs.
+ */
+unsigned
+coremap_freepages(void)
+{
+	struct coremap_cpucache *cc;
+	unsigned nfree;
+
+	if (coremap == NULL) {
+		return 0;
+	}
+
+	nfree = cm_nfree;
+	for (cc = cmcaches; cc != NULL; cc = cc->cc_next) {
+		nfree += cc->cc_count;
+	}
+	return nfree;
+}
+
+/*
+ * Pages sitting in the per-cpu caches are free, so don't count them.
+ * Hold all the cache locks while looking, so pages moving between the
+ * caches and the lists aren't counted twice or not at all.
+ */
+unsigned
+int
+coremap_used_bytes(void)
+{
+	struct coremap_cpucache *cc, *caches;
+	unsigned nfree;
+
+	if (coremap == NULL) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	caches = cmcaches;
+	spinlock_release(&coremap_lock);
+
+	nfree = 0;
+	for (cc = caches; cc != NULL; cc = cc->cc_next) {
+		spinlock_acquire(&cc->cc_lock);
+		nfree += cc->cc_count;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	nfree += cm_nfree;
+	spinlock_release(&coremap_lock);
+
+	for (cc = caches; cc != NULL; cc = cc->cc_next) {
+		spinlock_release(&cc->cc_lock);
+	}
+
+	return (cm_npages - nfree) * PAGE_SIZE;
+}
@@ -29,8 +29,11 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
+#include <current.h>
 #include <vm.h>
+#include <kmem_cache.h>
 #include <kern/test161.h>
 #include <test.h>
 
@@ -78,7 +81,9 @@ fill_deadbeef(void *vptr, size_t len)
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    make that work, but it would be painful.) A table indexed by
+//    physical page number leads from a block straight to the entry
+//    for its page, so kfree doesn't have to search for it.
 //
 
 ////////////////////////////////////////
@@ -147,7 +152,9 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
+	struct pageref *prev_samesize;
 	struct pageref *next_all;
+	struct pageref *prev_all;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -162,22 +169,29 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole page pool. Most allocations and
+ * frees never get here, though; they are satisfied from the per-cpu
+ * magazines (see below), which only come to the global pool in
+ * batches.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Number of blocks of each size a per-cpu magazine can hold.
+ */
+#define KMC_MAGSIZE 16
+
+static unsigned kmc_reclaim(void);
+
 ////////////////////////////////////////
 
 /*
  * We can only allocate whole pages of pageref structure at a time.
  * This is a struct type for such a page.
  *
- * Each pageref page contains 256 pagerefs, which can manage up to
- * 256 * 4K = 1M of kernel heap.
+ * Each pageref page contains 170 pagerefs, which can manage up to
+ * 170 * 4K = 680K of kernel heap.
  */
 
 #define NPAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
@@ -187,69 +201,69 @@ struct pagerefpage {
 };
 
 /*
- * This structure holds a pointer to a pageref page and also its
- * bitmap of free entries.
+ * Pagerefs not in use are kept on a free list, threaded through
+ * next_samesize. When it runs dry we carve up another page. Pageref
+ * pages are never given back.
  */
-
-#define INUSE_WORDS (NPAGEREFS_PER_PAGE / 32)
-
-struct kheap_root {
-	struct pagerefpage *page;
-	uint32_t pagerefs_inuse[INUSE_WORDS];
-	unsigned numinuse;
-};
+static struct pageref *freepagerefs;
 
 /*
- * It would be better to make this dynamically sizeable. However,
- * since we only actually run on System/161 and System/161 is
- * specifically limited to 16M of RAM, we'll just adopt that as a
- * static size limit.
+ * Map from physical page to the pageref for the subpage heap page
+ * that lives there, so kfree can find a block's pageref without
+ * searching. It's a two-level radix tree keyed by physical page
+ * number: the top level is static and covers the whole physical
+ * address space, and each leaf is one page of pointers covering 4M,
+ * allocated the first time a heap page lands in its range. Leaves
+ * are never freed.
  *
- * FUTURE: it would be better to pick this number based on the RAM
- * size we find at boot time.
+ * Entries change only under kmalloc_spinlock, but kfree can read the
+ * entry for a block it's freeing without the lock: as long as that
+ * block is allocated its page can't go away.
  */
 
-#define NUM_PAGEREFPAGES 16
-#define TOTAL_PAGEREFS (NUM_PAGEREFPAGES * NPAGEREFS_PER_PAGE)
+#define PAGEMAP_LEAFSIZE (PAGE_SIZE / sizeof(struct pageref *))
+#define PAGEMAP_ROOTSIZE (((paddr_t)-1 / PAGE_SIZE) / PAGEMAP_LEAFSIZE + 1)
 
-static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
+struct pagemapleaf {
+	struct pageref *refs[PAGEMAP_LEAFSIZE];
+};
+
+static struct pagemapleaf *kheap_pagemap[PAGEMAP_ROOTSIZE];
 
 /*
- * Allocate a page to hold pagerefs.
+ * Allocate a page to hold pagerefs, and put them on the free list.
+ * Returns false if out of memory.
  */
 static
-void
-allocpagerefpage(struct kheap_root *root)
+bool
+allocpagerefpage(void)
 {
+	struct pagerefpage *page;
 	vaddr_t va;
-
-	KASSERT(root->page == NULL);
+	unsigned i;
 
 	/*
 	 * We release the spinlock while calling alloc_kpages. This
 	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
+	 * Note that this means things can change behind our back;
+	 * but if somebody else also allocated a page, the worst that
+	 * happens is that we have more spare pagerefs than we need.
 	 */
 	spinlock_release(&kmalloc_spinlock);
 	va = alloc_kpages(1);
 	spinlock_acquire(&kmalloc_spinlock);
 	if (va == 0) {
 		kprintf("kmalloc: Couldn't get a pageref page\n");
-		return;
+		return false;
 	}
 	KASSERT(va % PAGE_SIZE == 0);
 
-	if (root->page != NULL) {
-		/* Oops, somebody else allocated it. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(va);
-		spinlock_acquire(&kmalloc_spinlock);
-		/* Once allocated it isn't ever freed. */
-		KASSERT(root->page != NULL);
-		return;
+	page = (struct pagerefpage *)va;
+	for (i=0; i<NPAGEREFS_PER_PAGE; i++) {
+		page->refs[i].next_samesize = freepagerefs;
+		freepagerefs = &page->refs[i];
 	}
-
-	root->page = (struct pagerefpage *)va;
+	return true;
 }
 
 /*
@@ -259,44 +273,18 @@ static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-		if (root->numinuse >= NPAGEREFS_PER_PAGE) {
-			continue;
-		}
+	struct pageref *pr;
 
-		/*
-		 * This should probably not be a linear search.
-		 */
-		for (i=0; i<INUSE_WORDS; i++) {
-			if (root->pagerefs_inuse[i]==0xffffffff) {
-				/* full */
-				continue;
-			}
-			for (k=1,j=0; k!=0; k<<=1,j++) {
-				if ((root->pagerefs_inuse[i] & k)==0) {
-					root->pagerefs_inuse[i] |= k;
-					root->numinuse++;
-					if (root->page == NULL) {
-						allocpagerefpage(root);
-					}
-					if (root->page == NULL) {
-						return NULL;
-					}
-					return &root->page->refs[i*32 + j];
-				}
-			}
-			KASSERT(0);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	while (freepagerefs == NULL) {
+		if (!allocpagerefpage()) {
+			return NULL;
 		}
 	}
-
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	freepagerefs = pr->next_samesize;
+	return pr;
 }
 
 /*
@@ -304,48 +292,104 @@ allocpageref(void)
  */
 static
 void
-freepageref(struct pageref *p)
+freepageref(struct pageref *pr)
 {
-	size_t i, j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-	struct pagerefpage *page;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
+	pr->pageaddr_and_blocktype = 0;
+	pr->next_samesize = freepagerefs;
+	freepagerefs = pr;
+}
 
-		page = root->page;
-		if (page == NULL) {
-			KASSERT(root->numinuse == 0);
-			continue;
-		}
+/*
+ * Make sure there's a page map leaf covering the page PRPAGE. Called
+ * without kmalloc_spinlock, because it may need to allocate a page.
+ * Returns false if out of memory.
+ */
+static
+bool
+pagemap_prepare(vaddr_t prpage)
+{
+	unsigned index;
+	vaddr_t va;
 
-		j = p-page->refs;
-		/* note: j is unsigned, don't test < 0 */
-		if (j < NPAGEREFS_PER_PAGE) {
-			/* on this page */
-			i = j/32;
-			k = ((uint32_t)1) << (j%32);
-			KASSERT((root->pagerefs_inuse[i] & k) != 0);
-			root->pagerefs_inuse[i] &= ~k;
-			KASSERT(root->numinuse > 0);
-			root->numinuse--;
-			return;
-		}
+	index = KVADDR_TO_PADDR(prpage) / PAGE_SIZE / PAGEMAP_LEAFSIZE;
+	KASSERT(index < PAGEMAP_ROOTSIZE);
+
+	if (kheap_pagemap[index] != NULL) {
+		return true;
+	}
+
+	va = alloc_kpages(1);
+	if (va == 0) {
+		return false;
+	}
+	bzero((void *)va, PAGE_SIZE);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	if (kheap_pagemap[index] == NULL) {
+		kheap_pagemap[index] = (struct pagemapleaf *)va;
+		va = 0;
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	if (va != 0) {
+		/* Oops, somebody else got there first. */
+		free_kpages(va);
+	}
+	return true;
+}
+
+/*
+ * Return the pageref for the heap page containing PTRADDR, or NULL if
+ * it isn't on any heap page. See above for when this can be called
+ * without kmalloc_spinlock.
+ */
+static
+struct pageref *
+pagemap_lookup(vaddr_t ptraddr)
+{
+	struct pagemapleaf *leaf;
+	paddr_t frame;
+
+	frame = KVADDR_TO_PADDR(ptraddr) / PAGE_SIZE;
+	leaf = kheap_pagemap[frame / PAGEMAP_LEAFSIZE];
+	if (leaf == NULL) {
+		return NULL;
 	}
-	/* pageref wasn't on any of the pages */
-	KASSERT(0);
+	return leaf->refs[frame % PAGEMAP_LEAFSIZE];
+}
+
+/*
+ * Record PR (or NULL) as the pageref for the heap page PRPAGE. The
+ * leaf must already exist (see pagemap_prepare).
+ */
+static
+void
+pagemap_set(vaddr_t prpage, struct pageref *pr)
+{
+	struct pagemapleaf *leaf;
+	paddr_t frame;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	frame = KVADDR_TO_PADDR(prpage) / PAGE_SIZE;
+	leaf = kheap_pagemap[frame / PAGEMAP_LEAFSIZE];
+	KASSERT(leaf != NULL);
+	leaf->refs[frame % PAGEMAP_LEAFSIZE] = pr;
 }
 
 ////////////////////////////////////////
 
 /*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
+ * Each pageref is on up to two doubly-linked lists: one of all heap
+ * pages, and, if it has any free blocks, one of pages of blocks of
+ * that same size. Keeping full pages off the size lists means we
+ * never have to step over them to find a free block.
  */
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
+static unsigned kheap_numpages;		/* number of pages on allbase */
 
 ////////////////////////////////////////
 
@@ -590,18 +634,24 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < TOTAL_PAGEREFS);
+			KASSERT(pr->nfree > 0);
+			KASSERT(pr->next_samesize == NULL ||
+				pr->next_samesize->prev_samesize == pr);
+			KASSERT(pagemap_lookup(PR_PAGEADDR(pr)) == pr);
+			KASSERT(sc < kheap_numpages);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
+		KASSERT(pr->next_all == NULL || pr->next_all->prev_all == pr);
+		KASSERT(ac < kheap_numpages);
 		ac++;
 	}
 
-	KASSERT(sc==ac);
+	KASSERT(sc<=ac);
+	KASSERT(ac==kheap_numpages);
 }
 #else
 #define checksubpages()
@@ -656,7 +706,8 @@ dump_subpage(struct pageref *pr, unsigned generation)
 	}
 
 	prpage = PR_PAGEADDR(pr);
-	fl = (struct freelist *)(prpage + pr->freelist_offset);
+	fl = pr->freelist_offset == INVALID_OFFSET ? NULL :
+		(struct freelist *)(prpage + pr->freelist_offset);
 	for (; fl != NULL; fl = fl->next) {
 		i = ((vaddr_t)fl - prpage) / blocksize;
 		mask = 1U << (i % 32);
@@ -683,13 +734,10 @@ void
 dump_subpages(unsigned generation)
 {
 	struct pageref *pr;
-	int i;
 
 	kprintf("Remaining allocations from generation %u:\n", generation);
-	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			dump_subpage(pr, generation);
-		}
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		dump_subpage(pr, generation);
 	}
 }
 
@@ -713,6 +761,8 @@ void
 kheap_dump(void)
 {
 #ifdef LABELS
+	kmc_reclaim();
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 	dump_subpages(mallocgeneration);
@@ -728,6 +778,8 @@ kheap_dumpall(void)
 #ifdef LABELS
 	unsigned i;
 
+	kmc_reclaim();
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 	for (i=0; i<=mallocgeneration; i++) {
@@ -807,6 +859,9 @@ kheap_printstats(void)
 {
 	struct pageref *pr;
 
+	/* don't show blocks sitting in magazines as allocated */
+	kmc_reclaim();
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -817,6 +872,8 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kmem_cache_printstats();
 }
 
 
@@ -829,6 +886,13 @@ kheap_getused(void) {
 	struct pageref *pr;
 	unsigned long total = 0;
 	unsigned int num_pages = 0, coremap_bytes = 0;
+	unsigned slab_pages;
+
+	/* blocks cached in the per-cpu magazines aren't in use */
+	kmc_reclaim();
+
+	/* likewise, count only the live objects in the object caches */
+	total += kmem_cache_getused(&slab_pages);
 
 	/* compute with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -839,10 +903,11 @@ kheap_getused(void) {
 
 	coremap_bytes = coremap_used_bytes();
 
-	// Don't double-count the pages we're using for subpage allocation;
-	// we've already accounted for the used portion.
+	// Don't double-count the pages we're using for subpage allocation
+	// or for object cache slabs; we've already accounted for the used
+	// portion.
 	if (coremap_bytes > 0) {
-		total += coremap_bytes - (num_pages * PAGE_SIZE);
+		total += coremap_bytes - ((num_pages + slab_pages) * PAGE_SIZE);
 	}
 
 	spinlock_release(&kmalloc_spinlock);
@@ -865,31 +930,80 @@ kheap_printused(void)
 ////////////////////////////////////////
 
 /*
- * Remove a pageref from both lists that it's on.
+ * Put a pageref on, or take it off, the list of pages of its size.
  */
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+add_samesize(struct pageref *pr, unsigned blktype)
 {
-	struct pageref **guy;
+	KASSERT(blktype<NSIZES);
+
+	pr->prev_samesize = NULL;
+	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr;
+	}
+	sizebases[blktype] = pr;
+}
 
-	KASSERT(blktype>=0 && blktype<NSIZES);
+static
+void
+remove_samesize(struct pageref *pr, unsigned blktype)
+{
+	KASSERT(blktype<NSIZES);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
 	}
+	else {
+		KASSERT(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
+	}
+	pr->next_samesize = pr->prev_samesize = NULL;
+}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+/*
+ * Put a new heap page on the lists, or take an entirely free one off
+ * them.
+ */
+static
+void
+add_lists(struct pageref *pr, unsigned blktype)
+{
+	add_samesize(pr, blktype);
+
+	pr->prev_all = NULL;
+	pr->next_all = allbase;
+	if (pr->next_all != NULL) {
+		pr->next_all->prev_all = pr;
+	}
+	allbase = pr;
+	kheap_numpages++;
+}
+
+static
+void
+remove_lists(struct pageref *pr, unsigned blktype)
+{
+	KASSERT(pr->nfree > 0);
+	remove_samesize(pr, blktype);
+
+	if (pr->prev_all != NULL) {
+		pr->prev_all->next_all = pr->next_all;
 	}
+	else {
+		KASSERT(allbase == pr);
+		allbase = pr->next_all;
+	}
+	if (pr->next_all != NULL) {
+		pr->next_all->prev_all = pr->prev_all;
+	}
+	pr->next_all = pr->prev_all = NULL;
+	KASSERT(kheap_numpages > 0);
+	kheap_numpages--;
 }
 
 /*
@@ -915,91 +1029,124 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Return the block type of the heap page holding PTRADDR, or -1 if
+ * it isn't a subpage block. PTRADDR must be a block the caller owns
+ * (that is, one that is allocated), or the answer may be stale by the
+ * time it's returned.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
+int
+subpage_blocktype(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+
+#ifdef __mips__
+	if (ptraddr < MIPS_KSEG0 || ptraddr >= MIPS_KSEG1) {
+		return -1;
+	}
 #endif
-	)
+
+	pr = pagemap_lookup(ptraddr);
+	if (pr == NULL) {
+		return -1;
+	}
+	KASSERT(PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+	KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+	return PR_BLOCKTYPE(pr);
+}
+
+/*
+ * Take one block off the freelist of the heap page PR, which must
+ * have at least one free block.
+ */
+static
+void *
+subpage_popblock(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
+	struct freelist *fl;	// free list entry
 	void *retptr;		// our result
 
-	volatile int i;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
 
-	spinlock_acquire(&kmalloc_spinlock);
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+		/* Full; it needn't be found until something is freed. */
+		remove_samesize(pr, PR_BLOCKTYPE(pr));
+	}
 
-	checksubpages();
+	return retptr;
+}
+
+/*
+ * Take up to MAX free blocks of type BLKTYPE from the heap pages we
+ * already have, putting them in BLOCKS. Returns the number taken.
+ */
+static
+unsigned
+subpage_takeblocks(unsigned blktype, void **blocks, unsigned max)
+{
+	struct pageref *pr;
+	unsigned n = 0;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	/* Every page on the size list has a free block. */
+	while (n < max && (pr = sizebases[blktype]) != NULL) {
 
 		/* check for corruption */
 		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		KASSERT(pr->nfree > 0);
 		checksubpage(pr);
 
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
+		/* this takes pr off the list once it's empty */
+		blocks[n++] = subpage_popblock(pr);
+	}
+	return n;
+}
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+/*
+ * Get a raw block (no guard bands or labels) of type BLKTYPE from the
+ * global pool, making a fresh heap page if needed.
+ */
+static
+void *
+subpage_getblock(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for page we're allocating from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+	void *retptr;		// our result
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+	volatile int i;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
+	spinlock_acquire(&kmalloc_spinlock);
 
-			checksubpages();
+	checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
+	if (subpage_takeblocks(blktype, &retptr, 1) == 1) {
+		checksubpages();
+		spinlock_release(&kmalloc_spinlock);
+		return retptr;
 	}
 
 	/*
@@ -1023,6 +1170,11 @@ subpage_kmalloc(size_t sz
 	/* deadbeef the whole page, as it probably starts zeroed */
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
 #endif
+	if (!pagemap_prepare(prpage)) {
+		free_kpages(prpage);
+		silent("kmalloc: Subpage allocator couldn't get a page\n");
+		return NULL;
+	}
 	spinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
@@ -1055,106 +1207,45 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
+	add_lists(pr, blktype);
+	pagemap_set(prpage, pr);
 
-	pr->next_all = allbase;
-	allbase = pr;
+	retptr = subpage_popblock(pr);
+
+	checksubpages();
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	spinlock_release(&kmalloc_spinlock);
+	return retptr;
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Put the raw block at PTRADDR back on its heap page's freelist. If
+ * that leaves the whole page free, the page is unhooked and its
+ * address returned so the caller can free_kpages it once it has let
+ * go of kmalloc_spinlock; otherwise returns 0.
  */
 static
-int
-subpage_kfree(void *ptr)
+vaddr_t
+subpage_putblock(vaddr_t ptraddr)
 {
 	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
-#ifdef GUARDS
-	size_t blocksize, smallerblocksize;
-#endif
 
-	ptraddr = (vaddr_t)ptr;
-#ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
-#endif
-#ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
-	}
-	ptraddr -= LABEL_PTROFFSET;
-#endif
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+	pr = pagemap_lookup(ptraddr);
+	KASSERT(pr != NULL);
+	checksubpage(pr);
 
+	prpage = PR_PAGEADDR(pr);
+	KASSERT(prpage == (ptraddr & PAGE_FRAME));
+	blktype = PR_BLOCKTYPE(pr);
 	offset = ptraddr - prpage;
-
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
-
-#ifdef GUARDS
-	blocksize = sizes[blktype];
-	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
-	checkguardband(ptraddr, smallerblocksize, blocksize);
-#endif
-
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+	KASSERT(offset % sizes[blktype] == 0);
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
@@ -1183,27 +1274,422 @@ subpage_kfree(void *ptr)
 #endif
 	}
 	pr->freelist_offset = offset;
-	pr->nfree++;
+	if (pr->nfree++ == 0) {
+		/* Was full; make it findable again. */
+		add_samesize(pr, blktype);
+	}
 
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
+		pagemap_set(prpage, NULL);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
+		return prpage;
+	}
+	return 0;
+}
+
+/*
+ * Return N raw blocks (at most KMC_MAGSIZE) to the global pool,
+ * releasing any heap pages that become entirely free.
+ */
+static
+void
+subpage_release(void **blocks, unsigned n)
+{
+	vaddr_t freepages[KMC_MAGSIZE];
+	unsigned i, nfreepages;
+	vaddr_t prpage;
+
+	KASSERT(n <= KMC_MAGSIZE);
+
+	nfreepages = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (i=0; i<n; i++) {
+		prpage = subpage_putblock((vaddr_t)blocks[i]);
+		if (prpage != 0) {
+			freepages[nfreepages++] = prpage;
+		}
+	}
+
+	checksubpages();
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+//    Each cpu keeps a small stack ("magazine") of free blocks of each
+//    block size. kmalloc and kfree on that cpu pop and push the
+//    magazine, and only come to the global pool (and thus
+//    kmalloc_spinlock) to refill an empty magazine or to spill half
+//    of a full one, in a batch under a single lock hold.
+//
+//    The magazines have their own per-cpu spinlock. Normally only
+//    the owning cpu takes it, so it costs us no contention; it's
+//    there so that any cpu can drain all the magazines when we're
+//    short of memory or want exact heap statistics.
+//
+//    Blocks sitting in a magazine are still allocated as far as their
+//    heap page is concerned, so they pin that page until drained.
+//
+
+struct kmc_magazine {
+	unsigned m_count;
+	void *m_blocks[KMC_MAGSIZE];
+};
+
+struct kmalloc_cpucache {
+	struct spinlock kc_lock;
+	struct kmalloc_cpucache *kc_next;	/* next on kmcaches list */
+	struct kmc_magazine kc_mags[NSIZES];
+};
+
+/*
+ * List of all the per-cpu caches, for draining. Entries are added
+ * under kmalloc_spinlock and never removed, and kc_next does not
+ * change once an entry is on the list, so it can be walked without
+ * the lock once the head has been read.
+ */
+static struct kmalloc_cpucache *kmcaches;
+
+/*
+ * Set up the magazines for cpu C. Called from cpu_create.
+ */
+void
+kmalloc_cpucache_init(struct cpu *c)
+{
+	struct kmalloc_cpucache *kc;
+	unsigned i;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		/* Not fatal; this cpu will just always use the pool. */
+		kprintf("kmalloc: cpu%u: no memory for magazines\n",
+			c->c_number);
+		return;
+	}
+
+	spinlock_init(&kc->kc_lock);
+	for (i=0; i<NSIZES; i++) {
+		kc->kc_mags[i].m_count = 0;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	kc->kc_next = kmcaches;
+	kmcaches = kc;
+	spinlock_release(&kmalloc_spinlock);
+
+	c->c_kmcache = kc;
+}
+
+/*
+ * Get the current cpu's magazines, if it has any yet.
+ *
+ * We may migrate to another cpu right after looking; that's fine,
+ * because the magazines are locked, so the worst that happens is that
+ * we use another cpu's magazine once.
+ */
+static
+struct kmalloc_cpucache *
+kmc_mine(void)
+{
+#ifdef CHECKGUARDS
+	/*
+	 * Cached blocks are deadbeef, but their pages think they're
+	 * allocated, so checksubpage would find their guard bands
+	 * trashed. Don't cache anything.
+	 */
+	return NULL;
+#endif
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	return curcpu->c_kmcache;
+}
+
+/*
+ * Pop a raw block of type BLKTYPE from this cpu's magazine, refilling
+ * it from existing heap pages if it's empty. Returns NULL if there's
+ * nothing cached; the caller then goes to subpage_getblock, which can
+ * make new heap pages. (We don't do that here, as we can't call
+ * alloc_kpages holding kc_lock.)
+ */
+static
+void *
+kmc_get(unsigned blktype)
+{
+	struct kmalloc_cpucache *kc;
+	struct kmc_magazine *mag;
+	void *ret;
+
+	kc = kmc_mine();
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	mag = &kc->kc_mags[blktype];
+	if (mag->m_count == 0) {
+		spinlock_acquire(&kmalloc_spinlock);
+		mag->m_count = subpage_takeblocks(blktype, mag->m_blocks,
+						  KMC_MAGSIZE / 2);
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+	}
+	if (mag->m_count > 0) {
+		ret = mag->m_blocks[--mag->m_count];
 	}
 	else {
-		spinlock_release(&kmalloc_spinlock);
+		ret = NULL;
 	}
+	spinlock_release(&kc->kc_lock);
+
+	return ret;
+}
+
+/*
+ * Push the raw block BLOCK of type BLKTYPE onto this cpu's magazine.
+ * If the magazine is full, spill the older half of it back to the
+ * global pool first. Returns false if this cpu has no magazines.
+ */
+static
+bool
+kmc_put(unsigned blktype, void *block)
+{
+	struct kmalloc_cpucache *kc;
+	struct kmc_magazine *mag;
+	void *spill[KMC_MAGSIZE / 2];
+	unsigned i, nspill;
+
+	kc = kmc_mine();
+	if (kc == NULL) {
+		return false;
+	}
+
+	nspill = 0;
+	spinlock_acquire(&kc->kc_lock);
+	mag = &kc->kc_mags[blktype];
+#ifdef SLOW
+	for (i=0; i<mag->m_count; i++) {
+		/* this block should not already be in the magazine! */
+		KASSERT(mag->m_blocks[i] != block);
+	}
+#endif
+	if (mag->m_count == KMC_MAGSIZE) {
+		nspill = KMC_MAGSIZE / 2;
+		for (i=0; i<nspill; i++) {
+			spill[i] = mag->m_blocks[i];
+		}
+		for (i=nspill; i<KMC_MAGSIZE; i++) {
+			mag->m_blocks[i - nspill] = mag->m_blocks[i];
+		}
+		mag->m_count -= nspill;
+	}
+	mag->m_blocks[mag->m_count++] = block;
+	spinlock_release(&kc->kc_lock);
+
+	/* Don't hold kc_lock while freeing pages. */
+	if (nspill > 0) {
+		subpage_release(spill, nspill);
+	}
+	return true;
+}
+
+/*
+ * Empty all the magazines of one cpu into the global pool. Returns
+ * the number of blocks released.
+ */
+static
+unsigned
+kmc_drain(struct kmalloc_cpucache *kc)
+{
+	void *blocks[KMC_MAGSIZE];
+	struct kmc_magazine *mag;
+	unsigned blktype, i, n, total;
+
+	total = 0;
+	for (blktype=0; blktype<NSIZES; blktype++) {
+		spinlock_acquire(&kc->kc_lock);
+		mag = &kc->kc_mags[blktype];
+		n = mag->m_count;
+		for (i=0; i<n; i++) {
+			blocks[i] = mag->m_blocks[i];
+		}
+		mag->m_count = 0;
+		spinlock_release(&kc->kc_lock);
+
+		subpage_release(blocks, n);
+		total += n;
+	}
+	return total;
+}
+
+/*
+ * Empty every cpu's magazines. This is done when we're out of memory,
+ * in the hope of freeing some heap pages, and before reporting heap
+ * statistics, so cached blocks aren't counted as in use. Returns the
+ * number of blocks released.
+ */
+static
+unsigned
+kmc_reclaim(void)
+{
+	struct kmalloc_cpucache *kc;
+	unsigned total;
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
+	kc = kmcaches;
 	spinlock_release(&kmalloc_spinlock);
+
+	total = 0;
+	for (; kc != NULL; kc = kc->kc_next) {
+		total += kmc_drain(kc);
+	}
+	return total;
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	retptr = kmc_get(blktype);
+	if (retptr == NULL) {
+		retptr = subpage_getblock(blktype);
+	}
+	if (retptr == NULL && kmc_reclaim() > 0) {
+		/* Cached blocks may have freed up a page; try again. */
+		retptr = subpage_getblock(blktype);
+	}
+	if (retptr == NULL) {
+		return NULL;
+	}
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+
+	return retptr;
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t ptraddr;	// same as ptr
+	vaddr_t offset;		// offset into page
+	void *block;		// the block itself
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
 #endif
 
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	blktype = subpage_blocktype(ptraddr);
+	if (blktype < 0) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
+	KASSERT(blktype < NSIZES);
+
+	offset = ptraddr & ~(vaddr_t)PAGE_FRAME;
+
+	/* Check for proper positioning and alignment */
+	if (offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#ifdef GUARDS
+	blocksize = sizes[blktype];
+	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
+	checkguardband(ptraddr, smallerblocksize, blocksize);
+#endif
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+
+	block = (void *)ptraddr;
+	if (!kmc_put(blktype, block)) {
+		subpage_release(&block, 1);
+	}
+
 	return 0;
 }
 
@@ -1238,6 +1724,10 @@ kmalloc(size_t sz)
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
+		if (address==0 && kmc_reclaim() > 0) {
+			/* Cached blocks may have freed up some pages. */
+			address = alloc_kpages(npages);
+		}
 		if (address==0) {
 			return NULL;
 		}
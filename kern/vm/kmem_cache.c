@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Object caches. See kmem_cache.h for the interface.
+ *
+ * Each cache owns a set of slabs. A slab is one page: a struct
+ * kmem_slab header, then a stack of the indexes of the free objects
+ * in the slab, then the objects themselves, packed end to end. The
+ * free stack lives outside the objects so that freeing an object
+ * doesn't scribble on its constructed state, and a slab can be found
+ * from any object in it by masking off the page offset.
+ *
+ * Slabs with free objects are kept on the cache's partial list; slabs
+ * with none are on no list at all (we never need to find them) and
+ * are only counted. When a slab becomes entirely free we keep it as
+ * the cache's spare, still constructed, unless there already is one;
+ * then it's destroyed. This keeps a cache that is cycling one object
+ * from creating and destroying a slab each time.
+ *
+ * Constructors and destructors are called, and pages allocated and
+ * freed, without holding the cache lock, as they may well want to
+ * call kmalloc.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+/* Object alignment; enough for anything we put in a struct. */
+#define KMEM_ALIGN 8
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	/* partial list */
+	struct kmem_slab *ks_prev;
+	struct kmem_cache *ks_cache;	/* cache we belong to */
+	unsigned ks_nfree;		/* number of free objects */
+	uint16_t ks_free[];		/* stack of free object indexes */
+};
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* size requested */
+	size_t kc_objsize;		/* size rounded for alignment */
+	unsigned kc_perslab;		/* objects per slab */
+	size_t kc_objoffset;		/* offset of first object in slab */
+	void (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_partial;	/* slabs with some free objects */
+	struct kmem_slab *kc_spare;	/* one entirely free slab */
+	unsigned kc_nslabs;		/* total slabs, including spare */
+	unsigned kc_inuse;		/* objects allocated */
+
+	/* statistics */
+	unsigned long kc_allocs;	/* calls to kmem_cache_alloc */
+	unsigned long kc_frees;		/* calls to kmem_cache_free */
+	unsigned long kc_ctors;		/* objects constructed */
+	unsigned long kc_slabsmade;	/* slabs created */
+
+	struct kmem_cache *kc_next;	/* on kmem_caches list */
+};
+
+/* All caches, for statistics. */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+// slab list handling
+
+static
+void
+slab_link(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	ks->ks_prev = NULL;
+	ks->ks_next = kc->kc_partial;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks;
+	}
+	kc->kc_partial = ks;
+}
+
+static
+void
+slab_unlink(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(kc->kc_partial == ks);
+		kc->kc_partial = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_next = ks->ks_prev = NULL;
+}
+
+static
+void *
+slab_obj(struct kmem_cache *kc, struct kmem_slab *ks, unsigned index)
+{
+	KASSERT(index < kc->kc_perslab);
+	return (char *)ks + kc->kc_objoffset + index * kc->kc_objsize;
+}
+
+////////////////////////////////////////////////////////////
+// slab creation and destruction
+
+/*
+ * Make a new slab, with all its objects constructed and free.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	KASSERT(page % PAGE_SIZE == 0);
+
+	ks = (struct kmem_slab *)page;
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_cache = kc;
+	ks->ks_nfree = kc->kc_perslab;
+	for (i=0; i<kc->kc_perslab; i++) {
+		/* hand out low addresses first */
+		ks->ks_free[i] = kc->kc_perslab - 1 - i;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_ctor(slab_obj(kc, ks, i));
+		}
+	}
+	return ks;
+}
+
+/*
+ * Destroy an entirely free slab that is no longer on any list.
+ */
+static
+void
+slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	unsigned i;
+
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(ks->ks_nfree == kc->kc_perslab);
+
+	if (kc->kc_dtor != NULL) {
+		for (i=0; i<kc->kc_perslab; i++) {
+			kc->kc_dtor(slab_obj(kc, ks, i));
+		}
+	}
+	ks->ks_cache = NULL;
+	free_kpages((vaddr_t)ks);
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  void (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+	size_t objsize, hdrsize = 0;
+	unsigned perslab;
+
+	KASSERT(size > 0);
+
+	objsize = ROUNDUP(size, KMEM_ALIGN);
+
+	/*
+	 * Each object costs its own size plus a slot in the free
+	 * stack. Guess from that, then back off until the header
+	 * (rounded for alignment) and the objects fit.
+	 */
+	perslab = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		(objsize + sizeof(uint16_t));
+	while (perslab > 0) {
+		hdrsize = sizeof(struct kmem_slab) + perslab*sizeof(uint16_t);
+		hdrsize = ROUNDUP(hdrsize, KMEM_ALIGN);
+		if (hdrsize + perslab * objsize <= PAGE_SIZE) {
+			break;
+		}
+		perslab--;
+	}
+	if (perslab == 0) {
+		/* Too big for a one-page slab. */
+		return NULL;
+	}
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_objsize = objsize;
+	kc->kc_perslab = perslab;
+	kc->kc_objoffset = hdrsize;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_spare = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_inuse = 0;
+
+	kc->kc_allocs = 0;
+	kc->kc_frees = 0;
+	kc->kc_ctors = 0;
+	kc->kc_slabsmade = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **p;
+	struct kmem_slab *ks;
+
+	KASSERT(kc != NULL);
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (p = &kmem_caches; *p != kc; p = &(*p)->kc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	/* No objects in use means no partial slabs either. */
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_partial == NULL);
+	ks = kc->kc_spare;
+	kc->kc_spare = NULL;
+	if (ks != NULL) {
+		slab_destroy(kc, ks);
+		kc->kc_nslabs--;
+	}
+	KASSERT(kc->kc_nslabs == 0);
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_allocs++;
+
+	ks = kc->kc_partial;
+	if (ks == NULL && kc->kc_spare != NULL) {
+		ks = kc->kc_spare;
+		kc->kc_spare = NULL;
+		slab_link(kc, ks);
+	}
+	if (ks == NULL) {
+		/*
+		 * Need a fresh slab. Make it unlocked; meanwhile
+		 * someone else may free something or make a slab
+		 * too, which is harmless.
+		 */
+		spinlock_release(&kc->kc_lock);
+		ks = slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kc->kc_nslabs++;
+		kc->kc_slabsmade++;
+		kc->kc_ctors += kc->kc_perslab;
+		slab_link(kc, ks);
+	}
+
+	KASSERT(ks->ks_nfree > 0);
+	ks->ks_nfree--;
+	obj = slab_obj(kc, ks, ks->ks_free[ks->ks_nfree]);
+	if (ks->ks_nfree == 0) {
+		/* Full; goes on no list. */
+		slab_unlink(kc, ks);
+	}
+	kc->kc_inuse++;
+
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks, *victim;
+	vaddr_t offset;
+	unsigned index;
+
+	KASSERT(obj != NULL);
+
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	KASSERT(ks->ks_cache == kc);
+
+	offset = (vaddr_t)obj - (vaddr_t)ks;
+	KASSERT(offset >= kc->kc_objoffset);
+	index = (offset - kc->kc_objoffset) / kc->kc_objsize;
+	if (slab_obj(kc, ks, index) != obj) {
+		panic("kmem_cache_free: %s: invalid object %p\n",
+		      kc->kc_name, obj);
+	}
+
+	victim = NULL;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_frees++;
+	KASSERT(kc->kc_inuse > 0);
+	kc->kc_inuse--;
+
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+	if (ks->ks_nfree == 0) {
+		/* Was full; now partial. */
+		slab_link(kc, ks);
+	}
+	ks->ks_free[ks->ks_nfree++] = index;
+
+	if (ks->ks_nfree == kc->kc_perslab) {
+		/* Entirely free: keep it as the spare, or let it go. */
+		slab_unlink(kc, ks);
+		if (kc->kc_spare == NULL) {
+			kc->kc_spare = ks;
+		}
+		else {
+			victim = ks;
+			kc->kc_nslabs--;
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (victim != NULL) {
+		slab_destroy(kc, victim);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// statistics
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	kprintf("Object caches:\n");
+	kprintf("  %-16s %5s %5s %6s %6s %10s %10s %8s\n",
+		"name", "size", "/slab", "slabs", "inuse",
+		"allocs", "frees", "ctors");
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		kprintf("  %-16s %5zu %5u %6u %6u %10lu %10lu %8lu\n",
+			kc->kc_name, kc->kc_objsize, kc->kc_perslab,
+			kc->kc_nslabs, kc->kc_inuse,
+			kc->kc_allocs, kc->kc_frees, kc->kc_ctors);
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
+
+unsigned long
+kmem_cache_getused(unsigned *npages)
+{
+	struct kmem_cache *kc;
+	unsigned long total;
+	unsigned pages;
+
+	total = 0;
+	pages = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		total += (unsigned long)kc->kc_inuse * kc->kc_size;
+		pages += kc->kc_nslabs;
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_caches_lock);
+
+	*npages = pages;
+	return total;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Two-level page tables. See pagetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagetable.h>
+
+#define PT_L2SIZE	(PAGE_SIZE / sizeof(pte_t))	/* entries per table */
+#define PT_L1SHIFT	22
+#define PT_L2SHIFT	12
+#define PT_L1SIZE	(USERSPACETOP >> PT_L1SHIFT)
+
+#define PT_L1INDEX(va)	((va) >> PT_L1SHIFT)
+#define PT_L2INDEX(va)	(((va) >> PT_L2SHIFT) & (PT_L2SIZE - 1))
+#define PT_VADDR(i, j)	(((vaddr_t)(i) << PT_L1SHIFT) | \
+			 ((vaddr_t)(j) << PT_L2SHIFT))
+
+/* The TLB cache is direct-mapped, by page number. */
+#define PT_TCSIZE	64
+#define PT_TCINDEX(va)	(((va) >> PT_L2SHIFT) & (PT_TCSIZE - 1))
+
+struct pt_tcentry {
+	vaddr_t tc_vaddr;		/* page cached here */
+	uint32_t tc_entrylo;		/* its TLB entry, or 0 if none */
+};
+
+struct pagetable {
+	struct spinlock pt_spinlock;	/* protects everything below */
+	struct wchan *pt_wchan;		/* for waiting on PTE_BUSY */
+	pte_t *pt_l2[PT_L1SIZE];	/* second-level tables, or NULL */
+	struct pt_tcentry pt_tlbcache[PT_TCSIZE];
+};
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	pt->pt_wchan = wchan_create("pagetable");
+	if (pt->pt_wchan == NULL) {
+		kfree(pt);
+		return NULL;
+	}
+	spinlock_init(&pt->pt_spinlock);
+	for (i=0; i<PT_L1SIZE; i++) {
+		pt->pt_l2[i] = NULL;
+	}
+	for (i=0; i<PT_TCSIZE; i++) {
+		pt->pt_tlbcache[i].tc_entrylo = 0;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t pte;
+
+	for (i=0; i<PT_L1SIZE; i++) {
+		if (pt->pt_l2[i] == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2SIZE; j++) {
+			if (pt->pt_l2[i][j] == 0) {
+				continue;
+			}
+
+			/* The pager might be working on it. */
+			pt_lock(pt);
+			while (pt->pt_l2[i][j] & PTE_BUSY) {
+				pt_wait(pt);
+			}
+			pte = pt->pt_l2[i][j];
+			pt->pt_l2[i][j] = 0;
+			pt_unlock(pt);
+
+			if (pte & PTE_VALID) {
+				coremap_free(PTE_PADDR(pte));
+			}
+			else if (pte & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(pte));
+			}
+		}
+		kfree(pt->pt_l2[i]);
+	}
+	spinlock_cleanup(&pt->pt_spinlock);
+	wchan_destroy(pt->pt_wchan);
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	unsigned i;
+	pte_t *l2;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	i = PT_L1INDEX(vaddr);
+	l2 = pt->pt_l2[i];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PAGE_SIZE);
+		if (l2 == NULL) {
+			return NULL;
+		}
+		bzero(l2, PAGE_SIZE);
+
+		/* Another thread in this address space may have beat us. */
+		pt_lock(pt);
+		if (pt->pt_l2[i] == NULL) {
+			pt->pt_l2[i] = l2;
+			l2 = NULL;
+		}
+		pt_unlock(pt);
+		if (l2 != NULL) {
+			kfree(l2);
+		}
+		l2 = pt->pt_l2[i];
+	}
+	return &l2[PT_L2INDEX(vaddr)];
+}
+
+int
+pt_copy(struct pagetable *old, struct pagetable *new)
+{
+	unsigned i, j, slot;
+	pte_t pte, *oldpte, *newpte;
+	int result;
+
+	/*
+	 * This only copies the tables; the pages themselves aren't
+	 * copied until somebody writes to them.
+	 */
+	for (i=0; i<PT_L1SIZE; i++) {
+		if (old->pt_l2[i] == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2SIZE; j++) {
+			oldpte = &old->pt_l2[i][j];
+			if (*oldpte == 0) {
+				continue;
+			}
+			newpte = pt_lookup(new, PT_VADDR(i, j), true);
+			if (newpte == NULL) {
+				return ENOMEM;
+			}
+			KASSERT(*newpte == 0);
+
+			pt_lock(old);
+			while (*oldpte & PTE_BUSY) {
+				pt_wait(old);
+			}
+			pte = *oldpte;
+			if (pte & PTE_VALID) {
+				coremap_addref(PTE_PADDR(pte));
+				pt_unlock(old);
+				/* NEW isn't visible to anyone else yet. */
+				*newpte = pte;
+				continue;
+			}
+			if ((pte & PTE_SWAPPED) == 0) {
+				pt_unlock(old);
+				continue;
+			}
+
+			/* In swap; give NEW its own copy there. */
+			*oldpte = pte | PTE_BUSY;
+			pt_unlock(old);
+
+			result = swap_dup(PTE_SLOT(pte), &slot);
+
+			pt_lock(old);
+			*oldpte = pte;
+			pt_wakeup(old);
+			pt_unlock(old);
+
+			if (result) {
+				return result;
+			}
+			*newpte = PTE_MKSWAPPED(slot);
+		}
+	}
+	return 0;
+}
+
+void
+pt_lock(struct pagetable *pt)
+{
+	spinlock_acquire(&pt->pt_spinlock);
+}
+
+void
+pt_unlock(struct pagetable *pt)
+{
+	spinlock_release(&pt->pt_spinlock);
+}
+
+void
+pt_wait(struct pagetable *pt)
+{
+	wchan_sleep(pt->pt_wchan, &pt->pt_spinlock);
+}
+
+void
+pt_wakeup(struct pagetable *pt)
+{
+	wchan_wakeall(pt->pt_wchan, &pt->pt_spinlock);
+}
+
+bool
+pt_tlbcache_lookup(struct pagetable *pt, vaddr_t vaddr, uint32_t *entrylo)
+{
+	struct pt_tcentry *tc;
+
+	KASSERT(spinlock_do_i_hold(&pt->pt_spinlock));
+
+	tc = &pt->pt_tlbcache[PT_TCINDEX(vaddr)];
+	if (tc->tc_entrylo == 0 || tc->tc_vaddr != vaddr) {
+		return false;
+	}
+	*entrylo = tc->tc_entrylo;
+	return true;
+}
+
+void
+pt_tlbcache_set(struct pagetable *pt, vaddr_t vaddr, uint32_t entrylo)
+{
+	struct pt_tcentry *tc;
+
+	KASSERT(spinlock_do_i_hold(&pt->pt_spinlock));
+	KASSERT(entrylo != 0);
+
+	tc = &pt->pt_tlbcache[PT_TCINDEX(vaddr)];
+	tc->tc_vaddr = vaddr;
+	tc->tc_entrylo = entrylo;
+}
+
+void
+pt_tlbcache_invalidate(struct pagetable *pt, vaddr_t vaddr)
+{
+	struct pt_tcentry *tc;
+
+	KASSERT(spinlock_do_i_hold(&pt->pt_spinlock));
+
+	tc = &pt->pt_tlbcache[PT_TCINDEX(vaddr)];
+	if (tc->tc_vaddr == vaddr) {
+		tc->tc_entrylo = 0;
+	}
+}
+
+void
+pt_tlbcache_flush(struct pagetable *pt)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&pt->pt_spinlock));
+
+	for (i=0; i<PT_TCSIZE; i++) {
+		pt->pt_tlbcache[i].tc_entrylo = 0;
+	}
+}
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap. See swap.h.
+ *
+ * Locking: swap_lock protects the slot bitmap and the pageout
+ * thread's wakeup flag. The page being paged out is pinned in the
+ * coremap, which keeps it from being freed (and thus its address
+ * space from going away) until we're done with it; its page table
+ * entry is marked PTE_BUSY while the write is in progress, so anyone
+ * faulting on it waits.
+ *
+ * Pages are paged out in batches where possible, so that the TLB
+ * shootdown for all of them can go out in one IPI per CPU.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/* The disk to swap on. test161 attaches it as disk1. */
+#define SWAP_DEVICE	"lhd0"
+
+/*
+ * The pageout thread is woken when there are fewer than SWAP_LOWATER
+ * free pages, and pages things out until there are SWAP_HIWATER.
+ */
+#define SWAP_LOWATER	16
+#define SWAP_HIWATER	32
+
+/*
+ * How many candidates per page swap_evictpages looks at before giving
+ * up. A candidate is skipped if its address space got to it first.
+ */
+#define SWAP_EVICTTRIES	8
+
+/*
+ * The pageout thread pages out up to this many pages at once, so that
+ * they can share a TLB shootdown. Must be at most VM_SHOOTDOWN_PAGES.
+ */
+#define SWAP_BATCH	8
+
+static struct vnode *swap_vn;		/* the swap disk, or NULL */
+static unsigned swap_nslots;		/* its size in pages */
+static struct bitmap *swap_map;		/* slots in use */
+static unsigned swap_nused;		/* number of slots in use */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+static struct wchan *swap_pageout_wchan;	/* pageout thread sleeps here */
+static bool swap_pageout_wanted;		/* pageout thread has work */
+
+/*
+ * Read or write one page of swap.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t pa, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vn, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vn, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+static
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_vn == NULL) {
+		return ENOSPC;
+	}
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_nused++;
+	}
+	spinlock_release(&swap_lock);
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+int
+swap_pagein(unsigned slot, paddr_t pa)
+{
+	return swap_io(slot, pa, UIO_READ);
+}
+
+int
+swap_dup(unsigned slot, unsigned *newslot)
+{
+	vaddr_t buf;
+	int result;
+
+	result = swap_alloc(newslot);
+	if (result) {
+		return result;
+	}
+
+	buf = alloc_kpages(1);
+	if (buf == 0) {
+		swap_free(*newslot);
+		return ENOMEM;
+	}
+
+	result = swap_io(slot, KVADDR_TO_PADDR(buf), UIO_READ);
+	if (result == 0) {
+		result = swap_io(*newslot, KVADDR_TO_PADDR(buf), UIO_WRITE);
+	}
+	free_kpages(buf);
+	if (result) {
+		swap_free(*newslot);
+	}
+	return result;
+}
+
+/*
+ * A page being paged out.
+ */
+struct swap_victim {
+	struct addrspace *sv_as;	/* its address space */
+	vaddr_t sv_vaddr;		/* where it is there */
+	paddr_t sv_pa;			/* the page, which is pinned */
+	pte_t *sv_pte;			/* its page table entry */
+	unsigned sv_slot;		/* where it's going */
+	int sv_result;			/* error getting sv_slot, or 0 */
+};
+
+/*
+ * Claim SV's page for paging out by marking its page table entry
+ * busy. Returns false if the mapping has changed since the coremap
+ * recorded it.
+ */
+static
+bool
+swap_claim(struct swap_victim *sv)
+{
+	struct pagetable *pt;
+
+	pt = sv->sv_as->as_pt;
+	sv->sv_pte = pt_lookup(pt, sv->sv_vaddr, false);
+	if (sv->sv_pte == NULL) {
+		return false;
+	}
+
+	pt_lock(pt);
+	if (*sv->sv_pte != (sv->sv_pa | PTE_VALID) ||
+	    coremap_refcount(sv->sv_pa) != 1) {
+		pt_unlock(pt);
+		return false;
+	}
+	*sv->sv_pte |= PTE_BUSY;
+	pt_tlbcache_invalidate(pt, sv->sv_vaddr);
+	pt_unlock(pt);
+	return true;
+}
+
+/*
+ * Write SV's page to its swap slot and free it. If that fails, put it
+ * back the way it was. The page must have been shot down.
+ */
+static
+int
+swap_write(struct swap_victim *sv)
+{
+	struct pagetable *pt;
+	int result;
+
+	result = sv->sv_result;
+	if (result == 0) {
+		result = swap_io(sv->sv_slot, sv->sv_pa, UIO_WRITE);
+		if (result) {
+			swap_free(sv->sv_slot);
+		}
+	}
+
+	pt = sv->sv_as->as_pt;
+	pt_lock(pt);
+	*sv->sv_pte = result ? (sv->sv_pa | PTE_VALID) :
+		PTE_MKSWAPPED(sv->sv_slot);
+	pt_wakeup(pt);
+	pt_unlock(pt);
+
+	if (result == 0) {
+		coremap_setowner(sv->sv_pa, NULL, 0);
+	}
+	coremap_unpin(sv->sv_pa);
+	if (result == 0) {
+		coremap_free(sv->sv_pa);
+	}
+	return result;
+}
+
+/*
+ * Page out up to NPAGES (at most SWAP_BATCH) pages. Returns the
+ * number paged out.
+ *
+ * All the pages are claimed first, so one shootdown covers them all.
+ */
+static
+unsigned
+swap_evictpages(unsigned npages)
+{
+	struct swap_victim victims[SWAP_BATCH];
+	struct vm_shootdown sd;
+	struct swap_victim *sv;
+	unsigned i, n, tries, done;
+
+	KASSERT(npages <= SWAP_BATCH);
+
+	if (swap_vn == NULL) {
+		return 0;
+	}
+
+	/* Don't bother claiming pages there's no room for. */
+	if (npages > swap_nslots - swap_nused) {
+		npages = swap_nslots - swap_nused;
+	}
+
+	vm_shootdown_init(&sd);
+	n = 0;
+	for (tries=0; n < npages && tries < npages * SWAP_EVICTTRIES;
+	     tries++) {
+		sv = &victims[n];
+		sv->sv_pa = coremap_pickvictim(&sv->sv_as, &sv->sv_vaddr);
+		if (sv->sv_pa == 0) {
+			break;
+		}
+		if (!swap_claim(sv)) {
+			coremap_unpin(sv->sv_pa);
+			continue;
+		}
+		vm_shootdown_add(&sd, sv->sv_as, sv->sv_vaddr);
+		n++;
+	}
+
+	/* Find slots for the pages while the other CPUs do the shootdown. */
+	vm_shootdown_start(&sd);
+	for (i=0; i<n; i++) {
+		victims[i].sv_result = swap_alloc(&victims[i].sv_slot);
+	}
+	vm_shootdown_wait(&sd);
+
+	done = 0;
+	for (i=0; i<n; i++) {
+		if (swap_write(&victims[i]) == 0) {
+			done++;
+		}
+	}
+	return done;
+}
+
+int
+swap_evict(void)
+{
+	return swap_evictpages(1) > 0 ? 0 : ENOMEM;
+}
+
+void
+swap_kick(void)
+{
+	if (swap_vn == NULL || coremap_freepages() >= SWAP_LOWATER) {
+		return;
+	}
+
+	spinlock_acquire(&swap_lock);
+	if (!swap_pageout_wanted) {
+		swap_pageout_wanted = true;
+		wchan_wakeone(swap_pageout_wchan, &swap_lock);
+	}
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * The pageout thread.
+ */
+static
+void
+swap_pageout_thread(void *data1, unsigned long data2)
+{
+	unsigned nfree, want;
+
+	(void)data1;
+	(void)data2;
+
+	spinlock_acquire(&swap_lock);
+	while (1) {
+		while (!swap_pageout_wanted) {
+			wchan_sleep(swap_pageout_wchan, &swap_lock);
+		}
+		spinlock_release(&swap_lock);
+
+		while ((nfree = coremap_freepages()) < SWAP_HIWATER) {
+			want = SWAP_HIWATER - nfree;
+			if (want > SWAP_BATCH) {
+				want = SWAP_BATCH;
+			}
+			if (swap_evictpages(want) == 0) {
+				break;
+			}
+		}
+
+		spinlock_acquire(&swap_lock);
+		swap_pageout_wanted = false;
+	}
+}
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vn);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vn = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vn, &st);
+	if (result) {
+		panic("swap: %s: VOP_STAT: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s: too small; running without swap\n",
+			SWAP_DEVICE);
+		VOP_DECREF(swap_vn);
+		vfs_swapoff(SWAP_DEVICE);
+		swap_vn = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_pageout_wchan = wchan_create("pageout");
+	if (swap_map == NULL || swap_pageout_wchan == NULL) {
+		panic("swap: Out of memory\n");
+	}
+
+	result = thread_fork("pageout", NULL, swap_pageout_thread, NULL, 0);
+	if (result) {
+		panic("swap: thread_fork: %s\n", strerror(result));
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
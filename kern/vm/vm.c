@@ -0,0 +1,648 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The VM system proper: page faults, the TLB, and kernel pages.
+ * Address spaces are in addrspace.c, page tables in pagetable.c, and
+ * physical memory in coremap.c.
+ *
+ * Note! As with addrspace.c, if OPT_DUMBVM is set this file is not
+ * used; dumbvm.c is used instead.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/*
+ * How many pages an allocation of one page may page out before
+ * giving up. (Multi-page allocations get proportionally more.)
+ */
+#define VM_EVICTTRIES	4
+
+/*
+ * TLB shootdown batches in flight. vm_shootdown_slots limits them to
+ * TLBSHOOTDOWN_MAX at once, so no CPU's queue can overflow; targets
+ * acknowledge a batch under vm_shootdown_lock and wake the sender on
+ * vm_shootdown_wchan.
+ */
+static struct semaphore *vm_shootdown_slots;
+static struct spinlock vm_shootdown_lock = SPINLOCK_INITIALIZER;
+static struct wchan *vm_shootdown_wchan;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	as_bootstrap();
+
+	vm_shootdown_slots = sem_create("shootdown", TLBSHOOTDOWN_MAX);
+	vm_shootdown_wchan = wchan_create("shootdown");
+	if (vm_shootdown_slots == NULL || vm_shootdown_wchan == NULL) {
+		panic("vm: Out of memory\n");
+	}
+
+	swap_bootstrap();
+}
+
+/*
+ * Check if we're in a context that can sleep, as in dumbvm.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/*
+ * Allocate NPAGES physical pages, paging other pages out if
+ * necessary.
+ */
+static
+paddr_t
+vm_getpages(unsigned npages)
+{
+	paddr_t pa;
+	unsigned i;
+
+	pa = coremap_alloc(npages);
+	for (i=0; pa == 0 && i < npages * VM_EVICTTRIES; i++) {
+		if (swap_evict()) {
+			break;
+		}
+		pa = coremap_alloc(npages);
+	}
+	swap_kick();
+	return pa;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	vm_can_sleep();
+	pa = vm_getpages(npages);
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+////////////////////////////////////////////////////////////
+// TLB
+
+/*
+ * Address space IDs.
+ *
+ * TLB entries are tagged with the ASID of the address space they
+ * belong to, so switching address spaces doesn't mean flushing the
+ * TLB. Each CPU hands out its own ASIDs, 1 to NUM_ASID-1, in order,
+ * and records which one each address space got in its as_asid[],
+ * along with the CPU's current generation number. When a CPU runs
+ * out it flushes its TLB and starts a new generation, which makes all
+ * the ASIDs it handed out before stale.
+ *
+ * curcpu->c_asid is the ASID the TLB is matching (which is also
+ * in the entryhi register). Everything here runs at splhigh.
+ */
+#define ASID_MAKE(gen, asid)	((gen) * NUM_ASID + (asid))
+#define ASID_GEN(x)		((x) / NUM_ASID)
+#define ASID_NUM(x)		((x) % NUM_ASID)
+#define ASID_EHI(vaddr, asid)	((vaddr) | ((asid) << TLBHI_PIDSHIFT))
+
+/*
+ * Invalidate all of this CPU's TLB.
+ */
+static
+void
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(ASID_EHI(TLBHI_INVALID(i), curcpu->c_asid),
+			  TLBLO_INVALID(), i);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Make the TLB match ASID. There's no separate way to load entryhi,
+ * but probing for an address that's never mapped loads it and
+ * changes nothing else.
+ */
+static
+void
+vm_tlbsetasid(unsigned asid)
+{
+	curcpu->c_asid = asid;
+	tlb_probe(ASID_EHI(TLBHI_INVALID(0), asid), 0);
+}
+
+/*
+ * Return AS's ASID on this CPU, or 0 if it doesn't have a current
+ * one. If CREATE is true, give it one.
+ */
+static
+unsigned
+vm_getasid(struct addrspace *as, bool create)
+{
+	struct cpu *c;
+	unsigned *asid;
+
+	c = curcpu->c_self;
+	KASSERT(c->c_number < VM_MAXCPUS);
+	asid = &as->as_asid[c->c_number];
+
+	if (*asid != 0 && ASID_GEN(*asid) == c->c_asidgen) {
+		return ASID_NUM(*asid);
+	}
+	if (!create) {
+		return 0;
+	}
+
+	if (c->c_asidnext == 0 || c->c_asidnext == NUM_ASID) {
+		/* Out of ASIDs (or never had any); start over. */
+		c->c_asidgen++;
+		c->c_asidnext = 1;
+		vm_tlbflush();
+	}
+	*asid = ASID_MAKE(c->c_asidgen, c->c_asidnext);
+	c->c_asidnext++;
+	return ASID_NUM(*asid);
+}
+
+/*
+ * Make AS the address space the TLB matches.
+ */
+void
+vm_tlbactivate(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	vm_tlbsetasid(vm_getasid(as, true));
+	splx(spl);
+}
+
+/*
+ * Get rid of all TLB entries for AS, which must be the current
+ * address space. Rather than hunting them down, forget AS's ASIDs:
+ * it gets a new one here, and on the other CPUs the next time it
+ * runs there. (This assumes it isn't running on another CPU right
+ * now, which is true as long as processes have only one thread.)
+ */
+void
+vm_tlbflush_as(struct addrspace *as)
+{
+	unsigned i;
+	int spl;
+
+	KASSERT(as == proc_getas());
+
+	spl = splhigh();
+	for (i=0; i<VM_MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	vm_tlbsetasid(vm_getasid(as, true));
+	splx(spl);
+
+	pt_lock(as->as_pt);
+	pt_tlbcache_flush(as->as_pt);
+	pt_unlock(as->as_pt);
+}
+
+/*
+ * Invalidate VADDR of AS in this CPU's TLB.
+ */
+static
+void
+vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned asid;
+	int index, spl;
+
+	spl = splhigh();
+	asid = vm_getasid(as, false);
+	if (asid != 0) {
+		index = tlb_probe(ASID_EHI(vaddr, asid), 0);
+		if (index >= 0) {
+			tlb_write(ASID_EHI(TLBHI_INVALID(index),
+					   curcpu->c_asid),
+				  TLBLO_INVALID(), index);
+		}
+		vm_tlbsetasid(curcpu->c_asid);
+	}
+	splx(spl);
+}
+
+/*
+ * Handle a shootdown request from another CPU.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	struct vm_shootdown *sd;
+	unsigned i;
+
+	sd = ts->ts_batch;
+	for (i=0; i<sd->sd_npages; i++) {
+		vm_tlbinvalidate(sd->sd_as[i], sd->sd_vaddr[i]);
+	}
+
+	/* Once we've acknowledged it, SD may disappear. */
+	spinlock_acquire(&vm_shootdown_lock);
+	KASSERT(sd->sd_pending > 0);
+	sd->sd_pending--;
+	if (sd->sd_pending == 0) {
+		wchan_wakeall(vm_shootdown_wchan, &vm_shootdown_lock);
+	}
+	spinlock_release(&vm_shootdown_lock);
+}
+
+void
+vm_shootdown_init(struct vm_shootdown *sd)
+{
+	sd->sd_npages = 0;
+	sd->sd_pending = 0;
+}
+
+bool
+vm_shootdown_add(struct vm_shootdown *sd, struct addrspace *as,
+		 vaddr_t vaddr)
+{
+	if (sd->sd_npages == VM_SHOOTDOWN_PAGES) {
+		return false;
+	}
+	sd->sd_as[sd->sd_npages] = as;
+	sd->sd_vaddr[sd->sd_npages] = vaddr;
+	sd->sd_npages++;
+	return true;
+}
+
+/*
+ * Invalidate SD's pages in every TLB that may have them.
+ *
+ * The CPUs that may have entries for an address space are the ones
+ * where it has an ASID; as_asid serves as the address space's CPU
+ * mask. (If the ASID is from an old generation on some CPU, that CPU
+ * gets a request it didn't need, and ignores it.) A CPU can't get a
+ * new entry for a page after we start, because the caller has marked
+ * its page table entry busy.
+ */
+void
+vm_shootdown_start(struct vm_shootdown *sd)
+{
+	struct tlbshootdown ts;
+	uint32_t cpumask;
+	unsigned i, j, n, sent;
+	int spl;
+
+	vm_can_sleep();
+
+	if (sd->sd_npages == 0) {
+		return;
+	}
+
+	P(vm_shootdown_slots);
+
+	/* Stay on this CPU until the requests are sent. */
+	spl = splhigh();
+
+	cpumask = 0;
+	for (i=0; i<sd->sd_npages; i++) {
+		vm_tlbinvalidate(sd->sd_as[i], sd->sd_vaddr[i]);
+		for (j=0; j<VM_MAXCPUS; j++) {
+			if (sd->sd_as[i]->as_asid[j] != 0) {
+				cpumask |= (uint32_t)1 << j;
+			}
+		}
+	}
+	cpumask &= ~((uint32_t)1 << curcpu->c_number);
+
+	n = 0;
+	for (j=0; j<VM_MAXCPUS; j++) {
+		if (cpumask & ((uint32_t)1 << j)) {
+			n++;
+		}
+	}
+
+	/* Must be set before anyone can acknowledge. */
+	sd->sd_pending = n;
+	ts.ts_batch = sd;
+	sent = ipi_tlbshootdown_mask(cpumask, &ts);
+	KASSERT(sent == n);
+
+	splx(spl);
+}
+
+/*
+ * Wait until every CPU vm_shootdown_start sent SD to has done it.
+ */
+void
+vm_shootdown_wait(struct vm_shootdown *sd)
+{
+	if (sd->sd_npages == 0) {
+		return;
+	}
+
+	spinlock_acquire(&vm_shootdown_lock);
+	while (sd->sd_pending > 0) {
+		wchan_sleep(vm_shootdown_wchan, &vm_shootdown_lock);
+	}
+	spinlock_release(&vm_shootdown_lock);
+
+	V(vm_shootdown_slots);
+}
+
+/*
+ * Load ENTRYLO for VADDR of the current address space into the TLB,
+ * replacing any existing entry for VADDR, and otherwise a random one.
+ */
+static
+void
+vm_tlbload(vaddr_t vaddr, uint32_t entrylo)
+{
+	uint32_t ehi;
+	int index, spl;
+
+	spl = splhigh();
+	ehi = ASID_EHI(vaddr, curcpu->c_asid);
+	index = tlb_probe(ehi, 0);
+	if (index >= 0) {
+		tlb_write(ehi, entrylo, index);
+	}
+	else {
+		tlb_random(ehi, entrylo);
+	}
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+// faults
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	struct pagetable *pt;
+	pte_t *pte, old;
+	paddr_t pa;
+	uint32_t elo;
+	bool writeable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	/* Statistics only; a preemption here might lose a count. */
+	curcpu->c_tlbfaults++;
+
+	/*
+	 * Plain TLB misses on pages we've mapped before can usually be
+	 * refilled from the page table's TLB cache. (Misses on writes
+	 * only if the cached entry is writeable, or we'd just take a
+	 * VM_FAULT_READONLY next.)
+	 */
+	pt = as->as_pt;
+	if (faulttype != VM_FAULT_READONLY) {
+		pt_lock(pt);
+		if (pt_tlbcache_lookup(pt, faultaddress, &elo) &&
+		    (faulttype == VM_FAULT_READ || (elo & TLBLO_DIRTY))) {
+			coremap_touch(elo & TLBLO_PPAGE);
+			vm_tlbload(faultaddress, elo);
+			pt_unlock(pt);
+			curcpu->c_tlbrefills++;
+			return 0;
+		}
+		pt_unlock(pt);
+	}
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+
+	writeable = rg->rg_writeable || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	pt_lock(pt);
+	while (*pte & PTE_BUSY) {
+		pt_wait(pt);
+	}
+
+	if ((*pte & PTE_VALID) == 0) {
+		/*
+		 * First touch (zero-fill) or paged out. Either way
+		 * we need a new page, which may mean paging something
+		 * else out; mark the entry busy so nobody else in
+		 * this address space tries to fill it meanwhile.
+		 */
+		old = *pte;
+		*pte = old | PTE_BUSY;
+		pt_unlock(pt);
+
+		result = 0;
+		pa = vm_getpages(1);
+		if (pa == 0) {
+			result = ENOMEM;
+		}
+		else if (old & PTE_SWAPPED) {
+			result = swap_pagein(PTE_SLOT(old), pa);
+		}
+		else {
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+		}
+
+		pt_lock(pt);
+		*pte = result ? old : (pa | PTE_VALID);
+		pt_wakeup(pt);
+		pt_unlock(pt);
+
+		if (result) {
+			if (pa != 0) {
+				coremap_free(pa);
+			}
+			return result;
+		}
+		if (old & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(old));
+		}
+		pt_lock(pt);
+		while (*pte & PTE_BUSY) {
+			pt_wait(pt);
+		}
+	}
+
+	pa = 0;
+	if ((*pte & PTE_VALID) && writeable &&
+	    coremap_refcount(PTE_PADDR(*pte)) > 1) {
+		/*
+		 * Shared copy-on-write (see as_copy). If this is a
+		 * write, make our own copy; otherwise map it
+		 * read-only, and we'll be back with VM_FAULT_READONLY
+		 * if there's a write later.
+		 */
+		if (faulttype == VM_FAULT_READ) {
+			writeable = false;
+		}
+		else {
+			old = *pte;
+			*pte = old | PTE_BUSY;
+			pt_unlock(pt);
+
+			pa = vm_getpages(1);
+			if (pa != 0) {
+				memmove((void *)PADDR_TO_KVADDR(pa),
+					(const void *)
+					PADDR_TO_KVADDR(PTE_PADDR(old)),
+					PAGE_SIZE);
+			}
+
+			pt_lock(pt);
+			*pte = (pa != 0) ? (pa | PTE_VALID) : old;
+			pt_wakeup(pt);
+			if (pa == 0) {
+				pt_unlock(pt);
+				return ENOMEM;
+			}
+			/* Drop our reference to the shared page below. */
+			pa = PTE_PADDR(old);
+		}
+	}
+
+	if ((*pte & PTE_VALID) == 0) {
+		/* Paged out again already; let it fault again. */
+		pt_unlock(pt);
+		if (pa != 0) {
+			coremap_free(pa);
+		}
+		return 0;
+	}
+
+	/*
+	 * If the page is ours alone, it can be paged out; tell the
+	 * coremap where to find it.
+	 */
+	if (coremap_refcount(PTE_PADDR(*pte)) == 1) {
+		coremap_setowner(PTE_PADDR(*pte), as, faultaddress);
+	}
+	coremap_touch(PTE_PADDR(*pte));
+
+	/*
+	 * Note that a VM_FAULT_READONLY on a page that is no longer
+	 * shared (because the other side already copied it) just
+	 * remaps it writeable here. We load the TLB with the page
+	 * table locked so the pager can't be paging it out meanwhile.
+	 */
+	elo = PTE_PADDR(*pte) | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+	pt_tlbcache_set(pt, faultaddress, elo);
+	vm_tlbload(faultaddress, elo);
+	pt_unlock(pt);
+
+	if (pa != 0) {
+		coremap_free(pa);
+	}
+	return 0;
+}
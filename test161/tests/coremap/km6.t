@@ -0,0 +1,10 @@
+---
+name: "kmalloc Scalability Test"
+description: >
+  Measures the kmalloc/kfree rate of 1 to 8 concurrent threads on 8 CPUs.
+tags: [coremap]
+depends: [boot]
+sys161:
+  cpus: 8
+---
+| km6
@@ -0,0 +1,9 @@
+---
+name: "kfree Cost Test"
+description: >
+  Measures the cost of kfree as the number of allocated blocks in the kernel
+  heap grows.
+tags: [coremap]
+depends: [boot]
+---
+| km7
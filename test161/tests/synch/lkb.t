@@ -0,0 +1,11 @@
+---
+name: "Lock Benchmark"
+description: >
+  Compares adaptive spin-then-sleep locking against pure sleeping
+  under contention.
+tags: [synch, locks]
+depends: [boot, semaphores]
+sys161:
+  cpus: 4
+---
+lkb
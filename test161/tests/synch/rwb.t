@@ -0,0 +1,10 @@
+---
+name: "RW Lock Benchmark"
+description: >
+  Measures reader-writer lock read throughput with 1 to 8 CPUs.
+tags: [synch, rwlocks]
+depends: [boot, semaphores]
+sys161:
+  cpus: 8
+---
+rwb
@@ -0,0 +1,10 @@
+---
+name: "Spinlock Benchmark"
+description: >
+  Measures spinlock throughput and fairness with one thread per CPU.
+tags: [synch]
+depends: [boot, semaphores]
+sys161:
+  cpus: 8
+---
+slb
@@ -0,0 +1,8 @@
+---
+name: "Futex Benchmark"
+description: >
+  Times uncontended user mutexes and the futex wait/wake system calls.
+tags: [syscalls]
+depends: [console]
+---
+p /testbin/futexbench
@@ -0,0 +1,9 @@
+---
+name: "Sequential Read Benchmark"
+description: >
+  Times sequential and backward reads of a scratch file with several
+  buffer sizes and checks the data read back.
+tags: [syscalls]
+depends: [console]
+---
+p /testbin/seqread
@@ -0,0 +1,11 @@
+---
+name: "Timeout Test"
+description: >
+  Checks timeouts and timed waits, and measures how late timed
+  sleeps wake up.
+tags: [threads]
+depends: [boot]
+sys161:
+  cpus: 4
+---
+tmo
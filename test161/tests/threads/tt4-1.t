@@ -0,0 +1,10 @@
+---
+name: "Thread Test 4 (1 CPU)"
+description: >
+  Measures CPU-bound throughput with 1 to 32 threads on 1 CPU.
+tags: [threads, scaling]
+depends: [boot]
+sys161:
+  cpus: 1
+---
+tt4
@@ -0,0 +1,10 @@
+---
+name: "Thread Test 4 (16 CPUs)"
+description: >
+  Measures CPU-bound throughput with 1 to 32 threads on 16 CPUs.
+tags: [threads, scaling]
+depends: [boot]
+sys161:
+  cpus: 16
+---
+tt4
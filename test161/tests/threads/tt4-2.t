@@ -0,0 +1,10 @@
+---
+name: "Thread Test 4 (2 CPUs)"
+description: >
+  Measures CPU-bound throughput with 1 to 32 threads on 2 CPUs.
+tags: [threads, scaling]
+depends: [boot]
+sys161:
+  cpus: 2
+---
+tt4
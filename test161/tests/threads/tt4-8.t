@@ -0,0 +1,10 @@
+---
+name: "Thread Test 4 (8 CPUs)"
+description: >
+  Measures CPU-bound throughput with 1 to 32 threads on 8 CPUs.
+tags: [threads, scaling]
+depends: [boot]
+sys161:
+  cpus: 8
+---
+tt4
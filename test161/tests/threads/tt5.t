@@ -0,0 +1,9 @@
+---
+name: "Thread Test 5"
+description: >
+  Measures thread_fork/thread_exit round-trip latency with and without
+  the thread cache.
+tags: [threads]
+depends: [boot]
+---
+tt5
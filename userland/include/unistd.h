@@ -148,6 +148,9 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int futex_wait(volatile int *uaddr, int val);
+int futex_wake(volatile int *uaddr, int count);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
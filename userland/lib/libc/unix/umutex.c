@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <umutex.h>
+
+/*
+ * User-level mutex: see umutex.h.
+ *
+ * This is the usual three-state futex mutex. um_state is 0 when the
+ * mutex is free, 1 when it's held and nobody is sleeping on it, and 2
+ * when it's held and somebody may be. Lockers that find it held set
+ * it to 2 before sleeping, so the unlocker knows to call futex_wake;
+ * an unlock that finds 1 knows nobody is asleep and stays in user
+ * space.
+ */
+
+/*
+ * Atomic compare-and-swap using LL/SC: if *p is OLD, set it to NEW.
+ * Returns the value that was in *p.
+ */
+static
+int
+cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if x != old, give up */
+		"move %1, %4;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the store failed */
+		"2: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+/*
+ * Atomic exchange: set *p to NEW and return what was there.
+ */
+static
+int
+xchg(volatile int *p, int new)
+{
+	int old;
+
+	do {
+		old = *p;
+	} while (cas(p, old, new) != old);
+	return old;
+}
+
+void
+umutex_init(struct umutex *m)
+{
+	m->um_state = 0;
+}
+
+int
+umutex_trylock(struct umutex *m)
+{
+	return cas(&m->um_state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+umutex_lock(struct umutex *m)
+{
+	int c;
+
+	/* Fast path: free, so take it. */
+	c = cas(&m->um_state, 0, 1);
+	if (c == 0) {
+		return;
+	}
+
+	/*
+	 * Held. Mark it contended and sleep until it's released. If
+	 * the exchange returns 0 it was just released and we now hold
+	 * it (marked contended, which costs at most a spare wakeup).
+	 * futex_wait fails at once if the state is no longer 2.
+	 */
+	if (c != 2) {
+		c = xchg(&m->um_state, 2);
+	}
+	while (c != 0) {
+		futex_wait(&m->um_state, 2);
+		c = xchg(&m->um_state, 2);
+	}
+}
+
+void
+umutex_unlock(struct umutex *m)
+{
+	if (xchg(&m->um_state, 0) == 2) {
+		futex_wake(&m->um_state, 1);
+	}
+}
@@ -163,6 +163,9 @@ dumpsb(void)
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
 	dumplval("Volume name", sb.sb_volname);
+	dumpvalf("Features", "0x%x%s", SWAP32(sb.sb_features),
+		 (SWAP32(sb.sb_features) & SFS_FEATURE_HASHDIR) ?
+		 " (hashed directories)" : "");
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
@@ -179,7 +179,8 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 			      pathsofar);
 			dchanged = 1;
 		}
-		else if (sfsdir_tryadd(direntries, maxdirentries, ".",
+		else if (!sb_hashdirs() &&
+			 sfsdir_tryadd(direntries, maxdirentries, ".",
 				       ino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `.' entry (added)",
@@ -208,7 +209,8 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 			      pathsofar);
 			dchanged = 1;
 		}
-		else if (sfsdir_tryadd(direntries, maxdirentries, "..",
+		else if (!sb_hashdirs() &&
+			 sfsdir_tryadd(direntries, maxdirentries, "..",
 				    parentino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `..' entry (added)",
@@ -297,6 +299,30 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		ichanged = 1;
 	}
 
+	/*
+	 * In a hashed directory every entry must be reachable from its
+	 * home slot. Renaming or adding entries above can break that,
+	 * as can a kernel that doesn't know about hashing; rebuild the
+	 * table if so. (Growing the directory is not attempted; the
+	 * extra blocks would have to be allocated.)
+	 */
+
+	if (sb_hashdirs()) {
+		if (!sfsdir_hashsizeok(ndirentries)) {
+			setbadness(EXIT_UNRECOV);
+			warnx("Directory %s: Invalid size %lu for hashed "
+			      "directory (NOT FIXED)", pathsofar,
+			      (unsigned long) sfi.sfi_size);
+		}
+		else if (sfsdir_hashcheck(direntries, ndirentries) > 0) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: Entries out of hash order "
+			      "(rehashed)", pathsofar);
+			sfsdir_rehash(direntries, ndirentries);
+			dchanged = 1;
+		}
+	}
+
 	/*
 	 * Write back anything that changed, clean up, and return.
 	 */
@@ -55,6 +55,11 @@ sb_load(void)
 		errx(EXIT_FATAL, "Not an sfs filesystem");
 	}
 
+	if (sb.sb_features & ~SFS_FEATURES_KNOWN) {
+		errx(EXIT_FATAL, "Unsupported features 0x%lx in superblock",
+		     (unsigned long) (sb.sb_features & ~SFS_FEATURES_KNOWN));
+	}
+
 	assert(sb.sb_nblocks > 0);
 	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks) > 0);
 }
@@ -114,6 +119,15 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return true if the volume has hashed directories.
+ */
+int
+sb_hashdirs(void)
+{
+	return (sb.sb_features & SFS_FEATURE_HASHDIR) != 0;
+}
+
 /*
  * Return the volume name.
  */
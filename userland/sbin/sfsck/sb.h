@@ -49,6 +49,9 @@ uint32_t sb_freemapblocks(void);
 /* After the superblock is loaded: return volume name. */
 const char *sb_volname(void);
 
+/* After the superblock is loaded: return true if directories are hashed. */
+int sb_hashdirs(void);
+
 /* Check the superblock. Must load it first. */
 void sb_check(void);
 
@@ -62,6 +62,7 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_features = SWAP32(sb->sb_features);
 }
 
 static
@@ -462,3 +463,84 @@ sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
 	}
 	return -1;
 }
+
+/*
+ * Hashed directory support; see <kern/sfs.h>. ND, the number of
+ * slots, must be a power of 2.
+ */
+
+static
+unsigned
+sfsdir_hashhome(const char *name, unsigned nd)
+{
+	uint32_t h;
+
+	h = SFS_HASHDIR_HASHINIT;
+	while (*name) {
+		h = SFS_HASHDIR_HASHSTEP(h, *name);
+		name++;
+	}
+	return h & (nd - 1);
+}
+
+/*
+ * Check if ND is a valid number of slots for a hashed directory.
+ */
+int
+sfsdir_hashsizeok(unsigned nd)
+{
+	return nd == 0 || (nd >= SFS_HASHDIR_MINSLOTS && (nd & (nd-1)) == 0);
+}
+
+/*
+ * Count the entries in D (a hashed directory with ND slots) that
+ * can't be reached from their home slot without crossing a free
+ * slot.
+ */
+unsigned
+sfsdir_hashcheck(struct sfs_direntry *d, unsigned nd)
+{
+	unsigned i, j, bad;
+
+	bad = 0;
+	for (i=0; i<nd; i++) {
+		if (d[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		for (j = sfsdir_hashhome(d[i].sfd_name, nd); j != i;
+		     j = (j + 1) & (nd - 1)) {
+			if (d[j].sfd_ino == SFS_NOINO) {
+				bad++;
+				break;
+			}
+		}
+	}
+	return bad;
+}
+
+/*
+ * Put every entry in D (a hashed directory with ND slots) back where
+ * a lookup will find it.
+ */
+void
+sfsdir_rehash(struct sfs_direntry *d, unsigned nd)
+{
+	struct sfs_direntry *tmp;
+	unsigned i, j;
+
+	tmp = domalloc(nd * sizeof(*tmp));
+	memcpy(tmp, d, nd * sizeof(*tmp));
+	bzero(d, nd * sizeof(*d));
+
+	for (i=0; i<nd; i++) {
+		if (tmp[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		j = sfsdir_hashhome(tmp[i].sfd_name, nd);
+		while (d[j].sfd_ino != SFS_NOINO) {
+			j = (j + 1) & (nd - 1);
+		}
+		d[j] = tmp[i];
+	}
+	free(tmp);
+}
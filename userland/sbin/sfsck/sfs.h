@@ -77,5 +77,10 @@ int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 
+/* Hashed directories: check the size, check and fix entry placement. */
+int sfsdir_hashsizeok(unsigned nd);
+unsigned sfsdir_hashcheck(struct sfs_direntry *d, unsigned nd);
+void sfsdir_rehash(struct sfs_direntry *d, unsigned nd);
+
 
 #endif /* SFS_H */
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futexbench - time user-level locking.
+ *
+ * Measures, per operation:
+ *    - an uncontended umutex lock/unlock pair, which should never
+ *      enter the kernel;
+ *    - futex_wake with nobody asleep, and futex_wait on a word that
+ *      has already changed, which are the cheapest possible trips
+ *      into the futex code;
+ *    - a semfs P/V pair, for comparison, if semfs is available.
+ *
+ * Also checks that the futex calls fail the way they should for a
+ * misaligned address.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <umutex.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define MUTEXLOOPS	100000
+#define SYSCALLLOOPS	10000
+
+static struct umutex mtx = UMUTEX_INITIALIZER;
+static volatile int word;
+
+/*
+ * Start/stop timer; report nanoseconds per operation.
+ */
+static time_t startsecs;
+static unsigned long startnsecs;
+
+static
+void
+timer_start(void)
+{
+	__time(&startsecs, &startnsecs);
+}
+
+static
+void
+timer_report(const char *what, unsigned loops)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned long long total;
+
+	__time(&secs, &nsecs);
+	total = (secs - startsecs) * 1000000000ULL;
+	total += nsecs;
+	total -= startnsecs;
+	printf("%-32s %llu ns\n", what, total / loops);
+}
+
+static
+void
+bench_umutex(void)
+{
+	unsigned i;
+
+	timer_start();
+	for (i=0; i<MUTEXLOOPS; i++) {
+		umutex_lock(&mtx);
+		umutex_unlock(&mtx);
+	}
+	timer_report("umutex lock/unlock:", MUTEXLOOPS);
+
+	if (umutex_trylock(&mtx) != 0) {
+		errx(1, "trylock of a free umutex failed");
+	}
+	if (umutex_trylock(&mtx) == 0) {
+		errx(1, "trylock of a held umutex succeeded");
+	}
+	umutex_unlock(&mtx);
+}
+
+static
+void
+bench_futex(void)
+{
+	unsigned i;
+	int r;
+
+	timer_start();
+	for (i=0; i<SYSCALLLOOPS; i++) {
+		r = futex_wake(&word, 1);
+		if (r != 0) {
+			err(1, "futex_wake");
+		}
+	}
+	timer_report("futex_wake, no sleepers:", SYSCALLLOOPS);
+
+	word = 1;
+	timer_start();
+	for (i=0; i<SYSCALLLOOPS; i++) {
+		r = futex_wait(&word, 0);
+		if (r != -1 || errno != EAGAIN) {
+			errx(1, "futex_wait on a stale value didn't fail "
+			     "with EAGAIN");
+		}
+	}
+	timer_report("futex_wait, value changed:", SYSCALLLOOPS);
+
+	r = futex_wake((volatile int *)((char *)&word + 1), 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "futex_wake on a misaligned address didn't fail "
+		     "with EINVAL");
+	}
+}
+
+static
+void
+bench_semfs(void)
+{
+	static const char name[] = "sem:futexbench";
+	unsigned i;
+	int fd;
+	char c;
+
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		warn("%s: skipping semfs comparison", name);
+		return;
+	}
+	c = 0;
+
+	timer_start();
+	for (i=0; i<SYSCALLLOOPS; i++) {
+		if (write(fd, &c, 1) != 1) {
+			err(1, "%s: write", name);
+		}
+		if (read(fd, &c, 1) != 1) {
+			err(1, "%s: read", name);
+		}
+	}
+	timer_report("semfs V/P:", SYSCALLLOOPS);
+
+	close(fd);
+	(void)remove(name);
+}
+
+int
+main(void)
+{
+	bench_umutex();
+	bench_futex();
+	bench_semfs();
+	success(TEST161_SUCCESS, SECRET, "/testbin/futexbench");
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * seqread - time sequential file reads.
+ *
+ * Usage: seqread [file]
+ *
+ * Reads the file start to finish with several buffer sizes and
+ * reports the throughput of each, then reads it backwards (which
+ * defeats read-ahead) for comparison. With no file, makes a scratch
+ * file, checks that what's read back is what was written, and
+ * removes it afterwards.
+ *
+ * Try it both on an SFS volume and on emu0:, e.g. on /testbin/huge.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define SCRATCHFILE	"seqread.tmp"
+#define SCRATCHSIZE	(512*1024)
+#define MAXBUF		16384
+
+static char buf[MAXBUF];
+static int checking;
+
+/*
+ * Start/stop timer; report throughput.
+ */
+static time_t startsecs;
+static unsigned long startnsecs;
+
+static
+void
+timer_start(void)
+{
+	__time(&startsecs, &startnsecs);
+}
+
+static
+void
+timer_report(const char *what, unsigned bufsize, unsigned long long bytes)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned long long total, kbps;
+
+	__time(&secs, &nsecs);
+	total = (secs - startsecs) * 1000000000ULL;
+	total += nsecs;
+	total -= startnsecs;
+	if (total == 0) {
+		total = 1;
+	}
+	kbps = bytes * 1000000000ULL / 1024 / total;
+	printf("%-10s %5u-byte reads: %llu bytes in %llu.%03llu s, "
+	       "%llu.%02llu MB/s\n", what, bufsize, bytes,
+	       total / 1000000000ULL, (total / 1000000ULL) % 1000,
+	       kbps / 1024, (kbps % 1024) * 100 / 1024);
+}
+
+/*
+ * The byte at offset POS of the scratch file.
+ */
+static
+char
+pattern(off_t pos)
+{
+	return (char)((pos / 512) * 7 + pos);
+}
+
+static
+void
+checkbuf(off_t pos, size_t len)
+{
+	size_t i;
+
+	if (!checking) {
+		return;
+	}
+	for (i=0; i<len; i++) {
+		if (buf[i] != pattern(pos + i)) {
+			errx(1, "Wrong data at offset %lld", pos + i);
+		}
+	}
+}
+
+static
+void
+makescratch(void)
+{
+	off_t pos;
+	size_t i;
+	ssize_t r;
+	int fd;
+
+	fd = open(SCRATCHFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SCRATCHFILE);
+	}
+	for (pos = 0; pos < SCRATCHSIZE; pos += MAXBUF) {
+		for (i=0; i<MAXBUF; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		r = write(fd, buf, MAXBUF);
+		if (r < 0) {
+			err(1, "%s: write", SCRATCHFILE);
+		}
+		if (r != MAXBUF) {
+			errx(1, "%s: short write", SCRATCHFILE);
+		}
+	}
+	if (fsync(fd) < 0) {
+		/* not fatal; the numbers will just be for cached data */
+		warn("%s: fsync", SCRATCHFILE);
+	}
+	close(fd);
+}
+
+/*
+ * Read the whole file front to back BUFSIZE bytes at a time. Returns
+ * the file size.
+ */
+static
+off_t
+readforward(const char *file, unsigned bufsize)
+{
+	off_t pos;
+	ssize_t r;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	pos = 0;
+	timer_start();
+	while (1) {
+		r = read(fd, buf, bufsize);
+		if (r < 0) {
+			err(1, "%s: read", file);
+		}
+		if (r == 0) {
+			break;
+		}
+		checkbuf(pos, r);
+		pos += r;
+	}
+	timer_report("forward", bufsize, pos);
+	close(fd);
+	return pos;
+}
+
+/*
+ * Read the file back to front, BUFSIZE bytes at a time.
+ */
+static
+void
+readbackward(const char *file, unsigned bufsize, off_t size)
+{
+	off_t pos, total;
+	size_t len;
+	ssize_t r;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	total = 0;
+	timer_start();
+	for (pos = size; pos > 0; pos -= len) {
+		len = pos < bufsize ? pos : bufsize;
+		if (lseek(fd, pos - len, SEEK_SET) < 0) {
+			err(1, "%s: lseek", file);
+		}
+		r = read(fd, buf, len);
+		if (r < 0) {
+			err(1, "%s: read", file);
+		}
+		if ((size_t)r != len) {
+			errx(1, "%s: short read", file);
+		}
+		checkbuf(pos - len, len);
+		total += r;
+	}
+	timer_report("backward", bufsize, total);
+	close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned bufsizes[] = { 512, 4096, MAXBUF };
+	const char *file;
+	off_t size;
+	unsigned i;
+
+	if (argc > 2) {
+		errx(1, "Usage: seqread [file]");
+	}
+	if (argc == 2) {
+		file = argv[1];
+	}
+	else {
+		file = SCRATCHFILE;
+		makescratch();
+		checking = 1;
+	}
+
+	size = 0;
+	for (i=0; i<sizeof(bufsizes)/sizeof(bufsizes[0]); i++) {
+		size = readforward(file, bufsizes[i]);
+	}
+	if (checking && size != SCRATCHSIZE) {
+		errx(1, "%s: got %lld bytes, expected %d", file, size,
+		     SCRATCHSIZE);
+	}
+	readbackward(file, 4096, size);
+
+	if (argc < 2) {
+		if (remove(file) < 0) {
+			err(1, "%s: remove", file);
+		}
+	}
+	if (checking) {
+		/* Everything read back matched what was written. */
+		success(TEST161_SUCCESS, SECRET, "/testbin/seqread");
+	}
+	else {
+		printf("seqread done.\n");
+	}
+	return 0;
+}